@@ -0,0 +1,171 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "allocationcounter.h"
+
+/*!
+ * \class AllocationCounter
+ * \internal
+ *
+ * AllocationCounter counts heap allocations made, by any thread, since it was
+ * created (or last reset). It is used to keep allocations out of hot paths:
+ * tests fail when a kernel allocates more than its budget, and the benchmarks
+ * report allocations per MB and per frame.
+ *
+ * The global operator new is replaced to count allocations. Qt's containers
+ * allocate with malloc() rather than new, so with glibc, malloc(), calloc()
+ * and realloc() are replaced as well, forwarding to glibc's own
+ * implementation. Elsewhere, only operator new is counted (see
+ * countsMalloc()). A realloc() counts as an allocation, whether or not it
+ * moves the block.
+ */
+
+static std::atomic<qint64> s_allocations(0);
+static std::atomic<qint64> s_bytes(0);
+
+static inline void countAllocation(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    s_bytes.fetch_add(qint64(size), std::memory_order_relaxed);
+}
+
+#if defined(__GLIBC__)
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) __THROW
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) __THROW
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) __THROW
+{
+    if (size)
+        countAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+}
+
+static inline void* allocate(size_t size)
+{
+    // malloc() counts it.
+    return malloc(size ? size : 1);
+}
+
+#else
+
+static inline void* allocate(size_t size)
+{
+    countAllocation(size);
+    return std::malloc(size ? size : 1);
+}
+
+#endif
+
+void* operator new(size_t size)
+{
+    void* p = allocate(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = allocate(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+AllocationCounter::AllocationCounter()
+{
+    reset();
+}
+
+void AllocationCounter::reset()
+{
+    m_startAllocations = s_allocations.load(std::memory_order_relaxed);
+    m_startBytes = s_bytes.load(std::memory_order_relaxed);
+}
+
+qint64 AllocationCounter::allocations() const
+{
+    return s_allocations.load(std::memory_order_relaxed) - m_startAllocations;
+}
+
+qint64 AllocationCounter::bytes() const
+{
+    return s_bytes.load(std::memory_order_relaxed) - m_startBytes;
+}
+
+/*!
+ * Whether allocations made by Qt's containers (which use malloc()) are
+ * counted, and not just those made with new.
+ */
+bool AllocationCounter::countsMalloc()
+{
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
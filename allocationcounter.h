@@ -0,0 +1,41 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+// allocationcounter.cpp replaces the global allocation functions, so it is
+// only built into apptest and benchmark, never into literm itself.
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+
+    void reset();
+    qint64 allocations() const;
+    qint64 bytes() const;
+
+    static bool countsMalloc();
+
+private:
+    qint64 m_startAllocations;
+    qint64 m_startBytes;
+};
+
+#endif // ALLOCATIONCOUNTER_H
@@ -2,21 +2,48 @@ SOURCES += \
 	main.cpp \
 	../parser.cpp \
 	../terminal.cpp \
+	../terminalsearch.cpp \
 	../textrender.cpp \
+	../instanceserver.cpp \
+	../keyboarditem.cpp \
+	../keyloader.cpp \
 	../ptyiface.cpp \
-	../utilities.cpp
+	../ptyreactor.cpp \
+	../sessionmanager.cpp \
+	../ptyrecording.cpp \
+	../latencyprobe.cpp \
+	../startupprofile.cpp \
+	../utilities.cpp \
+	../screenimage.cpp \
+	../blinkclock.cpp \
+	../trace.cpp \
+	../allocationcounter.cpp
 
 HEADERS += \
 	../parser.h \
 	../terminal.h \
+	../terminalsearch.h \
+	../testterminal.h \
 	../textrender.h \
+	../instanceserver.h \
+	../keyboarditem.h \
+	../keyloader.h \
 	../ptyiface.h \
+	../ptyreactor.h \
+	../sessionmanager.h \
+	../ptyrecording.h \
+	../latencyprobe.h \
+	../startupprofile.h \
 	../utilities.h \
+	../screenimage.h \
+	../blinkclock.h \
+	../trace.h \
+	../allocationcounter.h \
 	../catch.hpp
 
 INCLUDEPATH += ..
 DEPENDPATH += ..
 
-DEFINES += TEST_MODE
-QT += quick testlib
+DEFINES += TEST_MODE LITERM_TRACING CATCH_CONFIG_ENABLE_BENCHMARKING
+QT += quick testlib network
 LIBS += -lutil
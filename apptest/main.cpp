@@ -1,4 +1,18 @@
-#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_RUNNER
+#include <QGuiApplication>
+#include <QQuickWindow>
 #include <catch.hpp>
 
-// (intentionally blank, catch2 provides main)
+// Rendering, and anything that waits on the event loop, needs a
+// QGuiApplication. It's made once here, for all of the tests, on the
+// offscreen platform unless QT_QPA_PLATFORM says otherwise. Windows use the
+// software scene graph, which ScreenImage needs to grab them unexposed.
+int main(int argc, char* argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+
+    QGuiApplication app(argc, argv);
+    return Catch::Session().run(argc, argv);
+}
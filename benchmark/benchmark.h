@@ -0,0 +1,37 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QStringList>
+
+class QQmlEngine;
+class TextRender;
+
+// A TextRender with plain delegates, as the QML type registered as
+// literm.TextRender. The caller owns it.
+TextRender* createTextRender(QQmlEngine* engine);
+
+int runImageBenchmark(const QStringList& args);
+int runThroughputBenchmark(const QStringList& args);
+int runReplayBenchmark(const QStringList& args);
+int runLatencyBenchmark(const QStringList& args);
+int runSessionsBenchmark(const QStringList& args);
+int runTabsBenchmark(const QStringList& args);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,58 @@
+TEMPLATE = app
+TARGET = benchmark
+CONFIG -= app_bundle
+
+SOURCES += \
+	main.cpp \
+	image.cpp \
+	throughput.cpp \
+	replay.cpp \
+	latency.cpp \
+	sessions.cpp \
+	tabs.cpp \
+	../parser.cpp \
+	../terminal.cpp \
+	../terminalsearch.cpp \
+	../textrender.cpp \
+	../blinkclock.cpp \
+	../ptyiface.cpp \
+	../ptyreactor.cpp \
+	../sessionmanager.cpp \
+	../ptyrecording.cpp \
+	../latencyprobe.cpp \
+	../startupprofile.cpp \
+	../utilities.cpp \
+	../screenimage.cpp \
+	../trace.cpp \
+	../allocationcounter.cpp
+
+HEADERS += \
+	benchmark.h \
+	../parser.h \
+	../terminal.h \
+	../terminalsearch.h \
+	../testterminal.h \
+	../textrender.h \
+	../blinkclock.h \
+	../ptyiface.h \
+	../ptyreactor.h \
+	../sessionmanager.h \
+	../ptyrecording.h \
+	../latencyprobe.h \
+	../startupprofile.h \
+	../utilities.h \
+	../screenimage.h \
+	../trace.h \
+	../allocationcounter.h \
+	../catch.hpp
+
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+DEFINES += DESKTOP_BUILD
+DEFINES += LITERM_SOURCE_DIR=\\\"$$PWD/..\\\"
+
+QT += gui qml quick
+LIBS += -lutil
+
+tracing: DEFINES += LITERM_TRACING
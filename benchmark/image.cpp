@@ -0,0 +1,189 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Shows a set of canned terminal screens in a TextRender, in a window that is
+// never shown, and reports how many frames per second each manages. Each frame
+// rewrites the whole screen and then grabs the window with ScreenImage, so
+// that every row is laid out again and drawn by the software scene graph.
+// The time spent updating the Terminal is reported on its own as well.
+//
+//   benchmark image [-frames N] [-size COLSxROWS] [-dump DIR] [-compare DIR]
+//
+// -dump writes each screen as DIR/<name>.png, to be kept as golden images.
+// -compare draws each screen once and checks it against DIR/<name>.png,
+// exiting with a failure if any of them differ.
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QQuickWindow>
+#include <cstdio>
+
+#include "benchmark.h"
+#include "parser.h"
+#include "screenimage.h"
+#include "terminal.h"
+#include "testterminal.h"
+#include "utilities.h"
+
+struct Screen
+{
+    const char* name;
+    QString (*contents)(QSize size);
+    bool select;
+};
+
+static QString plainText(QSize size)
+{
+    QString out;
+    for (int y = 0; y < size.height(); y++) {
+        for (int x = 0; x < size.width() - 1; x++)
+            out += QChar('a' + (x + y) % 26);
+        out += "\r\n";
+    }
+    return out;
+}
+
+// Every cell a different color, so no two neighbours share a fragment.
+static QString colors(QSize size)
+{
+    QString out;
+    for (int y = 0; y < size.height(); y++) {
+        for (int x = 0; x < size.width() - 1; x++)
+            out += QString("\e[38;5;%1;48;5;%2m#").arg((x + y) % 256).arg((x * 7 + y) % 256);
+        out += "\e[0m\r\n";
+    }
+    return out;
+}
+
+static QString attributes(QSize size)
+{
+    static const char* styles[] = { "\e[1m", "\e[3m", "\e[4m", "\e[5m", "\e[7m", "\e[0m" };
+    QString out;
+    for (int y = 0; y < size.height(); y++) {
+        for (int x = 0; x < size.width() - 1; x += 8)
+            out += QString(styles[(x / 8 + y) % 6]) + "word    ";
+        out += "\e[0m\r\n";
+    }
+    return out;
+}
+
+static QString inverseVideo(QSize size)
+{
+    return "\e[?5h" + plainText(size);
+}
+
+static const Screen screens[] = {
+    { "empty", [](QSize) { return QString(); }, false },
+    { "plain", plainText, false },
+    { "plain-selected", plainText, true },
+    { "colors", colors, false },
+    { "attributes", attributes, false },
+    { "inverse", inverseVideo, false },
+};
+
+int runImageBenchmark(const QStringList& args)
+{
+    int frames = 200;
+    QSize size(80, 25);
+    QString dumpDir;
+    QString compareDir;
+
+    for (int i = 0; i < args.size(); i++) {
+        const QString& arg = args.at(i);
+        bool hasValue = i + 1 < args.size();
+        if (arg == "-frames" && hasValue) {
+            frames = qMax(1, args.at(++i).toInt());
+        } else if (arg == "-size" && hasValue) {
+            QStringList parts = args.at(++i).split('x');
+            if (parts.size() == 2)
+                size = QSize(parts.at(0).toInt(), parts.at(1).toInt());
+        } else if (arg == "-dump" && hasValue) {
+            dumpDir = args.at(++i);
+        } else if (arg == "-compare" && hasValue) {
+            compareDir = args.at(++i);
+        } else {
+            fprintf(stderr, "usage: benchmark image [-frames N] [-size COLSxROWS] [-dump DIR] [-compare DIR]\n");
+            return 2;
+        }
+    }
+
+    // Terminal reads its settings through Util.
+    Util util("");
+    QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+
+    if (!dumpDir.isEmpty())
+        QDir().mkpath(dumpDir);
+
+    int failures = 0;
+    for (const Screen& screen : screens) {
+        const QString contents = screen.contents(size);
+        const QPoint selectionStart(5, 3);
+        const QPoint selectionEnd(size.width() - 5, size.height() - 3);
+
+        TestTerminal terminal;
+        terminal.setTermSize(size);
+        terminal.insertInBuffer(contents);
+        if (screen.select)
+            terminal.setSelection(selectionStart, selectionEnd, false);
+
+        ScreenImage screenImage(&terminal);
+        QImage image = screenImage.grab();
+
+        if (!compareDir.isEmpty()) {
+            QString path = compareDir + "/" + screen.name + ".png";
+            QImage golden(path);
+            int differences = golden.isNull() ? -1 : ScreenImage::compare(image, golden);
+            if (differences != 0) {
+                failures++;
+                if (differences < 0)
+                    printf("%-16s missing %s\n", screen.name, qPrintable(path));
+                else
+                    printf("%-16s FAIL (%d pixels differ)\n", screen.name, differences);
+            } else {
+                printf("%-16s ok\n", screen.name);
+            }
+            continue;
+        }
+
+        if (!dumpDir.isEmpty())
+            image.save(dumpDir + "/" + screen.name + ".png");
+
+        // Writing the same text again still gives each line it covers new
+        // contents, so TextRender can't keep any of the rows it has for them.
+        const QString redraw = "\e[H" + contents;
+        qint64 terminalNsecs = 0;
+        qint64 totalNsecs = 0;
+        QElapsedTimer timer;
+        for (int i = 0; i < frames; i++) {
+            timer.start();
+            terminal.insertInBuffer(redraw);
+            if (screen.select)
+                terminal.setSelection(selectionStart, selectionEnd, false);
+            terminalNsecs += timer.nsecsElapsed();
+            screenImage.grab();
+            totalNsecs += timer.nsecsElapsed();
+        }
+
+        double msPerFrame = totalNsecs / 1e6 / frames;
+        printf("%-16s %8.1f frames/s  %8.3f ms/frame  %8.3f ms in Terminal\n", screen.name,
+            1000.0 / msPerFrame, msPerFrame, terminalNsecs / 1e6 / frames);
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Types into `cat` running in a real pty, and reports how long each key takes
+// to show up on screen, using LatencyProbe.
+//
+//   benchmark latency [-keys N] [-interval MS]
+//
+// Keys are sent to the TextRender as key events, N of them, one every MS
+// milliseconds. The echo comes from the pty itself, as it would at a shell
+// prompt. Results are written as JSON: p50, p99 and max for the whole path and
+// for each stage of it, in milliseconds.
+
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QKeyEvent>
+#include <QQmlEngine>
+#include <QQuickWindow>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <cstdio>
+#include <memory>
+
+#include "benchmark.h"
+#include "latencyprobe.h"
+#include "parser.h"
+#include "textrender.h"
+#include "utilities.h"
+
+int runLatencyBenchmark(const QStringList& args)
+{
+    int keys = 200;
+    int interval = 50;
+
+    for (int i = 0; i < args.size(); i++) {
+        const QString& arg = args.at(i);
+        bool hasValue = i + 1 < args.size();
+        if (arg == "-keys" && hasValue) {
+            keys = qMax(1, args.at(++i).toInt());
+        } else if (arg == "-interval" && hasValue) {
+            interval = qMax(1, args.at(++i).toInt());
+        } else {
+            fprintf(stderr, "usage: benchmark latency [-keys N] [-interval MS]\n");
+            return 2;
+        }
+    }
+
+    QTemporaryDir dir;
+    const QString settingsPath = dir.filePath("settings.ini");
+    {
+        QSettings settings(settingsPath, QSettings::IniFormat);
+        settings.setValue("general/execCmd", "cat");
+    }
+
+    Util util(settingsPath);
+    QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+    qmlRegisterType<TextRender>("literm", 1, 0, "TextRender");
+    QQmlEngine engine;
+
+    // The probe must be on before the item is put in a window.
+    LatencyProbe::setEnabled(true);
+
+    QQuickWindow window;
+    window.resize(800, 600);
+    std::unique_ptr<TextRender> render(createTextRender(&engine));
+    if (!render)
+        return 1;
+    render->setParentItem(window.contentItem());
+    window.show();
+
+    QEventLoop loop;
+
+    // Give cat a moment to start before typing.
+    QTimer::singleShot(500, &loop, &QEventLoop::quit);
+    loop.exec();
+    LatencyProbe::reset();
+
+    int sent = 0;
+    QTimer typing;
+    typing.setInterval(interval);
+    QObject::connect(&typing, &QTimer::timeout, &loop, [&]() {
+        // Type lines of 'a', so that cat has something to echo back as well.
+        bool newline = sent % 40 == 39;
+        QKeyEvent press(QEvent::KeyPress, newline ? Qt::Key_Return : Qt::Key_A, Qt::NoModifier, newline ? "\r" : "a");
+        QCoreApplication::sendEvent(render.get(), &press);
+        if (++sent == keys) {
+            typing.stop();
+            // Leave time for the last echo to be presented.
+            QTimer::singleShot(500, &loop, &QEventLoop::quit);
+        }
+    });
+    typing.start();
+    loop.exec();
+
+    QJsonObject report = LatencyProbe::summary();
+    report["benchmark"] = "latency";
+    report["qtVersion"] = qVersion();
+    report["keys"] = keys;
+    report["interval"] = interval;
+
+    QByteArray json = QJsonDocument(report).toJson();
+    fwrite(json.constData(), 1, json.size(), stdout);
+
+    LatencyProbe::setEnabled(false);
+    return report["samples"].toInt() > 0 ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmarks that need no display: the offscreen platform plugin is used
+// unless QT_QPA_PLATFORM says otherwise.
+//
+//   benchmark image ...       TextRender frames of canned screens
+//   benchmark throughput ...  ingest speed of canned output streams
+//   benchmark replay ...      replay of a recorded session (literm -record)
+//   benchmark latency ...     keypress to screen latency, typing into cat
+//   benchmark sessions ...    many chatty sessions at once
+//   benchmark tabs ...        time to start the child of a new tab
+//
+// In a build with CONFIG+=tracing, `-trace FILE` before the mode writes a
+// trace of the run (see trace.h).
+
+#include <QDebug>
+#include <QGuiApplication>
+#include <QQmlComponent>
+#include <cstdio>
+
+#include "benchmark.h"
+#include "parser.h"
+#include "textrender.h"
+#include "trace.h"
+
+TextRender* createTextRender(QQmlEngine* engine)
+{
+    QQmlComponent component(engine);
+    component.setData(
+        "import QtQuick 2.0\n"
+        "import literm 1.0\n"
+        "TextRender {\n"
+        "    width: 800; height: 600\n"
+        "    font.family: \"monospace\"; font.pointSize: 10\n"
+        "    contentItem: Item {}\n"
+        "    cellDelegate: Rectangle {}\n"
+        "    cellContentsDelegate: Text { textFormat: Text.PlainText }\n"
+        "    cursorDelegate: Rectangle {}\n"
+        "    selectionDelegate: Rectangle {}\n"
+        "}\n",
+        QUrl());
+
+    QObject* object = component.create();
+    TextRender* render = qobject_cast<TextRender*>(object);
+    if (!render) {
+        qWarning() << component.errors();
+        delete object;
+    }
+    return render;
+}
+
+int main(int argc, char* argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication app(argc, argv);
+    QStringList args = app.arguments().mid(1);
+
+    QString tracePath;
+    if (args.size() >= 2 && args.first() == "-trace") {
+        args.removeFirst();
+        tracePath = args.takeFirst();
+    }
+
+    QString mode = args.isEmpty() ? QString() : args.takeFirst();
+    int (*run)(const QStringList&) = 0;
+    if (mode == "image")
+        run = runImageBenchmark;
+    else if (mode == "throughput")
+        run = runThroughputBenchmark;
+    else if (mode == "replay")
+        run = runReplayBenchmark;
+    else if (mode == "latency")
+        run = runLatencyBenchmark;
+    else if (mode == "sessions")
+        run = runSessionsBenchmark;
+    else if (mode == "tabs")
+        run = runTabsBenchmark;
+
+    if (!run) {
+        fprintf(stderr, "usage: %s [-trace FILE] image|throughput|replay|latency|sessions|tabs [options]\n", argv[0]);
+        return 2;
+    }
+
+    if (!tracePath.isEmpty()) {
+#if defined(LITERM_TRACING)
+        if (!Trace::start(tracePath))
+            return 1;
+#else
+        fprintf(stderr, "-trace needs a build with CONFIG+=tracing\n");
+        return 2;
+#endif
+    }
+
+    int result = run(args);
+
+#if defined(LITERM_TRACING)
+    if (Trace::isEnabled() && !Trace::stop())
+        result = 1;
+#endif
+    return result;
+}
@@ -0,0 +1,207 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Replays a session recorded with `literm -record DIR` into a Terminal.
+//
+//   benchmark replay FILE [-realtime] [-screen FILE] [-image FILE]
+//
+// By default the recording is fed in as fast as possible, which is useful for
+// profiling. With -realtime, the original timing between reads is kept.
+//
+// Each chunk read from the pty is decoded and handed to the Terminal the same
+// way PtyIFace does it, but without the dispatch timer in between, so chunks
+// are never merged.
+//
+// The result is written as JSON, including a checksum of the final screen and
+// scrollback contents. Two builds that produce the same checksum for a
+// recording ended up with the same screen. -screen writes the final screen as
+// plain text, and -image saves a picture of it as TextRender draws it (see
+// ScreenImage), to look at the differences when they don't.
+
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQuickWindow>
+#include <QTextCodec>
+#include <QThread>
+#include <cstdio>
+#include <memory>
+
+#include "benchmark.h"
+#include "parser.h"
+#include "ptyrecording.h"
+#include "screenimage.h"
+#include "terminal.h"
+#include "testterminal.h"
+#include "utilities.h"
+
+static void addLines(QCryptographicHash* hash, const TerminalBuffer& buffer)
+{
+    for (int i = 0; i < buffer.size(); i++) {
+        const TerminalLine& line = buffer.at(i);
+        for (int j = 0; j < line.size(); j++) {
+            const TermChar& c = line.at(j);
+            quint32 values[] = { c.c.unicode(), c.fgColor, c.bgColor, quint32(c.attrib) };
+            hash->addData(reinterpret_cast<const char*>(values), sizeof(values));
+        }
+        hash->addData("\n", 1);
+    }
+}
+
+static QByteArray screenChecksum(Terminal* terminal)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    addLines(&hash, terminal->backBuffer());
+    hash.addData("\f", 1);
+    addLines(&hash, terminal->buffer());
+    QPoint cursor = terminal->cursorPos();
+    qint32 position[] = { cursor.x(), cursor.y() };
+    hash.addData(reinterpret_cast<const char*>(position), sizeof(position));
+    return hash.result().toHex();
+}
+
+static QString screenText(const Terminal* terminal)
+{
+    QString out;
+    const TerminalBuffer& buffer = terminal->buffer();
+    for (int i = 0; i < buffer.size(); i++) {
+        QString line;
+        const TerminalLine& l = buffer.at(i);
+        for (int j = 0; j < l.size(); j++)
+            line += l.at(j).c;
+        while (line.endsWith(' '))
+            line.chop(1);
+        out += line + '\n';
+    }
+    return out;
+}
+
+int runReplayBenchmark(const QStringList& args)
+{
+    QString recordingPath;
+    QString screenPath;
+    QString imagePath;
+    bool realtime = false;
+
+    for (int i = 0; i < args.size(); i++) {
+        const QString& arg = args.at(i);
+        bool hasValue = i + 1 < args.size();
+        if (arg == "-realtime") {
+            realtime = true;
+        } else if (arg == "-screen" && hasValue) {
+            screenPath = args.at(++i);
+        } else if (arg == "-image" && hasValue) {
+            imagePath = args.at(++i);
+        } else if (!arg.startsWith('-') && recordingPath.isEmpty()) {
+            recordingPath = arg;
+        } else {
+            recordingPath.clear();
+            break;
+        }
+    }
+
+    if (recordingPath.isEmpty()) {
+        fprintf(stderr, "usage: benchmark replay FILE [-realtime] [-screen FILE] [-image FILE]\n");
+        return 2;
+    }
+
+    QFile file(recordingPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "can't open %s\n", qPrintable(recordingPath));
+        return 1;
+    }
+
+    PtyRecordingReader reader(&file);
+    if (!reader.isValid()) {
+        fprintf(stderr, "%s is not a recording\n", qPrintable(recordingPath));
+        return 1;
+    }
+
+    QTextCodec* codec = QTextCodec::codecForName(reader.charset());
+    if (!codec)
+        codec = QTextCodec::codecForName("UTF-8");
+
+    // Terminal reads its settings through Util.
+    Util util("");
+
+    TestTerminal terminal;
+    terminal.setTermSize(QSize(80, 24));
+
+    // Read everything up front, so that file access doesn't count.
+    QVector<PtyRecordingEvent> events;
+    PtyRecordingEvent event;
+    qint64 bytes = 0;
+    while (reader.readNext(&event)) {
+        events.append(event);
+        bytes += event.data.size();
+    }
+
+    // One decoder for the whole recording, as in PtyIFace, so that a character
+    // split between two reads is decoded once both halves are in.
+    std::unique_ptr<QTextDecoder> decoder(codec->makeDecoder());
+
+    QElapsedTimer timer;
+    timer.start();
+    for (const PtyRecordingEvent& e : qAsConst(events)) {
+        if (realtime) {
+            qint64 wait = e.time - timer.nsecsElapsed() / 1000;
+            if (wait > 0)
+                QThread::usleep(wait);
+        }
+
+        if (e.type == PtyRecordingEvent::Resize)
+            terminal.setTermSize(e.size);
+        else
+            terminal.insertInBuffer(decoder->toUnicode(e.data));
+    }
+    double seconds = timer.nsecsElapsed() / 1e9;
+
+    QJsonObject report;
+    report["benchmark"] = "replay";
+    report["recording"] = recordingPath;
+    report["realtime"] = realtime;
+    report["events"] = events.size();
+    report["bytes"] = bytes;
+    report["seconds"] = seconds;
+    if (seconds > 0)
+        report["mbPerSecond"] = bytes / seconds / (1024 * 1024);
+    report["screenChecksum"] = QString::fromLatin1(screenChecksum(&terminal));
+
+    QByteArray json = QJsonDocument(report).toJson();
+    fwrite(json.constData(), 1, json.size(), stdout);
+
+    if (!screenPath.isEmpty()) {
+        QFile out(screenPath);
+        if (!out.open(QIODevice::WriteOnly) || out.write(screenText(&terminal).toUtf8()) < 0) {
+            fprintf(stderr, "can't write %s\n", qPrintable(screenPath));
+            return 1;
+        }
+    }
+
+    if (!imagePath.isEmpty()) {
+        QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+        ScreenImage screenImage(&terminal);
+        if (!screenImage.grab().save(imagePath)) {
+            fprintf(stderr, "can't write %s\n", qPrintable(imagePath));
+            return 1;
+        }
+    }
+
+    return 0;
+}
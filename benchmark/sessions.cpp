@@ -0,0 +1,143 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runs many chatty sessions at once, each a Terminal with `cat` of the same
+// canned output running in a real pty, and reports how long it takes for all
+// of them to finish:
+//
+//   benchmark sessions [-sessions N] [-size KB]
+//
+// There are no TextRenders, so this measures reading, decoding and parsing
+// only. Results are written as JSON, along with the CPU time used by the
+// process, which covers the reactor thread as well as the GUI thread.
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <sys/resource.h>
+}
+
+#include "benchmark.h"
+#include "parser.h"
+#include "terminal.h"
+#include "utilities.h"
+
+static double cpuSeconds()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int runSessionsBenchmark(const QStringList& args)
+{
+    int sessions = 200;
+    int size = 256;
+
+    for (int i = 0; i < args.size(); i++) {
+        const QString& arg = args.at(i);
+        bool hasValue = i + 1 < args.size();
+        if (arg == "-sessions" && hasValue) {
+            sessions = qMax(1, args.at(++i).toInt());
+        } else if (arg == "-size" && hasValue) {
+            size = qMax(1, args.at(++i).toInt());
+        } else {
+            fprintf(stderr, "usage: benchmark sessions [-sessions N] [-size KB]\n");
+            return 2;
+        }
+    }
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "can't create a temporary directory\n");
+        return 1;
+    }
+
+    QByteArray data;
+    for (int y = 0; data.size() < size * 1024; y++)
+        data += "session output line " + QByteArray::number(y) + " \e[1mwith\e[0m some \e[32mcolor\e[0m in it\n";
+
+    const QString streamPath = dir.filePath("stream");
+    {
+        QFile file(streamPath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+            fprintf(stderr, "can't write %s\n", qPrintable(streamPath));
+            return 1;
+        }
+    }
+
+    const QString settingsPath = dir.filePath("settings.ini");
+    {
+        QSettings settings(settingsPath, QSettings::IniFormat);
+        settings.setValue("general/execCmd", "cat " + streamPath);
+    }
+
+    Util util(settingsPath);
+
+    QEventLoop loop;
+    int running = sessions;
+    std::vector<std::unique_ptr<Terminal>> terminals;
+
+    QElapsedTimer timer;
+    double cpuStart = cpuSeconds();
+    timer.start();
+
+    for (int i = 0; i < sessions; i++) {
+        Terminal* terminal = new Terminal;
+        terminal->setTermSize(QSize(80, 24));
+        QObject::connect(terminal, &Terminal::hangupReceived, &loop, [&]() {
+            if (--running == 0)
+                loop.quit();
+        });
+        terminal->init();
+        terminals.emplace_back(terminal);
+    }
+
+    QTimer::singleShot(300 * 1000, &loop, &QEventLoop::quit);
+    loop.exec();
+
+    double seconds = timer.nsecsElapsed() / 1e9;
+    double cpu = cpuSeconds() - cpuStart;
+    qint64 bytes = qint64(data.size()) * sessions;
+
+    QJsonObject report;
+    report["benchmark"] = "sessions";
+    report["qtVersion"] = qVersion();
+    report["sessions"] = sessions;
+    report["finished"] = sessions - running;
+    report["bytes"] = bytes;
+    report["seconds"] = seconds;
+    report["cpuSeconds"] = cpu;
+    if (seconds > 0)
+        report["mbPerSecond"] = bytes / seconds / (1024 * 1024);
+
+    QByteArray json = QJsonDocument(report).toJson();
+    fwrite(json.constData(), 1, json.size(), stdout);
+
+    return running == 0 ? 0 : 1;
+}
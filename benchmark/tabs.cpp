@@ -0,0 +1,129 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Opens tabs one after the other, each a Terminal running `true` in a real
+// pty, and reports how long starting each child took on the GUI thread:
+//
+//   benchmark tabs [-tabs N] [-ballast MB] [-fork]
+//
+// -ballast makes the process that much bigger first, the way a server with a
+// few windows open is, which is what makes forking slow. -fork starts the
+// children with forkpty() instead of posix_spawn(), for comparison.
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "benchmark.h"
+#include "parser.h"
+#include "ptyiface.h"
+#include "terminal.h"
+#include "utilities.h"
+
+int runTabsBenchmark(const QStringList& args)
+{
+    int tabs = 100;
+    int ballast = 0;
+    bool forkOnly = false;
+
+    for (int i = 0; i < args.size(); i++) {
+        const QString& arg = args.at(i);
+        bool hasValue = i + 1 < args.size();
+        if (arg == "-tabs" && hasValue) {
+            tabs = qMax(1, args.at(++i).toInt());
+        } else if (arg == "-ballast" && hasValue) {
+            ballast = qMax(0, args.at(++i).toInt());
+        } else if (arg == "-fork") {
+            forkOnly = true;
+        } else {
+            fprintf(stderr, "usage: benchmark tabs [-tabs N] [-ballast MB] [-fork]\n");
+            return 2;
+        }
+    }
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "can't create a temporary directory\n");
+        return 1;
+    }
+
+    const QString settingsPath = dir.filePath("settings.ini");
+    {
+        QSettings settings(settingsPath, QSettings::IniFormat);
+        settings.setValue("general/execCmd", "true");
+    }
+
+    Util util(settingsPath);
+    PtyIFace::setForkOnly(forkOnly);
+
+    // Touched, so that it's really mapped.
+    std::vector<char> ballastData(size_t(ballast) * 1024 * 1024);
+    memset(ballastData.data(), 1, ballastData.size());
+
+    std::vector<double> startTimes;
+    QElapsedTimer total;
+    total.start();
+
+    for (int i = 0; i < tabs; i++) {
+        std::unique_ptr<Terminal> terminal(new Terminal);
+        terminal->setTermSize(QSize(80, 24));
+
+        QEventLoop loop;
+        QObject::connect(terminal.get(), &Terminal::hangupReceived, &loop, &QEventLoop::quit);
+        QTimer::singleShot(10 * 1000, &loop, &QEventLoop::quit);
+
+        QElapsedTimer timer;
+        timer.start();
+        terminal->init();
+        startTimes.push_back(timer.nsecsElapsed() / 1e6);
+
+        if (terminal->isRunning())
+            loop.exec();
+    }
+
+    double seconds = total.nsecsElapsed() / 1e9;
+    PtyIFace::setForkOnly(false);
+
+    std::sort(startTimes.begin(), startTimes.end());
+    auto percentile = [&](double p) {
+        return startTimes.at(qMin(int(startTimes.size() * p), int(startTimes.size()) - 1));
+    };
+
+    QJsonObject report;
+    report["benchmark"] = "tabs";
+    report["qtVersion"] = qVersion();
+    report["tabs"] = tabs;
+    report["ballastMb"] = ballast;
+    report["launch"] = forkOnly ? "forkpty" : "posix_spawn";
+    report["startMsP50"] = percentile(0.5);
+    report["startMsP99"] = percentile(0.99);
+    report["startMsMax"] = startTimes.back();
+    report["seconds"] = seconds;
+
+    QByteArray json = QJsonDocument(report).toJson();
+    fwrite(json.constData(), 1, json.size(), stdout);
+    return 0;
+}
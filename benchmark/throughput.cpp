@@ -0,0 +1,316 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Feeds canned output streams through the whole ingest pipeline, and reports
+// how fast each one goes through:
+//
+//   pty -> PtyIFace (decode) -> Terminal::insertInBuffer -> TextRender polish
+//
+// Each stream is written to a file and played by `cat` running in a real pty,
+// with a TextRender showing it in an offscreen window. The stream ends with a
+// window title change that marks it as done.
+//
+//   benchmark throughput [-repeat N] [-o FILE]
+//
+// Results are written as JSON (to FILE, or stdout), so that runs from
+// different builds can be compared. The best of N runs is reported, along with
+// the heap allocations it made per MB of input, and per polished frame.
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQmlEngine>
+#include <QQuickWindow>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <cstdio>
+#include <memory>
+
+#include "allocationcounter.h"
+#include "benchmark.h"
+#include "parser.h"
+#include "textrender.h"
+#include "utilities.h"
+
+static const char doneTitle[] = "literm-benchmark-done";
+
+class CountingTextRender : public TextRender
+{
+    Q_OBJECT
+
+public:
+    static int polishes;
+    static qint64 polishAllocations;
+
+protected:
+    void updatePolish() override
+    {
+        polishes++;
+        AllocationCounter counter;
+        TextRender::updatePolish();
+        polishAllocations += counter.allocations();
+    }
+};
+
+int CountingTextRender::polishes = 0;
+qint64 CountingTextRender::polishAllocations = 0;
+
+static QByteArray plainText()
+{
+    QByteArray out;
+    for (int y = 0; y < 20000; y++) {
+        for (int x = 0; x < 79; x++)
+            out += char('!' + (x * 7 + y) % 94);
+        out += '\n';
+    }
+    return out;
+}
+
+// Like test/16bitcolors.sh: a 24 bit background color for every cell.
+static QByteArray heavySgr()
+{
+    QByteArray out;
+    for (int y = 0; y < 2000; y++) {
+        for (int x = 0; x < 80; x++) {
+            int c = (x * 3 + y) % 256;
+            out += "\e[48;2;" + QByteArray::number(c) + ";" + QByteArray::number(255 - c) + ";" + QByteArray::number((c * 7) % 256) + "m ";
+        }
+        out += "\e[0m\n";
+    }
+    return out;
+}
+
+// Output confined to a scrolling region, as with a status line at the top and
+// bottom of the screen.
+static QByteArray scrollingRegion()
+{
+    QByteArray out = "\e[2J\e[H top status\e[24;1H bottom status\e[2;23r\e[23;1H";
+    for (int y = 0; y < 20000; y++)
+        out += "line " + QByteArray::number(y) + " of output inside the scrolling region\n";
+    out += "\e[r";
+    return out;
+}
+
+// Full screen redraws using cursor addressing, like a TUI application would.
+static QByteArray tuiRedraw()
+{
+    QByteArray out;
+    for (int frame = 0; frame < 500; frame++) {
+        out += "\e[H\e[7m status: frame " + QByteArray::number(frame) + "\e[K\e[0m";
+        for (int row = 2; row <= 24; row++) {
+            out += "\e[" + QByteArray::number(row) + ";1H";
+            out += "\e[3" + QByteArray::number((row + frame) % 8) + "m";
+            out += QByteArray("row ") + QByteArray::number(row) + " value " + QByteArray::number(frame * row);
+            out += "\e[0m\e[K";
+        }
+    }
+    return out;
+}
+
+static QByteArray unicodeText()
+{
+    QFile file(QStringLiteral(LITERM_SOURCE_DIR "/test/emoji.txt"));
+    QByteArray contents;
+    if (file.open(QIODevice::ReadOnly))
+        contents = file.readAll();
+    if (contents.isEmpty())
+        contents = QString::fromUtf8("åäö ÅÄÖ ñ ü ß — “quotes” 日本語のテキスト 한국어 😀 😃 👍 🎉 ☺️\n").toUtf8().repeated(100);
+
+    QByteArray out;
+    while (out.size() < 2 * 1024 * 1024)
+        out += contents;
+    return out;
+}
+
+struct Stream
+{
+    const char* name;
+    QByteArray (*generate)();
+};
+
+static const Stream streams[] = {
+    { "plain", plainText },
+    { "sgr", heavySgr },
+    { "scrolling-region", scrollingRegion },
+    { "tui", tuiRedraw },
+    { "unicode", unicodeText },
+};
+
+struct Result
+{
+    qint64 nsecs;
+    int polishes;
+    qint64 allocations;
+    qint64 polishAllocations;
+    bool finished;
+};
+
+static Result runOnce(QQmlEngine* engine)
+{
+    QQuickWindow window;
+    window.resize(800, 600);
+
+    Result result = { 0, 0, 0, 0, false };
+    QEventLoop loop;
+    QElapsedTimer timer;
+    AllocationCounter counter;
+
+    CountingTextRender::polishes = 0;
+    CountingTextRender::polishAllocations = 0;
+    timer.start();
+
+    // Creating the item starts the child process.
+    std::unique_ptr<TextRender> render(createTextRender(engine));
+    if (!render)
+        return result;
+
+    QObject::connect(render.get(), &TextRender::titleChanged, &loop, [&]() {
+        if (render->title() == doneTitle) {
+            result.nsecs = timer.nsecsElapsed();
+            result.allocations = counter.allocations();
+            result.finished = true;
+            loop.quit();
+        }
+    });
+    QObject::connect(render.get(), &TextRender::hangupReceived, &loop, &QEventLoop::quit);
+    QTimer::singleShot(120 * 1000, &loop, &QEventLoop::quit);
+
+    render->setParentItem(window.contentItem());
+    window.show();
+    loop.exec();
+
+    result.polishes = CountingTextRender::polishes;
+    result.polishAllocations = CountingTextRender::polishAllocations;
+    return result;
+}
+
+int runThroughputBenchmark(const QStringList& args)
+{
+    int repeat = 3;
+    QString outputFile;
+
+    for (int i = 0; i < args.size(); i++) {
+        const QString& arg = args.at(i);
+        bool hasValue = i + 1 < args.size();
+        if (arg == "-repeat" && hasValue) {
+            repeat = qMax(1, args.at(++i).toInt());
+        } else if (arg == "-o" && hasValue) {
+            outputFile = args.at(++i);
+        } else {
+            fprintf(stderr, "usage: benchmark throughput [-repeat N] [-o FILE]\n");
+            return 2;
+        }
+    }
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fprintf(stderr, "can't create a temporary directory\n");
+        return 1;
+    }
+
+    // The child plays whatever is in the stream file, and then stays around so
+    // that the end of the stream isn't raced by the hangup.
+    const QString streamPath = dir.filePath("stream");
+    const QString scriptPath = dir.filePath("play.sh");
+    {
+        QFile script(scriptPath);
+        if (!script.open(QIODevice::WriteOnly))
+            return 1;
+        script.write("cat '" + streamPath.toLocal8Bit() + "'\nexec sleep 600\n");
+    }
+
+    const QString settingsPath = dir.filePath("settings.ini");
+    {
+        QSettings settings(settingsPath, QSettings::IniFormat);
+        settings.setValue("general/execCmd", "sh " + scriptPath);
+    }
+
+    Util util(settingsPath);
+    QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+    qmlRegisterType<CountingTextRender>("literm", 1, 0, "TextRender");
+    QQmlEngine engine;
+
+    QJsonArray results;
+    int failures = 0;
+    for (const Stream& stream : streams) {
+        QByteArray data = stream.generate();
+        data += "\e]2;";
+        data += doneTitle;
+        data += "\a";
+
+        QFile file(streamPath);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size()) {
+            fprintf(stderr, "can't write %s\n", qPrintable(streamPath));
+            return 1;
+        }
+        file.close();
+
+        Result best = { 0, 0, 0, 0, false };
+        for (int i = 0; i < repeat; i++) {
+            Result result = runOnce(&engine);
+            if (!result.finished)
+                continue;
+            if (!best.finished || result.nsecs < best.nsecs)
+                best = result;
+        }
+
+        QJsonObject entry;
+        entry["name"] = stream.name;
+        entry["bytes"] = data.size();
+        entry["lines"] = data.count('\n');
+        entry["finished"] = best.finished;
+        if (best.finished) {
+            double seconds = best.nsecs / 1e9;
+            entry["seconds"] = seconds;
+            entry["mbPerSecond"] = data.size() / seconds / (1024 * 1024);
+            entry["linesPerSecond"] = data.count('\n') / seconds;
+            entry["polishes"] = best.polishes;
+            entry["allocationsPerMB"] = double(best.allocations) * 1024 * 1024 / data.size();
+            if (best.polishes)
+                entry["allocationsPerPolish"] = double(best.polishAllocations) / best.polishes;
+        } else {
+            failures++;
+        }
+        results.append(entry);
+        fprintf(stderr, "%-18s %s\n", stream.name, best.finished ? "done" : "did not finish");
+    }
+
+    QJsonObject report;
+    report["benchmark"] = "throughput";
+    report["qtVersion"] = qVersion();
+    report["repeat"] = repeat;
+    report["streams"] = results;
+
+    QByteArray json = QJsonDocument(report).toJson();
+    if (outputFile.isEmpty()) {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    } else {
+        QFile out(outputFile);
+        if (!out.open(QIODevice::WriteOnly) || out.write(json) != json.size()) {
+            fprintf(stderr, "can't write %s\n", qPrintable(outputFile));
+            return 1;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
+
+#include "throughput.moc"
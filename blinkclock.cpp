@@ -0,0 +1,145 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QGuiApplication>
+#include <QQuickWindow>
+
+#include "blinkclock.h"
+#include "catch.hpp"
+#include "utilities.h"
+
+/*!
+ * \class BlinkClock
+ * \internal
+ *
+ * A BlinkClock provides a single blink phase shared by everything in a window
+ * that blinks: blinking text and the cursor. Users (TextRender instances)
+ * register while they have something on screen that blinks, and the clock only
+ * ticks while it has at least one user and the application is active.
+ *
+ * When the clock stops, the phase is left "on", so that anything that blinks is
+ * shown.
+ */
+
+/*!
+ * Find the clock for \a window, creating it if this is the first time it is
+ * asked for. The clock is owned by the window.
+ */
+BlinkClock* BlinkClock::forWindow(QQuickWindow* window)
+{
+    BlinkClock* clock = window->findChild<BlinkClock*>(QString(), Qt::FindDirectChildrenOnly);
+    if (!clock) {
+        clock = new BlinkClock(window);
+        if (Util* util = Util::instance()) {
+            clock->setInterval(util->blinkInterval());
+            connect(util, &Util::settingsChanged, clock, [clock, util]() { clock->setInterval(util->blinkInterval()); });
+        }
+    }
+    return clock;
+}
+
+BlinkClock::BlinkClock(QObject* parent)
+    : QObject(parent)
+    , m_interval(500)
+    , m_timer(0)
+    , m_on(true)
+{
+    if (qApp)
+        connect(qApp, SIGNAL(applicationStateChanged(Qt::ApplicationState)), this, SLOT(updateRunning()));
+}
+
+void BlinkClock::setInterval(int interval)
+{
+    if (m_interval == interval)
+        return;
+
+    m_interval = interval;
+    if (m_timer) {
+        killTimer(m_timer);
+        m_timer = 0;
+    }
+    updateRunning();
+}
+
+void BlinkClock::addUser(const QObject* user)
+{
+    m_users.insert(user);
+    updateRunning();
+}
+
+void BlinkClock::removeUser(const QObject* user)
+{
+    m_users.remove(user);
+    updateRunning();
+}
+
+void BlinkClock::updateRunning()
+{
+    bool run = !m_users.isEmpty() && m_interval > 0 && QGuiApplication::applicationState() == Qt::ApplicationActive;
+
+    if (run) {
+        if (!m_timer)
+            m_timer = startTimer(m_interval);
+        return;
+    }
+
+    if (m_timer) {
+        killTimer(m_timer);
+        m_timer = 0;
+    }
+    if (!m_on) {
+        m_on = true;
+        emit phaseChanged();
+    }
+}
+
+void BlinkClock::timerEvent(QTimerEvent*)
+{
+    m_on = !m_on;
+    emit phaseChanged();
+}
+
+#if defined(TEST_MODE)
+
+struct BlinkClockTest
+{
+    static BlinkClock* create() { return new BlinkClock; }
+    static void tick(BlinkClock* clock) { clock->timerEvent(nullptr); }
+};
+
+TEST_CASE("BlinkClock: Only runs while it has users")
+{
+    // There are no windows, so the application is never active here, and the
+    // timer itself never starts. Only check the bookkeeping around it.
+    std::unique_ptr<BlinkClock> clock(BlinkClockTest::create());
+    REQUIRE(clock->isOn());
+    REQUIRE(!clock->isRunning());
+
+    QObject a;
+    clock->addUser(&a);
+    REQUIRE(!clock->isRunning());
+
+    BlinkClockTest::tick(clock.get());
+    REQUIRE(!clock->isOn());
+
+    // Stopping always leaves blinking content visible.
+    clock->removeUser(&a);
+    REQUIRE(!clock->isRunning());
+    REQUIRE(clock->isOn());
+}
+
+#endif // TEST_MODE
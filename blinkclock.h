@@ -0,0 +1,66 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLINKCLOCK_H
+#define BLINKCLOCK_H
+
+#include <QObject>
+#include <QSet>
+
+class QQuickWindow;
+
+class BlinkClock : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool on READ isOn NOTIFY phaseChanged)
+
+public:
+    static BlinkClock* forWindow(QQuickWindow* window);
+
+    bool isOn() const { return m_on; }
+
+    int interval() const { return m_interval; }
+    void setInterval(int interval);
+
+    void addUser(const QObject* user);
+    void removeUser(const QObject* user);
+    bool isRunning() const { return m_timer != 0; }
+
+signals:
+    void phaseChanged();
+
+protected:
+    void timerEvent(QTimerEvent* event) override;
+
+private slots:
+    void updateRunning();
+
+private:
+    explicit BlinkClock(QObject* parent = 0);
+    Q_DISABLE_COPY(BlinkClock)
+
+    QSet<const QObject*> m_users;
+    int m_interval;
+    int m_timer;
+    bool m_on;
+
+#if defined(TEST_MODE)
+    friend struct BlinkClockTest;
+#endif
+};
+
+#endif // BLINKCLOCK_H
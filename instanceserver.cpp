@@ -0,0 +1,217 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QRegularExpression>
+#include <QStandardPaths>
+
+#include "catch.hpp"
+#include "instanceserver.h"
+
+/*!
+ * \class InstanceServer
+ * \internal
+ *
+ * InstanceServer lets `literm` hand the window it was asked for to a running
+ * `literm --server`, which has its QML engine loaded already, instead of
+ * starting from scratch.
+ *
+ * A client connects to a local socket in $XDG_RUNTIME_DIR and sends a single
+ * line of JSON with the command (from -e), working directory and environment
+ * to start the terminal with, or asks to attach a detached session (see
+ * SessionManager). The server opens the window, answers "ok", and the client
+ * exits.
+ */
+
+static QByteArray encodeRequest(const PtyLaunchOptions& launch, bool attach)
+{
+    QJsonObject request;
+    request["attach"] = attach;
+    request["command"] = launch.command;
+    request["cwd"] = launch.workingDirectory;
+    request["env"] = QJsonArray::fromStringList(launch.environment);
+    return QJsonDocument(request).toJson(QJsonDocument::Compact) + '\n';
+}
+
+static bool decodeRequest(const QByteArray& line, PtyLaunchOptions* launch, bool* attach)
+{
+    QJsonParseError error;
+    QJsonDocument document = QJsonDocument::fromJson(line, &error);
+    if (error.error != QJsonParseError::NoError || !document.isObject())
+        return false;
+
+    QJsonObject request = document.object();
+    *attach = request["attach"].toBool();
+    launch->command = request["command"].toString();
+    launch->workingDirectory = request["cwd"].toString();
+    launch->environment.clear();
+    for (const QJsonValue& var : request["env"].toArray())
+        launch->environment.append(var.toString());
+    return true;
+}
+
+InstanceServer::InstanceServer(QObject* parent)
+    : QObject(parent)
+{
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    connect(&m_server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+}
+
+/*!
+ * The socket to use, one per display, so that windows open where they were
+ * asked for. Empty if there is no private runtime directory to put it in: a
+ * socket anywhere else (such as /tmp) could be put there first by another
+ * user, who would then be sent our environment.
+ */
+QString InstanceServer::socketPath()
+{
+    QString display = QString::fromLocal8Bit(qgetenv("WAYLAND_DISPLAY"));
+    if (display.isEmpty())
+        display = QString::fromLocal8Bit(qgetenv("DISPLAY"));
+    display.remove(QRegularExpression("[^A-Za-z0-9_-]"));
+
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (dir.isEmpty())
+        return QString();
+    return dir + "/literm-" + display + ".socket";
+}
+
+/*!
+ * Start listening on \a name. Returns false if another server is already
+ * listening there.
+ */
+bool InstanceServer::listen(const QString& name)
+{
+    if (name.isEmpty()) {
+        qWarning() << "No runtime directory to put the literm socket in";
+        return false;
+    }
+
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(1000)) {
+        qWarning() << "literm is already running on" << name;
+        return false;
+    }
+
+    // Left over from a server that didn't get to clean up.
+    QLocalServer::removeServer(name);
+    if (!m_server.listen(name)) {
+        qWarning() << "Can't listen on" << name << m_server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void InstanceServer::onNewConnection()
+{
+    while (QLocalSocket* socket = m_server.nextPendingConnection()) {
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() {
+            if (!socket->canReadLine())
+                return;
+
+            PtyLaunchOptions launch;
+            bool attach = false;
+            if (decodeRequest(socket->readLine(), &launch, &attach)) {
+                emit windowRequested(launch, attach);
+                socket->write("ok\n");
+            }
+            socket->disconnectFromServer();
+        });
+    }
+}
+
+/*!
+ * Ask the server listening on \a name to open a window for \a launch, or
+ * with \a attach, for the most recently detached session. Waits at most
+ * \a timeout milliseconds for each step. Returns false if there's no server
+ * (or no socket for one, see socketPath()), or it didn't answer.
+ */
+bool InstanceServer::requestWindow(const PtyLaunchOptions& launch, bool attach, int timeout, const QString& name)
+{
+    if (name.isEmpty())
+        return false;
+
+    QLocalSocket socket;
+    socket.connectToServer(name);
+    if (!socket.waitForConnected(timeout))
+        return false;
+
+    socket.write(encodeRequest(launch, attach));
+    if (!socket.waitForBytesWritten(timeout))
+        return false;
+
+    while (!socket.canReadLine()) {
+        if (!socket.waitForReadyRead(timeout))
+            return false;
+    }
+    return socket.readLine() == "ok\n";
+}
+
+#if defined(TEST_MODE)
+
+TEST_CASE("InstanceServer: Requests round trip")
+{
+    PtyLaunchOptions launch;
+    launch.command = "vim \"file name\"";
+    launch.workingDirectory = QString::fromUtf8("/tmp/åäö");
+    launch.environment << "PATH=/usr/bin:/bin"
+                       << "EMPTY="
+                       << "WITH_NEWLINE=a\nb";
+
+    QByteArray line = encodeRequest(launch, true);
+    REQUIRE(line.endsWith('\n'));
+    REQUIRE(line.count('\n') == 1);
+
+    PtyLaunchOptions decoded;
+    bool attach = false;
+    REQUIRE(decodeRequest(line, &decoded, &attach));
+    REQUIRE(decoded.command == launch.command);
+    REQUIRE(decoded.workingDirectory == launch.workingDirectory);
+    REQUIRE(decoded.environment == launch.environment);
+    REQUIRE(attach);
+
+    REQUIRE(decodeRequest(encodeRequest(launch, false), &decoded, &attach));
+    REQUIRE(!attach);
+
+    REQUIRE(!decodeRequest("not json\n", &decoded, &attach));
+    REQUIRE(!decodeRequest("[1, 2]\n", &decoded, &attach));
+}
+
+TEST_CASE("InstanceServer: No server")
+{
+    PtyLaunchOptions launch;
+    REQUIRE(!InstanceServer::requestWindow(launch, false, 100, QDir::tempPath() + "/literm-test-nonexistent.socket"));
+}
+
+TEST_CASE("InstanceServer: No socket without a runtime directory")
+{
+    // What socketPath() gives when there's no private place for the socket.
+    PtyLaunchOptions launch;
+    REQUIRE(!InstanceServer::requestWindow(launch, false, 100, QString()));
+
+    InstanceServer server;
+    REQUIRE(!server.listen(QString()));
+}
+
+#endif // TEST_MODE
@@ -0,0 +1,49 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef INSTANCESERVER_H
+#define INSTANCESERVER_H
+
+#include <QLocalServer>
+#include <QObject>
+
+#include "ptyiface.h"
+
+class InstanceServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit InstanceServer(QObject* parent = 0);
+
+    bool listen(const QString& name = socketPath());
+
+    static QString socketPath();
+    static bool requestWindow(const PtyLaunchOptions& launch, bool attach, int timeout, const QString& name = socketPath());
+
+signals:
+    void windowRequested(const PtyLaunchOptions& launch, bool attach);
+
+private slots:
+    void onNewConnection();
+
+private:
+    Q_DISABLE_COPY(InstanceServer)
+
+    QLocalServer m_server;
+};
+
+#endif // INSTANCESERVER_H
@@ -0,0 +1,556 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QFontMetricsF>
+#include <QPainter>
+#include <algorithm>
+
+#if defined(TEST_MODE)
+#    include <QSignalSpy>
+#endif
+
+#include "catch.hpp"
+#include "keyboarditem.h"
+#include "utilities.h"
+
+/*!
+ * \class KeyboardItem
+ * \internal
+ *
+ * KeyboardItem is the on-screen keyboard of the mobile UX as a single item:
+ * it paints every key of the KeyLoader layout into one texture, and does the
+ * hit-testing, sticky modifiers and key repeat of Key.qml in C++. Pressing or
+ * releasing a key only repaints that key; only a change of modifiers, which
+ * changes the labels, repaints the whole keyboard.
+ *
+ * Key.qml delegates are still there for theming (see Util::keyDelegates), in
+ * which case this isn't used.
+ */
+
+KeyboardItem::KeyboardItem(QQuickItem* parent)
+    : QQuickPaintedItem(parent)
+    , m_currentKey(-1)
+    , m_currentSticky(-1)
+    , m_resetSticky(-1)
+    , m_modifiers(0)
+    , m_active(false)
+    , m_keyFgColor("#ffffff")
+    , m_keyBgColor("#202020")
+    , m_keyHilightBgColor("#ffffff")
+    , m_keyBorderColor("#303030")
+    , m_fontSizeSmall(14)
+    , m_fontSizeLarge(24)
+    , m_radius(5)
+    , m_pixelRatio(1)
+    , m_margins(10)
+    , m_keySpacing(6)
+    , m_keyHeight(55)
+{
+    setOpaquePainting(false);
+    setAntialiasing(true);
+
+    m_repeatStarter.setSingleShot(true);
+    m_repeatStarter.setInterval(400);
+    m_repeatTimer.setInterval(80);
+    connect(&m_repeatStarter, SIGNAL(timeout()), this, SLOT(startRepeat()));
+    connect(&m_repeatTimer, SIGNAL(timeout()), this, SLOT(repeat()));
+
+    connect(this, SIGNAL(metricsChanged()), this, SLOT(relayout()));
+    connect(this, &KeyboardItem::appearanceChanged, this, [this]() { update(); });
+}
+
+KeyboardItem::~KeyboardItem()
+{
+}
+
+void KeyboardItem::setLayout(KeyLoader* layout)
+{
+    if (m_layout == layout)
+        return;
+    if (m_layout)
+        disconnect(m_layout, 0, this, 0);
+    m_layout = layout;
+    if (m_layout)
+        connect(m_layout, SIGNAL(layoutLoaded()), this, SLOT(reloadLayout()));
+    reloadLayout();
+    emit layoutChanged();
+}
+
+/*!
+ * Labels are dimmed while inactive.
+ */
+void KeyboardItem::setActive(bool active)
+{
+    if (m_active == active)
+        return;
+    m_active = active;
+    update();
+    emit activeChanged();
+}
+
+void KeyboardItem::reloadLayout()
+{
+    m_repeatStarter.stop();
+    m_repeatTimer.stop();
+    m_touches.clear();
+    m_keys.clear();
+    m_currentKey = -1;
+    m_currentSticky = -1;
+    m_resetSticky = -1;
+
+    if (m_layout) {
+        for (int row = 0; row < m_layout->vkbRows(); row++) {
+            for (int col = 0; col < m_layout->vkbColumns(); col++) {
+                QVariantList data = m_layout->keyAt(row, col);
+                // Rows shorter than the longest are padded with nothing.
+                if (data.at(4).toInt() <= 0)
+                    continue;
+
+                Key key;
+                key.row = row;
+                key.width = data.at(4).toInt();
+                key.label = data.at(0).toString();
+                key.code = data.at(1).toInt();
+                key.labelAlt = data.at(2).toString();
+                key.codeAlt = data.at(3).toInt();
+                key.sticky = data.at(5).toBool();
+                key.becomesSticky = false;
+                key.stickiness = 0;
+                key.pressed = false;
+                m_keys.append(key);
+            }
+        }
+    }
+
+    setModifiers(0);
+    relayout();
+    emit pressedKeyChanged();
+}
+
+void KeyboardItem::geometryChanged(const QRectF& newGeometry, const QRectF& oldGeometry)
+{
+    QQuickPaintedItem::geometryChanged(newGeometry, oldGeometry);
+    if (newGeometry.width() != oldGeometry.width())
+        relayout();
+}
+
+/*!
+ * \internal
+ *
+ * Lay the keys out the way Keyboard.qml's rows of Key delegates are: rows
+ * centered as a block, key widths in units of the widest row, and the height
+ * of the rows plus the margin as our implicit height.
+ */
+void KeyboardItem::relayout()
+{
+    int rows = m_layout ? m_layout->vkbRows() : 0;
+    int columns = m_layout ? m_layout->vkbColumns() : 0;
+    if (rows <= 0 || columns <= 0) {
+        setImplicitHeight(0);
+        update();
+        return;
+    }
+
+    qreal unit = (width() - m_keySpacing * columns - m_margins * 2) / columns;
+    QVector<qreal> rowWidths(rows, 0);
+    for (Key& key : m_keys) {
+        qreal keyWidth = unit * key.width + (key.width - 1) * m_keySpacing + 1;
+        qreal x = rowWidths.at(key.row);
+        if (x > 0)
+            x += m_keySpacing;
+        key.rect = QRectF(x, key.row * (m_keyHeight + m_keySpacing), keyWidth, m_keyHeight);
+        rowWidths[key.row] = x + keyWidth;
+    }
+
+    qreal widest = *std::max_element(rowWidths.constBegin(), rowWidths.constEnd());
+    qreal left = (width() - widest) / 2;
+    for (Key& key : m_keys)
+        key.rect.translate(left, 0);
+
+    setImplicitHeight(rows * m_keyHeight + (rows - 1) * m_keySpacing + m_margins);
+    update();
+}
+
+int KeyboardItem::keyAt(const QPointF& pos) const
+{
+    for (int i = 0; i < m_keys.size(); i++) {
+        if (m_keys.at(i).rect.contains(pos))
+            return i;
+    }
+    return -1;
+}
+
+bool KeyboardItem::shiftActive(const Key& key) const
+{
+    return (m_modifiers & Qt::ShiftModifier) && !key.sticky;
+}
+
+int KeyboardItem::currentCode(const Key& key) const
+{
+    return shiftActive(key) && !key.labelAlt.isEmpty() ? key.codeAlt : key.code;
+}
+
+QString KeyboardItem::currentLabel(const Key& key) const
+{
+    return shiftActive(key) && !key.labelAlt.isEmpty() ? key.labelAlt : key.label;
+}
+
+/*!
+ * The single character label of the key being pressed, to show bigger above
+ * it. Empty for anything else.
+ */
+QString KeyboardItem::pressedLabel() const
+{
+    if (m_currentKey < 0)
+        return QString();
+    QString label = currentLabel(m_keys.at(m_currentKey));
+    return label.length() == 1 && label != " " ? label : QString();
+}
+
+QRectF KeyboardItem::pressedKeyRect() const
+{
+    return m_currentKey < 0 ? QRectF() : m_keys.at(m_currentKey).rect;
+}
+
+bool KeyboardItem::press(int pointId, qreal x, qreal y)
+{
+    int index = keyAt(QPointF(x, y));
+    if (index < 0)
+        return false;
+
+    Key& key = m_keys[index];
+    key.pressed = true;
+    m_touches.insert(pointId, index);
+    setCurrentKey(index);
+    updateKey(index);
+    Util::instance()->keyPressFeedback();
+
+    m_repeatTimer.stop();
+    m_repeatStarter.start();
+
+    if (key.sticky) {
+        key.becomesSticky = true;
+        m_currentSticky = index;
+        setModifiers(m_modifiers | key.code);
+    } else if (m_currentSticky >= 0) {
+        // Pressing a non-sticky key while a sticky key is pressed: the sticky
+        // key will not become sticky when released.
+        m_keys[m_currentSticky].becomesSticky = false;
+    }
+    return true;
+}
+
+void KeyboardItem::move(int pointId, qreal x, qreal y)
+{
+    auto it = m_touches.find(pointId);
+    if (it == m_touches.end())
+        return;
+
+    // Sliding off a key releases it.
+    QPointF pos(x, y);
+    int index = *it;
+    if (!m_keys.at(index).rect.contains(pos)) {
+        m_touches.erase(it);
+        releaseKey(index, pos);
+    }
+}
+
+void KeyboardItem::release(int pointId, qreal x, qreal y)
+{
+    auto it = m_touches.find(pointId);
+    if (it == m_touches.end())
+        return;
+
+    int index = *it;
+    m_touches.erase(it);
+    releaseKey(index, QPointF(x, y));
+}
+
+void KeyboardItem::releaseKey(int index, const QPointF& pos)
+{
+    Key& key = m_keys[index];
+    if (index == m_currentKey) {
+        m_repeatStarter.stop();
+        m_repeatTimer.stop();
+    }
+    key.pressed = false;
+    updateKey(index);
+    setCurrentKey(-1);
+
+    if (key.sticky && !key.becomesSticky) {
+        m_currentSticky = -1;
+        setModifiers(m_modifiers & ~key.code);
+    }
+
+    if (keyAt(pos) != index)
+        return;
+
+    Util::instance()->keyReleaseFeedback();
+
+    if (key.sticky && key.becomesSticky)
+        setStickiness(index, -1);
+
+    if (shiftActive(key) && key.codeAlt != 0 && key.codeAlt != key.code) {
+        // Do not apply shift on alt codes that are accessible only with
+        // shift.
+        emit keyPressed(currentCode(key), m_modifiers & ~Qt::ShiftModifier);
+    } else {
+        emit keyPressed(currentCode(key), m_modifiers);
+    }
+
+    // The first non-sticky press releases a modifier stuck until then.
+    if (!key.sticky && m_resetSticky >= 0 && m_resetSticky != index)
+        setStickiness(m_resetSticky, 0);
+}
+
+/*!
+ * \internal
+ *
+ * Set how a modifier sticks, or with -1, go on to the next: not, until the
+ * next key, until pressed again.
+ */
+void KeyboardItem::setStickiness(int index, int stickiness)
+{
+    Key& key = m_keys[index];
+    if (!key.sticky)
+        return;
+
+    if (m_resetSticky >= 0 && m_resetSticky != index)
+        setStickiness(m_resetSticky, 0);
+
+    key.stickiness = stickiness == -1 ? (key.stickiness + 1) % 3 : stickiness;
+    m_resetSticky = key.stickiness == 1 ? index : -1;
+    updateKey(index);
+
+    if (key.stickiness > 0)
+        setModifiers(m_modifiers | key.code);
+    else
+        setModifiers(m_modifiers & ~key.code);
+}
+
+void KeyboardItem::setModifiers(int modifiers)
+{
+    if (m_modifiers == modifiers)
+        return;
+    m_modifiers = modifiers;
+    // Shift changes the labels.
+    update();
+    emit keyModifiersChanged();
+}
+
+void KeyboardItem::setCurrentKey(int index)
+{
+    if (m_currentKey == index)
+        return;
+    m_currentKey = index;
+    emit pressedKeyChanged();
+}
+
+void KeyboardItem::updateKey(int index)
+{
+    update(m_keys.at(index).rect.toAlignedRect().adjusted(-1, -1, 1, 1));
+}
+
+void KeyboardItem::startRepeat()
+{
+    repeat();
+    m_repeatTimer.start();
+}
+
+void KeyboardItem::repeat()
+{
+    if (m_currentKey < 0) {
+        m_repeatTimer.stop();
+        return;
+    }
+    emit keyPressed(currentCode(m_keys.at(m_currentKey)), m_modifiers);
+}
+
+QImage KeyboardItem::icon(const QString& name)
+{
+    auto it = m_icons.find(name);
+    if (it == m_icons.end())
+        it = m_icons.insert(name, QImage(":/icons/" + name + ".png"));
+    return *it;
+}
+
+void KeyboardItem::paint(QPainter* painter)
+{
+    painter->setRenderHint(QPainter::Antialiasing);
+
+    // Only what was updated, when that's a single key.
+    QRectF dirty = painter->hasClipping() ? painter->clipBoundingRect() : boundingRect();
+    for (const Key& key : qAsConst(m_keys)) {
+        if (key.rect.intersects(dirty))
+            paintKey(painter, key);
+    }
+}
+
+void KeyboardItem::paintKey(QPainter* painter, const Key& key)
+{
+    // [] is a gap.
+    if (key.label.isEmpty())
+        return;
+
+    painter->save();
+    painter->setPen(QPen(m_keyBorderColor, 1));
+    painter->setBrush(key.pressed ? m_keyHilightBgColor : m_keyBgColor);
+    painter->drawRoundedRect(key.rect.adjusted(0.5, 0.5, -0.5, -0.5), m_radius, m_radius);
+
+    if (key.sticky && key.stickiness > 0) {
+        QRectF stuck = key.rect;
+        if (key.stickiness == 1)
+            stuck.setTop(stuck.center().y());
+        painter->setOpacity(0.5);
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(m_keyHilightBgColor);
+        painter->drawRoundedRect(stuck, m_radius, m_radius);
+    }
+
+    qreal labelOpacity = m_active ? 1.0 : 0.3;
+
+    if (key.label.length() > 1 && key.label.startsWith(':')) {
+        QImage image = icon(key.label.mid(1));
+        QSizeF size = QSizeF(image.size()) * m_pixelRatio;
+        QRectF target(key.rect.center() - QPointF(size.width(), size.height()) / 2, size);
+        painter->setOpacity(labelOpacity);
+        painter->drawImage(target, image);
+        painter->restore();
+        return;
+    }
+
+    bool shift = shiftActive(key);
+    QString label = key.label;
+    if (key.label.length() == 1 && key.labelAlt.isEmpty())
+        label = shift ? label.toUpper() : label.toLower();
+    bool labelHighlighted = key.labelAlt.isEmpty() || !shift;
+
+    auto fontFor = [this](const QString& text, bool highlighted) {
+        QFont font(m_fontFamily);
+        font.setPointSizeF((highlighted ? m_fontSizeLarge : m_fontSizeSmall) * (text.length() > 1 ? 0.5 : 1.0));
+        return font;
+    };
+
+    painter->setPen(m_keyFgColor);
+    if (key.labelAlt.isEmpty()) {
+        painter->setOpacity(labelOpacity);
+        painter->setFont(fontFor(label, true));
+        painter->drawText(key.rect, Qt::AlignCenter, label);
+    } else {
+        // The alternative above the label, overlapping a little, as in Key.qml.
+        QFont altFont = fontFor(key.labelAlt, shift);
+        QFont labelFont = fontFor(label, labelHighlighted);
+        qreal altHeight = QFontMetricsF(altFont).height();
+        qreal labelHeight = QFontMetricsF(labelFont).height();
+        qreal overlap = 17 * m_pixelRatio;
+        qreal top = key.rect.center().y() - (altHeight + labelHeight - overlap) / 2;
+
+        painter->setOpacity(labelOpacity * (shift ? 1.0 : 0.2));
+        painter->setFont(altFont);
+        painter->drawText(QRectF(key.rect.left(), top, key.rect.width(), altHeight), Qt::AlignCenter, key.labelAlt);
+
+        painter->setOpacity(labelOpacity * (labelHighlighted ? 1.0 : 0.2));
+        painter->setFont(labelFont);
+        painter->drawText(QRectF(key.rect.left(), top + altHeight - overlap, key.rect.width(), labelHeight), Qt::AlignCenter, label);
+    }
+
+    painter->restore();
+}
+
+#if defined(TEST_MODE)
+
+struct KeyboardItemTest
+{
+    static void addKey(KeyboardItem* item, const QString& label, int code, const QString& labelAlt, int codeAlt, bool sticky)
+    {
+        KeyboardItem::Key key;
+        key.row = 0;
+        key.width = 1;
+        key.label = label;
+        key.code = code;
+        key.labelAlt = labelAlt;
+        key.codeAlt = codeAlt;
+        key.sticky = sticky;
+        key.becomesSticky = false;
+        key.stickiness = 0;
+        key.pressed = false;
+        key.rect = QRectF(item->m_keys.size() * 10, 0, 10, 10);
+        item->m_keys.append(key);
+    }
+};
+
+TEST_CASE("KeyboardItem: Keys and sticky modifiers")
+{
+    if (Util::instance() == nullptr)
+        new Util("");
+
+    KeyboardItem item;
+    KeyboardItemTest::addKey(&item, ":shift", Qt::ShiftModifier, "", 0, true);
+    KeyboardItemTest::addKey(&item, "a", Qt::Key_A, "", 0, false);
+    KeyboardItemTest::addKey(&item, "1", Qt::Key_1, "!", Qt::Key_Exclam, false);
+    QSignalSpy keys(&item, &KeyboardItem::keyPressed);
+
+    auto tap = [&](qreal x) {
+        REQUIRE(item.press(1, x, 5));
+        item.release(1, x, 5);
+    };
+
+    tap(15);
+    REQUIRE(keys.count() == 1);
+    REQUIRE(keys.at(0) == QVariantList({ int(Qt::Key_A), 0 }));
+
+    // Nothing there.
+    REQUIRE(!item.press(2, 100, 5));
+
+    // Sliding off a key doesn't type it.
+    REQUIRE(item.press(1, 15, 5));
+    REQUIRE(item.pressedLabel() == "a");
+    item.move(1, 25, 5);
+    REQUIRE(item.pressedLabel().isEmpty());
+    item.release(1, 25, 5);
+    REQUIRE(keys.count() == 1);
+
+    // Shift sticks until the next key, which it applies to.
+    tap(5);
+    REQUIRE(item.keyModifiers() == int(Qt::ShiftModifier));
+    REQUIRE(keys.count() == 2);
+    tap(25);
+    REQUIRE(keys.at(2) == QVariantList({ int(Qt::Key_Exclam), 0 }));
+    REQUIRE(item.keyModifiers() == 0);
+
+    // Twice locks it.
+    tap(5);
+    tap(5);
+    tap(15);
+    tap(15);
+    REQUIRE(item.keyModifiers() == int(Qt::ShiftModifier));
+    REQUIRE(keys.at(5) == QVariantList({ int(Qt::Key_A), int(Qt::ShiftModifier) }));
+    REQUIRE(keys.at(6) == QVariantList({ int(Qt::Key_A), int(Qt::ShiftModifier) }));
+    tap(5);
+    REQUIRE(item.keyModifiers() == 0);
+
+    // Held down along with another key, it doesn't stick.
+    REQUIRE(item.press(1, 5, 5));
+    REQUIRE(item.press(2, 15, 5));
+    item.release(2, 15, 5);
+    item.release(1, 5, 5);
+    REQUIRE(keys.at(keys.count() - 2) == QVariantList({ int(Qt::Key_A), int(Qt::ShiftModifier) }));
+    REQUIRE(item.keyModifiers() == 0);
+    REQUIRE(item.pressedLabel().isEmpty());
+}
+
+#endif // TEST_MODE
@@ -0,0 +1,154 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEYBOARDITEM_H
+#define KEYBOARDITEM_H
+
+#include <QColor>
+#include <QHash>
+#include <QImage>
+#include <QPointer>
+#include <QQuickPaintedItem>
+#include <QTimer>
+#include <QVector>
+
+#include "keyloader.h"
+
+class KeyboardItem : public QQuickPaintedItem
+{
+    Q_OBJECT
+    Q_PROPERTY(KeyLoader* layout READ layout WRITE setLayout NOTIFY layoutChanged)
+    Q_PROPERTY(bool active READ isActive WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(int keyModifiers READ keyModifiers NOTIFY keyModifiersChanged)
+    Q_PROPERTY(QString pressedLabel READ pressedLabel NOTIFY pressedKeyChanged)
+    Q_PROPERTY(QRectF pressedKeyRect READ pressedKeyRect NOTIFY pressedKeyChanged)
+
+    // Looks, as in Key.qml.
+    Q_PROPERTY(QColor keyFgColor MEMBER m_keyFgColor NOTIFY appearanceChanged)
+    Q_PROPERTY(QColor keyBgColor MEMBER m_keyBgColor NOTIFY appearanceChanged)
+    Q_PROPERTY(QColor keyHilightBgColor MEMBER m_keyHilightBgColor NOTIFY appearanceChanged)
+    Q_PROPERTY(QColor keyBorderColor MEMBER m_keyBorderColor NOTIFY appearanceChanged)
+    Q_PROPERTY(QString fontFamily MEMBER m_fontFamily NOTIFY appearanceChanged)
+    Q_PROPERTY(qreal fontSizeSmall MEMBER m_fontSizeSmall NOTIFY appearanceChanged)
+    Q_PROPERTY(qreal fontSizeLarge MEMBER m_fontSizeLarge NOTIFY appearanceChanged)
+    Q_PROPERTY(qreal radius MEMBER m_radius NOTIFY appearanceChanged)
+    Q_PROPERTY(qreal pixelRatio MEMBER m_pixelRatio NOTIFY appearanceChanged)
+
+    // Geometry, as in Keyboard.qml.
+    Q_PROPERTY(int margins MEMBER m_margins NOTIFY metricsChanged)
+    Q_PROPERTY(int keySpacing MEMBER m_keySpacing NOTIFY metricsChanged)
+    Q_PROPERTY(int keyHeight MEMBER m_keyHeight NOTIFY metricsChanged)
+
+public:
+    explicit KeyboardItem(QQuickItem* parent = 0);
+    virtual ~KeyboardItem();
+
+    KeyLoader* layout() const { return m_layout; }
+    void setLayout(KeyLoader* layout);
+
+    bool isActive() const { return m_active; }
+    void setActive(bool active);
+
+    int keyModifiers() const { return m_modifiers; }
+    QString pressedLabel() const;
+    QRectF pressedKeyRect() const;
+
+    // Touch points, by id, in our coordinates.
+    Q_INVOKABLE bool press(int pointId, qreal x, qreal y);
+    Q_INVOKABLE void move(int pointId, qreal x, qreal y);
+    Q_INVOKABLE void release(int pointId, qreal x, qreal y);
+
+    void paint(QPainter* painter) override;
+
+signals:
+    void layoutChanged();
+    void activeChanged();
+    void keyModifiersChanged();
+    void pressedKeyChanged();
+    void appearanceChanged();
+    void metricsChanged();
+    void keyPressed(int code, int modifiers);
+
+protected:
+    void geometryChanged(const QRectF& newGeometry, const QRectF& oldGeometry) override;
+
+private slots:
+    void relayout();
+    void reloadLayout();
+    void startRepeat();
+    void repeat();
+
+private:
+    Q_DISABLE_COPY(KeyboardItem)
+    friend struct KeyboardItemTest;
+
+    struct Key
+    {
+        QRectF rect;
+        int row;
+        int width; // in keys
+        QString label;
+        QString labelAlt;
+        int code;
+        int codeAlt;
+        bool sticky; // a modifier, which can be made to stick
+        bool becomesSticky;
+        int stickiness; // 0: no, 1: until the next key, 2: until pressed again
+        bool pressed;
+    };
+
+    int keyAt(const QPointF& pos) const;
+    bool shiftActive(const Key& key) const;
+    int currentCode(const Key& key) const;
+    QString currentLabel(const Key& key) const;
+
+    void releaseKey(int index, const QPointF& pos);
+    void setStickiness(int index, int stickiness);
+    void setModifiers(int modifiers);
+    void setCurrentKey(int index);
+    void updateKey(int index);
+
+    void paintKey(QPainter* painter, const Key& key);
+    QImage icon(const QString& name);
+
+    QPointer<KeyLoader> m_layout;
+    QVector<Key> m_keys;
+    QHash<int, int> m_touches; // key by touch point
+    int m_currentKey;          // the last one pressed, for repeat and feedback
+    int m_currentSticky;       // a modifier being held
+    int m_resetSticky;         // a modifier to unstick after the next key
+    int m_modifiers;
+    bool m_active;
+    QTimer m_repeatStarter;
+    QTimer m_repeatTimer;
+    QHash<QString, QImage> m_icons;
+
+    QColor m_keyFgColor;
+    QColor m_keyBgColor;
+    QColor m_keyHilightBgColor;
+    QColor m_keyBorderColor;
+    QString m_fontFamily;
+    qreal m_fontSizeSmall;
+    qreal m_fontSizeLarge;
+    qreal m_radius;
+    qreal m_pixelRatio;
+    int m_margins;
+    int m_keySpacing;
+    int m_keyHeight;
+};
+
+#endif // KEYBOARDITEM_H
@@ -16,15 +16,129 @@
 */
 
 #include <QDebug>
+#include <QSaveFile>
 #include <QtCore>
 
+#include "catch.hpp"
 #include "keyloader.h"
 #include "utilities.h"
 
+// A layout is parsed from its .layout file once, and compiled into a
+// .layoutcache next to it, which later loads map as they are. It holds a
+// header, a rows x columns grid of keys (short rows padded with empty keys),
+// and the UTF-16 of all labels. It's in native byte order, as it never leaves
+// the machine, and is recompiled whenever the .layout changes.
+struct CompiledHeader
+{
+    char magic[4];
+    quint32 version;
+    qint64 sourceTime; // mtime of the .layout, in ms
+    qint64 sourceSize;
+    quint32 sourceHash;
+    quint32 rows;
+    quint32 columns;
+    quint32 stringLength; // in UTF-16 code units
+};
+
+struct CompiledKey
+{
+    qint32 code;
+    qint32 codeAlt;
+    quint32 label; // offset into the strings
+    quint32 labelAlt;
+    quint16 labelLength;
+    quint16 labelAltLength;
+    quint16 width;
+    quint16 isModifier;
+};
+
+static const char compiledMagic[4] = { 'L', 'T', 'K', 'L' };
+static const quint32 compiledVersion = 1;
+
+// FNV-1a, which unlike qHash() is the same from one run to the next.
+static quint32 hashSource(const QByteArray& source)
+{
+    quint32 hash = 2166136261u;
+    for (char c : source) {
+        hash ^= uchar(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static QByteArray compileLayout(const QList<QList<KeyData>>& keyData, qint64 sourceTime, const QByteArray& source)
+{
+    int columns = 0;
+    for (const QList<KeyData>& row : keyData)
+        columns = qMax(columns, row.count());
+
+    QVector<CompiledKey> keys(keyData.count() * columns, CompiledKey());
+    QString strings;
+    for (int row = 0; row < keyData.count(); row++) {
+        for (int col = 0; col < keyData.at(row).count(); col++) {
+            const KeyData& from = keyData.at(row).at(col);
+            CompiledKey& key = keys[row * columns + col];
+            key.code = from.code;
+            key.codeAlt = from.code_alt;
+            key.label = strings.size();
+            key.labelLength = from.label.size();
+            strings += from.label;
+            key.labelAlt = strings.size();
+            key.labelAltLength = from.label_alt.size();
+            strings += from.label_alt;
+            key.width = from.width;
+            key.isModifier = from.isModifier;
+        }
+    }
+
+    CompiledHeader header;
+    memcpy(header.magic, compiledMagic, sizeof(header.magic));
+    header.version = compiledVersion;
+    header.sourceTime = sourceTime;
+    header.sourceSize = source.size();
+    header.sourceHash = hashSource(source);
+    header.rows = keyData.count();
+    header.columns = columns;
+    header.stringLength = strings.size();
+
+    QByteArray compiled;
+    compiled.reserve(sizeof(header) + keys.size() * sizeof(CompiledKey) + strings.size() * sizeof(QChar));
+    compiled.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    compiled.append(reinterpret_cast<const char*>(keys.constData()), keys.size() * sizeof(CompiledKey));
+    compiled.append(reinterpret_cast<const char*>(strings.constData()), strings.size() * sizeof(QChar));
+    return compiled;
+}
+
+// The header of \a data, if it is a whole compiled layout that's safe to use.
+static const CompiledHeader* validCompiled(const uchar* data, qint64 size)
+{
+    if (!data || size < qint64(sizeof(CompiledHeader)))
+        return 0;
+
+    const CompiledHeader* header = reinterpret_cast<const CompiledHeader*>(data);
+    if (memcmp(header->magic, compiledMagic, sizeof(header->magic)) != 0 || header->version != compiledVersion)
+        return 0;
+    if (header->rows == 0 || header->columns == 0 || header->rows > 1000 || header->columns > 1000)
+        return 0;
+
+    qint64 keyCount = qint64(header->rows) * header->columns;
+    if (size != qint64(sizeof(CompiledHeader)) + keyCount * qint64(sizeof(CompiledKey)) + qint64(header->stringLength) * qint64(sizeof(QChar)))
+        return 0;
+
+    const CompiledKey* keys = reinterpret_cast<const CompiledKey*>(header + 1);
+    for (qint64 i = 0; i < keyCount; i++) {
+        if (keys[i].label + quint64(keys[i].labelLength) > header->stringLength
+            || keys[i].labelAlt + quint64(keys[i].labelAltLength) > header->stringLength)
+            return 0;
+    }
+    return header;
+}
+
 KeyLoader::KeyLoader(QObject* parent)
     : QObject(parent)
     , iVkbRows(0)
     , iVkbColumns(0)
+    , m_layout(0)
     , iUtil(0)
 {
 }
@@ -33,32 +147,113 @@ KeyLoader::~KeyLoader()
 {
 }
 
+/*!
+ * Load \a layout, either a resource path or a layout name in the config
+ * directory. Emits layoutLoaded() when the layout has changed, which it has
+ * (to none) if loading failed.
+ */
 bool KeyLoader::loadLayout(QString layout)
 {
-    bool ret = false;
     if (layout.isEmpty() || !iUtil)
         return false;
 
-    if (layout.at(0) == ':') { // load from resources
-        QResource res(layout);
-        QByteArray resArr(reinterpret_cast<const char*>(res.data()));
-        QBuffer resBuf(&resArr);
-        ret = loadLayoutInternal(resBuf);
-    } else { // load from file
-        QFile f(iUtil->configPath() + "/" + layout + ".layout");
-        ret = loadLayoutInternal(f);
+    bool ok;
+    if (layout.at(0) == ':') { // load from resources, which are in memory already
+        unload();
+        QFile res(layout);
+        ok = false;
+        if (res.open(QIODevice::ReadOnly)) {
+            QByteArray source = res.readAll();
+            QList<QList<KeyData>> keyData;
+            ok = parseLayout(source, &keyData) && useCompiled(compileLayout(keyData, 0, source));
+        }
+    } else {
+        QString path = iUtil->configPath() + "/" + layout;
+        ok = loadLayoutFile(path + ".layout", path + ".layoutcache");
     }
 
-    return ret;
+    emit layoutLoaded();
+    return ok;
 }
 
-bool KeyLoader::loadLayoutInternal(QIODevice& from)
+/*!
+ * \internal
+ *
+ * Load the layout at \a sourcePath, from the compiled one at \a cachePath if
+ * that is up to date, or else by parsing it, and writing the cache for the
+ * next time.
+ */
+bool KeyLoader::loadLayoutFile(const QString& sourcePath, const QString& cachePath)
 {
-    iKeyData.clear();
-    bool ret = true;
+    unload();
+
+    QFile sourceFile(sourcePath);
+    if (!sourceFile.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray source = sourceFile.readAll();
+    qint64 sourceTime = QFileInfo(sourceFile).lastModified().toMSecsSinceEpoch();
+
+    m_cacheFile.setFileName(cachePath);
+    if (m_cacheFile.open(QIODevice::ReadOnly)) {
+        const uchar* data = m_cacheFile.map(0, m_cacheFile.size());
+        const CompiledHeader* header = validCompiled(data, m_cacheFile.size());
+        if (header
+            && header->sourceTime == sourceTime
+            && header->sourceSize == source.size()
+            && header->sourceHash == hashSource(source)) {
+            setLayout(data);
+            return true;
+        }
+        m_cacheFile.close();
+    }
+
+    QList<QList<KeyData>> keyData;
+    if (!parseLayout(source, &keyData))
+        return false;
+
+    QByteArray compiled = compileLayout(keyData, sourceTime, source);
+    QSaveFile cache(cachePath);
+    if (!cache.open(QIODevice::WriteOnly) || cache.write(compiled) != compiled.size() || !cache.commit())
+        qWarning() << "Could not write keyboard layout cache" << cachePath;
+
+    return useCompiled(compiled);
+}
+
+bool KeyLoader::useCompiled(const QByteArray& compiled)
+{
+    const uchar* data = reinterpret_cast<const uchar*>(compiled.constData());
+    if (!validCompiled(data, compiled.size()))
+        return false;
 
+    m_compiled = compiled;
+    setLayout(reinterpret_cast<const uchar*>(m_compiled.constData()));
+    return true;
+}
+
+void KeyLoader::setLayout(const uchar* layout)
+{
+    const CompiledHeader* header = reinterpret_cast<const CompiledHeader*>(layout);
+    m_layout = layout;
+    iVkbRows = header->rows;
+    iVkbColumns = header->columns;
+}
+
+void KeyLoader::unload()
+{
+    m_layout = 0;
     iVkbRows = 0;
     iVkbColumns = 0;
+    m_compiled.clear();
+    m_cacheFile.close(); // unmaps it
+}
+
+bool KeyLoader::parseLayout(const QByteArray& source, QList<QList<KeyData>>* keyData)
+{
+    QBuffer from;
+    from.setData(source);
+    bool ret = true;
+
+    int columns = 0;
     bool lastLineHadKey = false;
 
     if (!from.open(QIODevice::ReadOnly | QIODevice::Text))
@@ -121,10 +316,10 @@ bool KeyLoader::loadLayoutInternal(QIODevice& from)
             cleanUpKey(key);
             keyRow.append(key);
         } else if (line.length() == 0 && lastLineHadKey) {
-            if (keyRow.count() > iVkbColumns) {
-                iVkbColumns = keyRow.count();
+            if (keyRow.count() > columns) {
+                columns = keyRow.count();
             }
-            iKeyData.append(keyRow);
+            keyData->append(keyRow);
             keyRow.clear();
             lastLineHadKey = false;
         } else {
@@ -132,47 +327,48 @@ bool KeyLoader::loadLayoutInternal(QIODevice& from)
         }
     }
     if (keyRow.count() > 0)
-        iKeyData.append(keyRow);
+        keyData->append(keyRow);
 
-    iVkbRows = iKeyData.count();
-    foreach (QList<KeyData> r, iKeyData) {
-        if (r.count() > iVkbColumns)
-            iVkbColumns = r.count();
+    foreach (QList<KeyData> r, *keyData) {
+        if (r.count() > columns)
+            columns = r.count();
     }
 
     from.close();
 
-    if (iVkbColumns <= 0 || iVkbRows <= 0)
+    if (columns <= 0 || keyData->isEmpty())
         ret = false;
 
     if (!ret)
-        iKeyData.clear();
+        keyData->clear();
 
     return ret;
 }
 
 QVariantList KeyLoader::keyAt(int row, int col)
 {
-    QVariantList ret;
-    ret.append("");    //label
-    ret.append(0);     //code
-    ret.append("");    //label_alt
-    ret.append(0);     //code_alt
-    ret.append(0);     //width
-    ret.append(false); //isModifier
-
-    if (iKeyData.count() <= row)
-        return ret;
-    if (iKeyData.at(row).count() <= col)
+    if (!m_layout || row < 0 || row >= iVkbRows || col < 0 || col >= iVkbColumns) {
+        QVariantList ret;
+        ret.append("");    //label
+        ret.append(0);     //code
+        ret.append("");    //label_alt
+        ret.append(0);     //code_alt
+        ret.append(0);     //width
+        ret.append(false); //isModifier
         return ret;
+    }
 
-    ret[0] = iKeyData.at(row).at(col).label;
-    ret[1] = iKeyData.at(row).at(col).code;
-    ret[2] = iKeyData.at(row).at(col).label_alt;
-    ret[3] = iKeyData.at(row).at(col).code_alt;
-    ret[4] = iKeyData.at(row).at(col).width;
-    ret[5] = iKeyData.at(row).at(col).isModifier;
+    const CompiledHeader* header = reinterpret_cast<const CompiledHeader*>(m_layout);
+    const CompiledKey& key = reinterpret_cast<const CompiledKey*>(header + 1)[row * iVkbColumns + col];
+    const QChar* strings = reinterpret_cast<const QChar*>(reinterpret_cast<const CompiledKey*>(header + 1) + iVkbRows * iVkbColumns);
 
+    QVariantList ret;
+    ret.append(QString(strings + key.label, key.labelLength));
+    ret.append(key.code);
+    ret.append(QString(strings + key.labelAlt, key.labelAltLength));
+    ret.append(key.codeAlt);
+    ret.append(int(key.width));
+    ret.append(bool(key.isModifier));
     return ret;
 }
 
@@ -224,3 +420,103 @@ void KeyLoader::cleanUpKey(KeyData& key)
         key.code_alt = 0;
     }
 }
+
+#if defined(TEST_MODE)
+
+struct KeyLoaderTest
+{
+    static bool load(KeyLoader* loader, const QString& source, const QString& cache) { return loader->loadLayoutFile(source, cache); }
+    static bool isMapped(KeyLoader* loader) { return loader->m_cacheFile.isOpen(); }
+    static void unload(KeyLoader* loader) { loader->unload(); }
+};
+
+static void writeFile(const QString& path, const QByteArray& data)
+{
+    QFile file(path);
+    REQUIRE(file.open(QIODevice::WriteOnly));
+    REQUIRE(file.write(data) == data.size());
+}
+
+TEST_CASE("KeyLoader: Layouts are compiled and cached")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    QString source = dir.filePath("test.layout");
+    QString cache = dir.filePath("test.layoutcache");
+
+    writeFile(source,
+        "; a comment\n"
+        "[\"esc\", 0x1000000, \"\", 0x0]\n"
+        "[\">\", 0x3e, \"<\", 0x3c]\n"
+        "\n"
+        "[[\":shift\", 0x2000000, \"\", 0x0]]\n"
+        "[\",\", 0x2c, \"\", 0x0]\n"
+        "[\"a\", 0x41, \"b\", 0x42]\n");
+
+    KeyLoader first;
+    REQUIRE(KeyLoaderTest::load(&first, source, cache));
+    REQUIRE(!KeyLoaderTest::isMapped(&first));
+    REQUIRE(QFile::exists(cache));
+    REQUIRE(first.vkbRows() == 2);
+    REQUIRE(first.vkbColumns() == 3);
+
+    KeyLoader second;
+    REQUIRE(KeyLoaderTest::load(&second, source, cache));
+    REQUIRE(KeyLoaderTest::isMapped(&second));
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 4; col++)
+            REQUIRE(second.keyAt(row, col) == first.keyAt(row, col));
+    }
+
+    REQUIRE(second.keyAt(0, 1) == QVariantList({ ">", 0x3e, "<", 0x3c, 1, false }));
+    REQUIRE(second.keyAt(1, 0) == QVariantList({ ":shift", 0x2000000, "", 0, 2, true }));
+    REQUIRE(second.keyAt(1, 1) == QVariantList({ ",", 0x2c, "", 0, 1, false }));
+    // Letters have no alternative.
+    REQUIRE(second.keyAt(1, 2) == QVariantList({ "a", 0x41, "", 0, 1, false }));
+    // Short rows are padded.
+    REQUIRE(second.keyAt(0, 2) == QVariantList({ "", 0, "", 0, 0, false }));
+    REQUIRE(second.keyAt(5, 0) == QVariantList({ "", 0, "", 0, 0, false }));
+}
+
+TEST_CASE("KeyLoader: Stale or broken caches are not used")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    QString source = dir.filePath("test.layout");
+    QString cache = dir.filePath("test.layoutcache");
+
+    writeFile(source, "[\"x\", 0x58, \"\", 0x0]\n");
+    KeyLoader loader;
+    REQUIRE(KeyLoaderTest::load(&loader, source, cache));
+    REQUIRE(loader.keyAt(0, 0).at(0) == "x");
+
+    // Changed within the same mtime, as far as the filesystem can tell.
+    QDateTime mtime = QFileInfo(source).lastModified();
+    writeFile(source, "[\"y\", 0x59, \"\", 0x0]\n");
+    {
+        QFile file(source);
+        REQUIRE(file.open(QIODevice::ReadWrite));
+        REQUIRE(file.setFileTime(mtime, QFileDevice::FileModificationTime));
+    }
+    REQUIRE(KeyLoaderTest::load(&loader, source, cache));
+    REQUIRE(!KeyLoaderTest::isMapped(&loader));
+    REQUIRE(loader.keyAt(0, 0).at(0) == "y");
+
+    REQUIRE(KeyLoaderTest::load(&loader, source, cache));
+    REQUIRE(KeyLoaderTest::isMapped(&loader));
+
+    // Truncated.
+    KeyLoaderTest::unload(&loader);
+    QFile file(cache);
+    REQUIRE(file.resize(file.size() - 1));
+    REQUIRE(KeyLoaderTest::load(&loader, source, cache));
+    REQUIRE(!KeyLoaderTest::isMapped(&loader));
+    REQUIRE(loader.keyAt(0, 0).at(0) == "y");
+
+    // A layout that doesn't parse loads nothing.
+    writeFile(source, "; nothing\n");
+    REQUIRE(!KeyLoaderTest::load(&loader, source, cache));
+    REQUIRE(loader.vkbRows() == 0);
+}
+
+#endif // TEST_MODE
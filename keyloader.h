@@ -49,18 +49,30 @@ public:
     Q_INVOKABLE const QStringList availableLayouts();
 
 signals:
+    void layoutLoaded();
 
 public slots:
 
 private:
     Q_DISABLE_COPY(KeyLoader)
-    bool loadLayoutInternal(QIODevice& from);
-    void cleanUpKey(KeyData& key);
+    friend struct KeyLoaderTest;
+
+    bool loadLayoutFile(const QString& sourcePath, const QString& cachePath);
+    bool useCompiled(const QByteArray& compiled);
+    void setLayout(const uchar* layout);
+    void unload();
+
+    static bool parseLayout(const QByteArray& source, QList<QList<KeyData>>* keyData);
+    static void cleanUpKey(KeyData& key);
 
     int iVkbRows;
     int iVkbColumns;
 
-    QList<QList<KeyData>> iKeyData;
+    // The compiled layout (see keyloader.cpp), mapped from the cache file, or
+    // compiled just now.
+    const uchar* m_layout;
+    QFile m_cacheFile;
+    QByteArray m_compiled;
 
     Util* iUtil;
 };
@@ -0,0 +1,238 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QMutex>
+#include <algorithm>
+#include <cmath>
+
+#include "catch.hpp"
+#include "latencyprobe.h"
+
+/*!
+ * \class LatencyProbe
+ * \internal
+ *
+ * LatencyProbe measures how long it takes from a key press until the echo of
+ * it is on screen, broken down by the stages of the path in between (see
+ * Stage).
+ *
+ * A key press starts a new sample. Every later stage is attributed to each
+ * sample still in flight that has reached the stage before it, so a pty read
+ * that carries the echo of three quick key presses completes the PtyRead stage
+ * for all three. A sample is done when it is presented.
+ *
+ * This assumes that the first read after a write is the echo, which holds for
+ * a shell prompt or `cat`, but not with output already streaming in.
+ *
+ * When disabled (the default) mark() is a single predictable branch. Stages
+ * may be marked from the render thread, so recording takes a lock.
+ */
+
+bool LatencyProbe::s_enabled = false;
+
+static const int maxSamples = 100000;
+
+static QMutex s_lock;
+static QElapsedTimer s_clock;
+static QVector<LatencyProbe::Sample> s_inFlight;
+static QVector<LatencyProbe::Sample> s_done;
+
+static const char* const stageNames[] = {
+    "keyPress",
+    "ptyWrite",
+    "ptyRead",
+    "parsed",
+    "polished",
+    "presented",
+};
+
+void LatencyProbe::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&s_lock);
+    if (!s_clock.isValid())
+        s_clock.start();
+    s_enabled = enabled;
+}
+
+void LatencyProbe::record(Stage stage)
+{
+    QMutexLocker locker(&s_lock);
+    qint64 now = s_clock.nsecsElapsed();
+
+    if (stage == KeyPress) {
+        Sample sample;
+        std::fill(sample.time, sample.time + StageCount, -1);
+        sample.time[KeyPress] = now;
+        s_inFlight.append(sample);
+        return;
+    }
+
+    for (int i = 0; i < s_inFlight.size(); i++) {
+        Sample& sample = s_inFlight[i];
+        if (sample.time[stage - 1] >= 0 && sample.time[stage] < 0)
+            sample.time[stage] = now;
+    }
+
+    if (stage != Presented)
+        return;
+
+    for (int i = 0; i < s_inFlight.size();) {
+        if (s_inFlight.at(i).time[Presented] >= 0) {
+            if (s_done.size() < maxSamples)
+                s_done.append(s_inFlight.at(i));
+            s_inFlight.remove(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+/*!
+ * All completed samples so far.
+ */
+QVector<LatencyProbe::Sample> LatencyProbe::samples()
+{
+    QMutexLocker locker(&s_lock);
+    return s_done;
+}
+
+void LatencyProbe::reset()
+{
+    QMutexLocker locker(&s_lock);
+    s_inFlight.clear();
+    s_done.clear();
+}
+
+QJsonObject LatencyProbe::summary()
+{
+    return summary(samples());
+}
+
+static double percentile(const QVector<qint64>& sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0;
+    int index = qBound(0, int(std::ceil(p * sorted.size())) - 1, sorted.size() - 1);
+    return sorted.at(index) / 1e6;
+}
+
+static QJsonObject distribution(QVector<qint64> values)
+{
+    std::sort(values.begin(), values.end());
+    QJsonObject out;
+    out["p50"] = percentile(values, 0.50);
+    out["p99"] = percentile(values, 0.99);
+    out["max"] = values.isEmpty() ? 0 : values.last() / 1e6;
+    return out;
+}
+
+/*!
+ * Summarise \a samples: p50, p99 and max in milliseconds for the whole path
+ * ("total"), and for the time spent getting to each stage from the one before.
+ */
+QJsonObject LatencyProbe::summary(const QVector<Sample>& samples)
+{
+    QJsonObject out;
+    out["samples"] = samples.size();
+
+    QVector<qint64> totals;
+    for (const Sample& sample : samples)
+        totals.append(sample.time[Presented] - sample.time[KeyPress]);
+    out["total"] = distribution(totals);
+
+    QJsonObject stages;
+    for (int stage = PtyWrite; stage < StageCount; stage++) {
+        QVector<qint64> deltas;
+        for (const Sample& sample : samples)
+            deltas.append(sample.time[stage] - sample.time[stage - 1]);
+        stages[stageNames[stage]] = distribution(deltas);
+    }
+    out["stages"] = stages;
+    return out;
+}
+
+#if defined(TEST_MODE)
+
+TEST_CASE("LatencyProbe: Disabled by default")
+{
+    REQUIRE(!LatencyProbe::isEnabled());
+    LatencyProbe::mark(LatencyProbe::KeyPress);
+    LatencyProbe::mark(LatencyProbe::PtyWrite);
+    LatencyProbe::mark(LatencyProbe::PtyRead);
+    LatencyProbe::mark(LatencyProbe::Parsed);
+    LatencyProbe::mark(LatencyProbe::Polished);
+    LatencyProbe::mark(LatencyProbe::Presented);
+    REQUIRE(LatencyProbe::samples().isEmpty());
+}
+
+TEST_CASE("LatencyProbe: Stages are matched to key presses")
+{
+    LatencyProbe::setEnabled(true);
+    LatencyProbe::reset();
+
+    // Two key presses whose echoes arrive in a single read.
+    LatencyProbe::mark(LatencyProbe::KeyPress);
+    LatencyProbe::mark(LatencyProbe::PtyWrite);
+    LatencyProbe::mark(LatencyProbe::KeyPress);
+    LatencyProbe::mark(LatencyProbe::PtyWrite);
+    LatencyProbe::mark(LatencyProbe::PtyRead);
+    LatencyProbe::mark(LatencyProbe::Parsed);
+
+    // A frame that doesn't have the echo yet does not complete anything.
+    LatencyProbe::mark(LatencyProbe::Presented);
+    REQUIRE(LatencyProbe::samples().isEmpty());
+
+    // A key press that hasn't been written yet is not picked up by the read.
+    LatencyProbe::mark(LatencyProbe::KeyPress);
+    LatencyProbe::mark(LatencyProbe::Polished);
+    LatencyProbe::mark(LatencyProbe::Presented);
+
+    QVector<LatencyProbe::Sample> samples = LatencyProbe::samples();
+    REQUIRE(samples.size() == 2);
+    for (const LatencyProbe::Sample& sample : samples) {
+        for (int stage = LatencyProbe::PtyWrite; stage < LatencyProbe::StageCount; stage++)
+            REQUIRE(sample.time[stage] >= sample.time[stage - 1]);
+    }
+
+    QJsonObject summary = LatencyProbe::summary();
+    REQUIRE(summary["samples"].toInt() == 2);
+    REQUIRE(summary["total"].toObject()["p99"].toDouble() >= summary["total"].toObject()["p50"].toDouble());
+
+    LatencyProbe::setEnabled(false);
+    LatencyProbe::reset();
+}
+
+TEST_CASE("LatencyProbe: Percentiles")
+{
+    QVector<LatencyProbe::Sample> samples;
+    for (int i = 1; i <= 100; i++) {
+        LatencyProbe::Sample sample;
+        for (int stage = 0; stage < LatencyProbe::StageCount; stage++)
+            sample.time[stage] = 0;
+        sample.time[LatencyProbe::Presented] = i * 1000000; // i ms
+        samples.append(sample);
+    }
+
+    QJsonObject total = LatencyProbe::summary(samples)["total"].toObject();
+    REQUIRE(total["p50"].toDouble() == 50);
+    REQUIRE(total["p99"].toDouble() == 99);
+    REQUIRE(total["max"].toDouble() == 100);
+}
+
+#endif // TEST_MODE
@@ -0,0 +1,63 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LATENCYPROBE_H
+#define LATENCYPROBE_H
+
+#include <QJsonObject>
+#include <QVector>
+
+class LatencyProbe
+{
+public:
+    enum Stage
+    {
+        KeyPress,  // Terminal::keyPress, for keys that write to the pty
+        PtyWrite,  // PtyIFace::writeTerm
+        PtyRead,   // PtyIFace::readAvailable, with the echo
+        Parsed,    // Terminal::insertInBuffer is done with it
+        Polished,  // TextRender::updatePolish
+        Presented, // QQuickWindow::frameSwapped
+        StageCount
+    };
+
+    struct Sample
+    {
+        qint64 time[StageCount]; // nanoseconds, -1 if not reached
+    };
+
+    static bool isEnabled() { return s_enabled; }
+    static void setEnabled(bool enabled);
+
+    static void mark(Stage stage)
+    {
+        if (Q_UNLIKELY(s_enabled))
+            record(stage);
+    }
+
+    static QVector<Sample> samples();
+    static void reset();
+
+    static QJsonObject summary();
+    static QJsonObject summary(const QVector<Sample>& samples);
+
+private:
+    static void record(Stage stage);
+    static bool s_enabled;
+};
+
+#endif // LATENCYPROBE_H
@@ -1,4 +1,4 @@
-QT = core gui qml quick
+QT = core gui qml quick network
 
 CONFIG -= app_bundle
 
@@ -7,6 +7,9 @@ OBJECTS_DIR = .obj
 
 CONFIG += link_pkgconfig
 
+# Compile the QML in resources.qrc ahead of time, rather than on every start.
+CONFIG += qtquickcompiler
+
 TEMPLATE = app
 TARGET = literm
 DEPENDPATH += .
@@ -15,23 +18,46 @@ LIBS += -lutil
 
 # Input
 HEADERS += \
+    instanceserver.h \
     ptyiface.h \
+    ptyreactor.h \
+    sessionmanager.h \
+    ptyrecording.h \
+    latencyprobe.h \
+    startupprofile.h \
     terminal.h \
+    terminalsearch.h \
     textrender.h \
     version.h \
     utilities.h \
+    keyboarditem.h \
     keyloader.h \
     parser.h \
+    blinkclock.h \
+    trace.h \
     catch.hpp
 
 SOURCES += \
     main.cpp \
     terminal.cpp \
+    terminalsearch.cpp \
     textrender.cpp \
+    instanceserver.cpp \
     ptyiface.cpp \
+    ptyreactor.cpp \
+    sessionmanager.cpp \
+    ptyrecording.cpp \
+    latencyprobe.cpp \
+    startupprofile.cpp \
     utilities.cpp \
+    keyboarditem.cpp \
     keyloader.cpp \
-    parser.cpp
+    parser.cpp \
+    blinkclock.cpp \
+    trace.cpp
+
+# qmake CONFIG+=tracing builds in support for -trace FILE (see trace.h)
+tracing: DEFINES += LITERM_TRACING
 
 OTHER_FILES += \
     qml/mobile/Main.qml \
@@ -56,7 +82,8 @@ OTHER_FILES += \
     qml/desktop/LayoutWindow.qml \
     qml/desktop/PopupWindow.qml \
     qml/desktop/TabView.qml \
-    qml/desktop/TabBar.qml
+    qml/desktop/TabBar.qml \
+    qml/desktop/SearchBar.qml
 
 RESOURCES += \
     resources.qrc
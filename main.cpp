@@ -16,25 +16,78 @@
 */
 
 #include <QDir>
+#include <QElapsedTimer>
 #include <QGuiApplication>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QQmlComponent>
 #include <QQmlContext>
 #include <QQmlEngine>
 #include <QQuickView>
 #include <QScreen>
 #include <QString>
+#include <QThread>
+#include <cstring>
 
+#include "instanceserver.h"
+#include "keyboarditem.h"
 #include "keyloader.h"
+#include "latencyprobe.h"
+#include "sessionmanager.h"
+#include "startupprofile.h"
 #include "textrender.h"
+#include "trace.h"
 #include "utilities.h"
 #include "version.h"
 
 static void copyFileFromResources(QString from, QString to);
+static QQuickView* createWindow(QQmlEngine* engine, const QUrl& source, bool fullscreen);
+static bool runClient(int argc, char* argv[]);
+
+static bool hasArgument(int argc, char* argv[], const char* arg)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], arg) == 0)
+            return true;
+    }
+    return false;
+}
+
+static PtyLaunchOptions launchFromArguments(const QStringList& arguments)
+{
+    PtyLaunchOptions launch;
+    int commandIndex = arguments.indexOf("-e");
+    if (commandIndex != -1 && commandIndex + 1 < arguments.size())
+        launch.command = arguments.at(commandIndex + 1);
+    return launch;
+}
 
 int main(int argc, char* argv[])
 {
+    // Report how long it takes to get the first output of the shell on screen.
+    if (hasArgument(argc, argv, "--startup-profile")) {
+        StartupProfile::setEnabled(true);
+        StartupProfile::setCompletionHandler([]() {
+            qInfo().noquote() << QJsonDocument(StartupProfile::timeline()).toJson();
+        });
+    }
+    StartupProfile::mark(StartupProfile::Main);
+
     QCoreApplication::setApplicationName("literm");
 
+    // Unless asked to be the server, or to run on our own (also implied by the
+    // options that are about this process), have a server open the window.
+    bool serverMode = hasArgument(argc, argv, "--server");
+    bool standalone = hasArgument(argc, argv, "--standalone")
+        || hasArgument(argc, argv, "--startup-profile")
+        || hasArgument(argc, argv, "-trace")
+        || hasArgument(argc, argv, "-latency")
+        || hasArgument(argc, argv, "-record");
+    if (!serverMode && !standalone && runClient(argc, argv))
+        return 0;
+
     QGuiApplication app(argc, argv);
+    StartupProfile::mark(StartupProfile::Application);
 
     QScreen* sc = app.primaryScreen();
     if (sc) {
@@ -45,9 +98,28 @@ int main(int argc, char* argv[])
             | Qt::InvertedPortraitOrientation);
     }
 
+    // Report keypress to screen latency on exit.
+    if (app.arguments().contains("-latency")) {
+        LatencyProbe::setEnabled(true);
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, []() {
+            qInfo().noquote() << QJsonDocument(LatencyProbe::summary()).toJson();
+        });
+    }
+
+    // Write a trace of the data path on exit, for chrome://tracing or Perfetto.
+    int traceIndex = app.arguments().indexOf("-trace");
+    if (traceIndex != -1 && traceIndex + 1 < app.arguments().size()) {
+#if defined(LITERM_TRACING)
+        if (Trace::start(app.arguments().at(traceIndex + 1)))
+            QObject::connect(&app, &QCoreApplication::aboutToQuit, []() { Trace::stop(); });
+#else
+        qWarning() << "-trace needs a build with CONFIG+=tracing";
+#endif
+    }
+
     qmlRegisterType<TextRender>("literm", 1, 0, "TextRender");
+    qmlRegisterType<KeyboardItem>("literm", 1, 0, "KeyboardItem");
     qmlRegisterUncreatableType<Util>("literm", 1, 0, "Util", "Util is created by app");
-    QQuickView view;
 
 #if defined(DESKTOP_BUILD)
     bool fullscreen = app.arguments().contains("-fullscreen");
@@ -55,16 +127,6 @@ int main(int argc, char* argv[])
     bool fullscreen = !app.arguments().contains("-nofs");
 #endif
 
-    QSize screenSize = QGuiApplication::primaryScreen()->size();
-
-    if (fullscreen) {
-        view.setWidth(screenSize.width());
-        view.setHeight(screenSize.height());
-    } else {
-        view.setWidth(screenSize.width() / 2);
-        view.setHeight(screenSize.height() / 2);
-    }
-
     QString settings_path(QDir::homePath() + "/.config/literm");
     QDir dir;
 
@@ -82,6 +144,16 @@ int main(int argc, char* argv[])
 
     Util util(settingsFile);
     qmlRegisterSingletonInstance("literm", 1, 0, "Util", &util);
+    StartupProfile::mark(StartupProfile::Settings);
+
+    SessionManager sessions;
+
+    // Get the shell going first, so that it starts up while the rest of us
+    // does.
+    if (!serverMode) {
+        util.setNextLaunch(launchFromArguments(app.arguments()));
+        sessions.prestart();
+    }
 
     QString startupErrorMsg;
 
@@ -92,23 +164,7 @@ int main(int argc, char* argv[])
     copyFileFromResources(":/data/french.layout", util.configPath() + "/french.layout");
     copyFileFromResources(":/data/german.layout", util.configPath() + "/german.layout");
     copyFileFromResources(":/data/qwertz.layout", util.configPath() + "/qwertz.layout");
-
-    KeyLoader keyLoader;
-    keyLoader.setUtil(&util);
-    qmlRegisterSingletonInstance("literm", 1, 0, "KeyLoader", &keyLoader);
-    bool ret = keyLoader.loadLayout(util.keyboardLayout());
-    if (!ret) {
-        // on failure, try to load the default one (english) directly from resources
-        startupErrorMsg = "There was an error loading the keyboard layout.<br>\nUsing the default one instead.";
-        util.setKeyboardLayout("english");
-        ret = keyLoader.loadLayout(":/data/english.layout");
-        if (!ret)
-            qFatal("failure loading keyboard layout");
-    }
-
-    util.setWindow(&view);
-
-    QObject::connect(view.engine(), SIGNAL(quit()), &app, SLOT(quit()));
+    StartupProfile::mark(StartupProfile::ConfigCopied);
 
     // Allow overriding the UX choice
     QString uxChoice;
@@ -125,20 +181,110 @@ int main(int argc, char* argv[])
 #endif
     }
 
-    view.setResizeMode(QQuickView::SizeRootObjectToView);
-    view.setSource(QUrl("qrc:/qml/" + uxChoice + "/Main.qml"));
+    KeyLoader keyLoader;
+    keyLoader.setUtil(&util);
+    qmlRegisterSingletonInstance("literm", 1, 0, "KeyLoader", &keyLoader);
+
+    // Only the mobile UX has an on-screen keyboard to parse the layout for.
+    if (uxChoice == "mobile") {
+        bool ret = keyLoader.loadLayout(util.keyboardLayout());
+        if (!ret) {
+            // on failure, try to load the default one (english) directly from resources
+            startupErrorMsg = "There was an error loading the keyboard layout.<br>\nUsing the default one instead.";
+            util.setKeyboardLayout("english");
+            ret = keyLoader.loadLayout(":/data/english.layout");
+            if (!ret)
+                qFatal("failure loading keyboard layout");
+        }
+        StartupProfile::mark(StartupProfile::KeyboardLoaded);
+    }
+
+    // All windows share one engine, so that everything loaded for the first
+    // one is there for the next.
+    QQmlEngine engine;
+    QObject::connect(&engine, SIGNAL(quit()), &app, SLOT(quit()));
+
+    QUrl source("qrc:/qml/" + uxChoice + "/Main.qml");
+    QObject::connect(&util, &Util::newWindowRequested, &engine, [&]() {
+        createWindow(&engine, source, fullscreen);
+    });
+
+    InstanceServer server;
+    if (serverMode) {
+        if (!server.listen())
+            return 1;
+
+        // Stay around without windows, with the QML compiled and cached.
+        app.setQuitOnLastWindowClosed(false);
+        new QQmlComponent(&engine, source, &engine);
+
+        // Closed windows leave their sessions running, to be attached again,
+        // only if asked to: nothing else would ever end them.
+        sessions.setKeepSessions(util.keepSessions());
+        QObject::connect(&util, &Util::settingsChanged, &sessions, [&]() {
+            sessions.setKeepSessions(util.keepSessions());
+        });
+
+        QObject::connect(&server, &InstanceServer::windowRequested, &engine, [&](const PtyLaunchOptions& launch, bool attach) {
+            util.setNextLaunch(launch);
+            if (attach)
+                sessions.requestAttach();
+            else
+                sessions.prestart();
+            createWindow(&engine, source, fullscreen);
+        });
+    } else {
+        createWindow(&engine, source, fullscreen);
+    }
+
+    int result = app.exec();
+
+    // Before the engine goes.
+    qDeleteAll(util.windows());
+    return result;
+}
+
+static QQuickView* createWindow(QQmlEngine* engine, const QUrl& source, bool fullscreen)
+{
+    QQuickView* view = new QQuickView(engine, 0);
+
+    QSize screenSize = QGuiApplication::primaryScreen()->size();
 
-    QObject* root = view.rootObject();
+    if (fullscreen) {
+        view->setWidth(screenSize.width());
+        view->setHeight(screenSize.height());
+    } else {
+        view->setWidth(screenSize.width() / 2);
+        view->setHeight(screenSize.height() / 2);
+    }
+
+    Util::instance()->addWindow(view);
+
+    // A closed window goes away, along with its terminals.
+    QObject::connect(view, &QQuickWindow::closing, view, [view]() {
+        if (SessionManager::instance()->keepsSessions()) {
+            for (TextRender* render : view->rootObject()->findChildren<TextRender*>())
+                render->detachSession();
+        }
+        view->deleteLater();
+    });
+
+    view->setResizeMode(QQuickView::SizeRootObjectToView);
+    view->setSource(source);
+
+    QObject* root = view->rootObject();
     if (!root)
         qFatal("no root object - qml error");
+    StartupProfile::mark(StartupProfile::QmlLoaded);
 
     if (fullscreen) {
-        view.showFullScreen();
+        view->showFullScreen();
     } else {
-        view.show();
+        view->show();
     }
+    StartupProfile::mark(StartupProfile::WindowShown);
 
-    return app.exec();
+    return view;
 }
 
 static void copyFileFromResources(QString from, QString to)
@@ -156,3 +302,41 @@ static void copyFileFromResources(QString from, QString to)
         }
     }
 }
+
+/*!
+ * Have a server open the window, starting one first if there is none. Returns
+ * false if that didn't work out, and the window should be opened here.
+ */
+static bool runClient(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    // Without a private place for the socket, there's no server to trust.
+    if (InstanceServer::socketPath().isEmpty())
+        return false;
+
+    PtyLaunchOptions launch = launchFromArguments(app.arguments());
+    launch.workingDirectory = QDir::currentPath();
+    launch.environment = QProcess::systemEnvironment();
+
+    bool attach = app.arguments().contains("-attach");
+    if (InstanceServer::requestWindow(launch, attach, 2000))
+        return true;
+
+    QStringList arguments = app.arguments().mid(1);
+    int commandIndex = arguments.indexOf("-e");
+    if (commandIndex != -1)
+        arguments.erase(arguments.begin() + commandIndex, arguments.begin() + qMin(commandIndex + 2, arguments.size()));
+    arguments.prepend("--server");
+    if (!QProcess::startDetached(app.applicationFilePath(), arguments, QDir::homePath()))
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 10000) {
+        if (InstanceServer::requestWindow(launch, attach, 2000))
+            return true;
+        QThread::msleep(20);
+    }
+    return false;
+}
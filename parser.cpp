@@ -416,3 +416,29 @@ TEST_CASE("SGR: 256color: Background", "[terminal] [256color]")
     requireParseSuccess({ 48, 5, 9 }, Qt::red, QColor(Qt::red).rgb(), "");
     requireParseSuccess({ 48, 5, 10 }, Qt::red, QColor(Qt::green).rgb(), "");
 }
+
+#if defined(CATCH_CONFIG_ENABLE_BENCHMARKING)
+
+// Run with: ./apptest "[!benchmark]"
+TEST_CASE("SGR: Benchmark", "[!benchmark] [sgr]")
+{
+    Parser::TextAttributes attribs = Parser::TextAttribute::NoAttributes;
+    QRgb fg = Qt::red;
+    QRgb bg = Qt::red;
+    Parser::SGRParserState state(fg, bg, QColor(Qt::white).rgb(), QColor(Qt::black).rgb(), attribs);
+    QString errorString;
+
+    const QList<int> reset = { 0 };
+    const QList<int> boldRed = { 1, 31 };
+    const QList<int> indexed = { 38, 5, 208 };
+    const QList<int> trueColor = { 48, 2, 10, 20, 30 };
+    const QList<int> mixed = { 0, 1, 4, 38, 2, 255, 128, 0, 48, 5, 17 };
+
+    BENCHMARK("reset") { return Parser::handleSGR(state, reset, errorString); };
+    BENCHMARK("bold, red") { return Parser::handleSGR(state, boldRed, errorString); };
+    BENCHMARK("256 color") { return Parser::handleSGR(state, indexed, errorString); };
+    BENCHMARK("24 bit color") { return Parser::handleSGR(state, trueColor, errorString); };
+    BENCHMARK("mixed") { return Parser::handleSGR(state, mixed, errorString); };
+}
+
+#endif // CATCH_CONFIG_ENABLE_BENCHMARKING
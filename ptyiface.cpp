@@ -16,16 +16,21 @@
     along with this work.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <QAbstractEventDispatcher>
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QDebug>
-#include <QTimer>
+#include <QDir>
+#include <QFile>
 
 extern "C" {
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
@@ -39,103 +44,217 @@ extern "C" {
 #include <stdlib.h>
 #include <sys/types.h>
 #include <unistd.h>
+
+extern char** environ;
 }
 
+#include <vector>
+
+#include "catch.hpp"
+#include "latencyprobe.h"
 #include "ptyiface.h"
+#include "ptyrecording.h"
+#include "startupprofile.h"
 #include "terminal.h"
+#include "trace.h"
+
+// Read at most this much at a time, so that one busy session doesn't hold up
+// the others.
+static const int maxReadSize = 64 * 1024;
+
+// Stop reading once this much output is waiting to be parsed, until it has
+// been taken. The child then blocks on a full pty.
+static const int maxPendingData = 1024 * 1024;
+
+// posix_spawn() gained POSIX_SPAWN_SETSID in glibc 2.26, and a way to change
+// directory in 2.29. Without those, the child is forked.
+#if defined(Q_OS_LINUX) && defined(__GLIBC__) && defined(POSIX_SPAWN_SETSID)
+#    define LITERM_PTY_SPAWN
+#    if __GLIBC_PREREQ(2, 29)
+#        define LITERM_PTY_SPAWN_CHDIR
+#    endif
+#endif
 
-std::vector<int> PtyIFace::m_deadPids;
-bool PtyIFace::m_initializedSignalHandler = false;
+static bool s_forkOnly = false;
 
-void PtyIFace::sighandler(int sig)
+// The command line, split on spaces, or the user's shell.
+static QList<QByteArray> childArguments(const QString& command)
 {
-    if (sig == SIGCHLD) {
-        int pid = wait(NULL);
+    QList<QByteArray> args;
+    if (command.isEmpty()) {
+        passwd* pwdstruct = getpwuid(getuid());
+        args << QByteArray(pwdstruct && pwdstruct->pw_shell ? pwdstruct->pw_shell : "/bin/sh") << "--login";
+        return args;
+    }
 
-        if (pid > 0) {
-            // we cannot reallocate in a signal handler, or Bad Things will happen
-            Q_ASSERT(m_deadPids.size() + 1 <= m_deadPids.capacity());
-            m_deadPids.push_back(pid);
-        }
+    for (const QString& part : command.split(' ', Qt::SkipEmptyParts))
+        args.append(part.toLocal8Bit());
+    return args;
+}
+
+// The given environment (or our own, if empty), with TERM set.
+static QList<QByteArray> childEnvironment(const QStringList& environment, const QByteArray& termEnv)
+{
+    QList<QByteArray> env;
+    if (environment.isEmpty()) {
+        for (char** var = environ; *var; var++)
+            env.append(*var);
+    } else {
+        for (const QString& var : environment)
+            env.append(var.toLocal8Bit());
     }
+
+    for (int i = env.size() - 1; i >= 0; i--) {
+        if (env.at(i).startsWith("TERM="))
+            env.removeAt(i);
+    }
+    env.append("TERM=" + termEnv);
+    return env;
 }
 
-void PtyIFace::checkForDeadPids()
+// Where execvp() would find \a name, but going by the PATH in \a env, which
+// is the one the child gets. Empty if it's nowhere.
+static QByteArray findExecutable(const QByteArray& name, const QList<QByteArray>& env)
 {
-    for (size_t i = 0; i < m_deadPids.size(); ++i) {
-        if (m_deadPids.at(i) == m_childProcessPid) {
-            delete iReadNotifier;
+    if (name.contains('/'))
+        return name;
 
-            m_deadPids.erase(m_deadPids.begin() + i);
+    QByteArray path = "/bin:/usr/bin";
+    for (const QByteArray& var : env) {
+        if (var.startsWith("PATH="))
+            path = var.mid(5);
+    }
 
-            int status = 0;
-            waitpid(m_childProcessPid, &status, WNOHANG);
-            m_childProcessQuit = true;
-            m_childProcessPid = 0;
+    for (const QByteArray& dir : path.split(':')) {
+        QByteArray candidate = (dir.isEmpty() ? QByteArray(".") : dir) + '/' + name;
+        struct stat info;
+        if (stat(candidate.constData(), &info) == 0 && S_ISREG(info.st_mode) && access(candidate.constData(), X_OK) == 0)
+            return candidate;
+    }
+    return QByteArray();
+}
 
-            emit hangupReceived();
-            return;
-        }
+#if defined(LITERM_PTY_SPAWN)
+// Starts the child on a new pty with posix_spawn(), which glibc does with
+// CLONE_VFORK: the child shares our memory until it execs, so none of our
+// page tables get copied, however big the process. Setting the pty up as the
+// controlling terminal (what login_tty() would do) is left to the spawn
+// attributes: the child starts a session, and then opens the pty as stdin.
+// Returns -1 if this didn't work out, and the child should be forked.
+static pid_t spawnOnPty(int* masterFd, const QByteArray& path, char* const argv[], char* const envp[], const QByteArray& workingDirectory)
+{
+#    if !defined(LITERM_PTY_SPAWN_CHDIR)
+    if (!workingDirectory.isEmpty())
+        return -1;
+#    endif
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0)
+        return -1;
+
+    char slaveName[128];
+    if (grantpt(master) != 0 || unlockpt(master) != 0 || ptsname_r(master, slaveName, sizeof(slaveName)) != 0) {
+        close(master);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, slaveName, O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&actions, 0, 1);
+    posix_spawn_file_actions_adddup2(&actions, 0, 2);
+#    if defined(LITERM_PTY_SPAWN_CHDIR)
+    if (!workingDirectory.isEmpty())
+        posix_spawn_file_actions_addchdir_np(&actions, workingDirectory.constData());
+#    endif
+
+    // Nothing of ours should carry over, such as the reactor's SIGCHLD
+    // handler, or signals a thread of ours has blocked.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigfillset(&signals);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid = -1;
+    int error = posix_spawn(&pid, path.constData(), &actions, &attr, argv, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (error != 0) {
+        qWarning() << "posix_spawn failed:" << strerror(error);
+        close(master);
+        return -1;
     }
+
+    *masterFd = master;
+    return pid;
+}
+#endif
+
+// Starts the child with forkpty(). Everything it needs is prepared already,
+// as the child of a threaded process mustn't allocate.
+static pid_t forkOnPty(int* masterFd, const QByteArray& path, char* const argv[], char* const envp[], const QByteArray& workingDirectory)
+{
+    pid_t pid = forkpty(masterFd, NULL, NULL, NULL);
+    if (pid != 0)
+        return pid;
+
+    if (!workingDirectory.isEmpty() && chdir(workingDirectory.constData()) != 0)
+        perror("chdir");
+    if (!path.isEmpty())
+        execve(path.constData(), argv, envp);
+
+    // Nothing to run: the session ends straight away.
+    _exit(127);
 }
 
-PtyIFace::PtyIFace(Terminal* term, const QString& charset, const QByteArray& termEnv, const QString& commandOverride, QObject* parent)
+PtyIFace::PtyIFace(Terminal* term, const QString& charset, const QByteArray& termEnv, const PtyLaunchOptions& launch, QObject* parent)
     : QObject(parent)
     , iTerm(term)
     , iFailed(false)
     , m_childProcessQuit(false)
     , m_childProcessPid(0)
-    , iReadNotifier(0)
     , iTextCodec(0)
+    , m_decoder(0)
+    , m_readPaused(false)
+    , m_recorder(0)
 {
-    m_deadPids.reserve(m_deadPids.capacity() + 1);
-    connect(qApp->eventDispatcher(), &QAbstractEventDispatcher::awake, this, &PtyIFace::checkForDeadPids);
-
-    // fork the child process before creating QGuiApplication
-    int socketM;
-    int pid = forkpty(&socketM, NULL, NULL, NULL);
+    // Reaps the child once it exits, see childExited().
+    PtyReactor* reactor = PtyReactor::instance();
+
+    // Everything the child needs, done up front.
+    QByteArray workingDirectory = QFile::encodeName(launch.workingDirectory);
+    QList<QByteArray> arguments = childArguments(launch.command);
+    QList<QByteArray> environment = childEnvironment(launch.environment, termEnv);
+    QByteArray path = arguments.isEmpty() ? QByteArray() : findExecutable(arguments.first(), environment);
+
+    std::vector<char*> argv;
+    for (QByteArray& arg : arguments)
+        argv.push_back(arg.data());
+    argv.push_back(0);
+    std::vector<char*> envp;
+    for (QByteArray& var : environment)
+        envp.push_back(var.data());
+    envp.push_back(0);
+
+    int socketM = -1;
+    pid_t pid = -1;
+#if defined(LITERM_PTY_SPAWN)
+    if (!path.isEmpty() && !s_forkOnly)
+        pid = spawnOnPty(&socketM, path, argv.data(), envp.data(), workingDirectory);
+#endif
+    if (pid == -1)
+        pid = forkOnPty(&socketM, path, argv.data(), envp.data(), workingDirectory);
     if (pid == -1) {
         qFatal("forkpty failed");
         exit(1);
-    } else if (pid == 0) {
-        setenv("TERM", termEnv, 1);
-
-        QString execCmd;
-        bool next = false;
-        // ### this belongs elsewhere
-        for (int i = 0; i < qApp->arguments().count(); ++i) {
-            if (next) {
-                execCmd = qApp->arguments().at(i);
-                break;
-            }
-            if (qApp->arguments().at(i) == "-e") {
-                next = true;
-            }
-        }
-        if (execCmd.isEmpty()) {
-            execCmd = commandOverride;
-        }
-        if (execCmd.isEmpty()) {
-            // execute the user's default shell
-            passwd* pwdstruct = getpwuid(getuid());
-            execCmd = QString(pwdstruct->pw_shell);
-            execCmd.append(" --login");
-        }
-
-        QStringList execParts = execCmd.split(' ', Qt::SkipEmptyParts);
-        if (execParts.length() == 0)
-            exit(0);
-        char* ptrs[execParts.length() + 1];
-        for (int i = 0; i < execParts.length(); i++) {
-            ptrs[i] = new char[execParts.at(i).toLatin1().length() + 1];
-            memcpy(ptrs[i], execParts.at(i).toLatin1().data(), execParts.at(i).toLatin1().length());
-            ptrs[i][execParts.at(i).toLatin1().length()] = 0;
-        }
-        ptrs[execParts.length()] = 0;
-
-        execvp(execParts.first().toLatin1(), ptrs);
-        exit(0);
     }
+    StartupProfile::mark(StartupProfile::ShellStarted);
 
     iPid = pid;
     iMasterFd = socketM;
@@ -147,48 +266,141 @@ PtyIFace::PtyIFace(Terminal* term, const QString& charset, const QByteArray& ter
         qFatal("PtyIFace: null Terminal pointer");
     }
 
-    resize(iTerm->rows(), iTerm->columns());
-    connect(iTerm, SIGNAL(termSizeChanged(int, int)), this, SLOT(resize(int, int)));
-
-    iReadNotifier = new QSocketNotifier(iMasterFd, QSocketNotifier::Read, this);
-    connect(iReadNotifier, SIGNAL(activated(int)), this, SLOT(readActivated()));
-
-    if (!m_initializedSignalHandler) {
-        signal(SIGCHLD, &PtyIFace::sighandler);
-        m_initializedSignalHandler = true;
-    }
-
-    fcntl(iMasterFd, F_SETFL, O_NONBLOCK); // reads from the descriptor should be non-blocking
-
     if (!charset.isEmpty())
         iTextCodec = QTextCodec::codecForName(charset.toLatin1());
     if (!iTextCodec)
         iTextCodec = QTextCodec::codecForName("UTF-8");
     if (!iTextCodec)
         qFatal("No valid text codec");
+    m_decoder = iTextCodec->makeDecoder();
+
+    // ### this belongs elsewhere
+    int recordIndex = qApp->arguments().indexOf("-record");
+    if (recordIndex != -1 && recordIndex + 1 < qApp->arguments().count())
+        startRecording(qApp->arguments().at(recordIndex + 1));
+
+    resize(iTerm->rows(), iTerm->columns());
+    connect(iTerm, SIGNAL(termSizeChanged(int, int)), this, SLOT(resize(int, int)));
+
+    fcntl(iMasterFd, F_SETFL, O_NONBLOCK); // reads from the descriptor should be non-blocking
+    fcntl(iMasterFd, F_SETFD, FD_CLOEXEC);
+
+    reactor->add(this, iMasterFd, iPid);
 }
 
 PtyIFace::~PtyIFace()
 {
+    // No more reads after this.
+    PtyReactor::instance()->remove(this);
+
     if (!m_childProcessQuit) {
         // make the process quit
         kill(iPid, SIGHUP);
         kill(iPid, SIGTERM);
     }
+
+    close(iMasterFd);
+    delete m_decoder;
+    delete m_recorder;
 }
 
-void PtyIFace::readActivated()
+/*!
+ * Always start children with forkpty(), to compare against posix_spawn() in
+ * benchmarks.
+ */
+void PtyIFace::setForkOnly(bool forkOnly)
 {
-    if (m_childProcessQuit)
-        return;
+    s_forkOnly = forkOnly;
+}
 
-    int ret = 0;
-    char ch[4096];
-    ret = read(iMasterFd, ch, sizeof(ch));
-    if (iTerm && ret > 0) {
-        m_pendingData += iTextCodec->toUnicode(QByteArray::fromRawData(ch, ret));
-        emit dataAvailable();
+/*!
+ * Take the output read so far.
+ */
+QString PtyIFace::takeData()
+{
+    QMutexLocker locker(&m_lock);
+    QString tmp = m_pendingData;
+    m_pendingData = QString();
+    bool paused = m_readPaused;
+    m_readPaused = false;
+    locker.unlock();
+
+    if (paused)
+        PtyReactor::instance()->rearm(this);
+    return tmp;
+}
+
+/*!
+ * \internal
+ *
+ * Called on the reactor thread. Reads and decodes what there is, and lets the
+ * terminal know if it wasn't waiting for output already.
+ */
+bool PtyIFace::readAvailable()
+{
+    LITERM_TRACE_SPAN(readSpan, "pty", "read");
+    QMutexLocker locker(&m_lock);
+    bool wasEmpty = m_pendingData.isEmpty();
+    bool keepWatching = true;
+    int total = 0;
+    char ch[16 * 1024];
+
+    while (total < maxReadSize) {
+        ssize_t ret = read(iMasterFd, ch, sizeof(ch));
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            // EIO once the child side is closed. The child exiting is noticed
+            // separately.
+            if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                keepWatching = false;
+            break;
+        }
+
+        total += ret;
+        if (m_recorder)
+            m_recorder->recordData(ch, ret);
+
+        // The decoder keeps any partial character for the next read.
+        LITERM_TRACE_SPAN(decodeSpan, "pty", "decode");
+        m_pendingData += m_decoder->toUnicode(ch, ret);
+    }
+
+    LITERM_TRACE_ARG(readSpan, "bytes", total);
+    LITERM_TRACE_ARG(readSpan, "pending", m_pendingData.size());
+    if (total > 0) {
+        LatencyProbe::mark(LatencyProbe::PtyRead);
+        StartupProfile::mark(StartupProfile::OutputRead);
     }
+
+    if (wasEmpty && !m_pendingData.isEmpty())
+        QMetaObject::invokeMethod(this, "dataAvailable", Qt::QueuedConnection);
+
+    if (m_pendingData.size() >= maxPendingData) {
+        m_readPaused = true;
+        keepWatching = false;
+    }
+    return keepWatching;
+}
+
+/*!
+ * \internal
+ *
+ * Called on the reactor thread once the child has been reaped.
+ */
+void PtyIFace::childExited()
+{
+    // Pick up whatever it wrote last.
+    readAvailable();
+    QMetaObject::invokeMethod(this, "onChildExited", Qt::QueuedConnection);
+}
+
+void PtyIFace::onChildExited()
+{
+    PtyReactor::instance()->remove(this);
+    m_childProcessQuit = true;
+    m_childProcessPid = 0;
+    emit hangupReceived();
 }
 
 void PtyIFace::resize(int rows, int columns)
@@ -200,9 +412,37 @@ void PtyIFace::resize(int rows, int columns)
     winp.ws_col = columns;
     winp.ws_row = rows;
 
+    {
+        QMutexLocker locker(&m_lock);
+        if (m_recorder)
+            m_recorder->recordResize(rows, columns);
+    }
+
     ioctl(iMasterFd, TIOCSWINSZ, &winp);
 }
 
+/*!
+ * Record everything read from the pty (and any resizes) to a new file in
+ * \a directory, for replaying later.
+ *
+ * \sa PtyRecorder
+ */
+void PtyIFace::startRecording(const QString& directory)
+{
+    QDir().mkpath(directory);
+    QString fileName = QString("literm-%1-%2.rec").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss")).arg(m_childProcessPid);
+    QFile* file = new QFile(QDir(directory).filePath(fileName));
+    if (!file->open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't record to" << file->fileName() << file->errorString();
+        delete file;
+        return;
+    }
+
+    QMutexLocker locker(&m_lock);
+    delete m_recorder;
+    m_recorder = new PtyRecorder(file, iTextCodec->name());
+}
+
 void PtyIFace::writeTerm(const QString& chars)
 {
     writeTerm(iTextCodec->fromUnicode(chars));
@@ -213,7 +453,32 @@ void PtyIFace::writeTerm(const QByteArray& chars)
     if (m_childProcessQuit)
         return;
 
+    LatencyProbe::mark(LatencyProbe::PtyWrite);
+    LITERM_TRACE_SPAN(span, "pty", "write");
+    LITERM_TRACE_ARG(span, "bytes", chars.size());
     int ret = write(iMasterFd, chars, chars.size());
     if (ret != chars.size())
         qDebug() << "write error!";
 }
+
+#if defined(TEST_MODE)
+
+TEST_CASE("PtyIFace: Child arguments and environment")
+{
+    QList<QByteArray> args = childArguments("vim  -R file");
+    REQUIRE(args == QList<QByteArray>({ "vim", "-R", "file" }));
+    args = childArguments(QString());
+    REQUIRE(args.size() == 2);
+    REQUIRE(args.at(1) == "--login");
+
+    QList<QByteArray> env = childEnvironment(QStringList({ "TERM=dumb", "PATH=/nonexistent:/bin:/usr/bin" }), "xterm");
+    REQUIRE(env == QList<QByteArray>({ "PATH=/nonexistent:/bin:/usr/bin", "TERM=xterm" }));
+
+    QByteArray sh = findExecutable("sh", env);
+    REQUIRE((sh == "/bin/sh" || sh == "/usr/bin/sh"));
+    REQUIRE(findExecutable("/some/where", env) == "/some/where");
+    REQUIRE(findExecutable("literm-nonexistent", env).isEmpty());
+    REQUIRE(findExecutable("bin", QList<QByteArray>({ "PATH=/" })).isEmpty());
+}
+
+#endif // TEST_MODE
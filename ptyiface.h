@@ -20,46 +20,58 @@
 #define PTYIFACE_H
 
 #include <QByteArray>
+#include <QMutex>
 #include <QObject>
 #include <QSize>
-#include <QSocketNotifier>
+#include <QStringList>
 #include <QTextCodec>
 
+#include "ptyreactor.h"
+
+class PtyRecorder;
 class Terminal;
 
-class PtyIFace : public QObject
+// How to start the child process. Empty fields mean the defaults: the user's
+// shell, and the directory and environment of literm itself.
+struct PtyLaunchOptions
+{
+    QString command;
+    QString workingDirectory;
+    QStringList environment; // KEY=value
+};
+
+class PtyIFace : public QObject, private PtyReactor::Client
 {
     Q_OBJECT
 public:
-    explicit PtyIFace(Terminal* term, const QString& charset, const QByteArray& terminalEnv, const QString& commandOverride, QObject* parent);
+    explicit PtyIFace(Terminal* term, const QString& charset, const QByteArray& terminalEnv, const PtyLaunchOptions& launch, QObject* parent);
     virtual ~PtyIFace();
 
     void writeTerm(const QString& chars);
     bool failed() { return iFailed; }
+    bool isRunning() const { return !m_childProcessQuit; }
+    void startRecording(const QString& directory);
+
+    static void setForkOnly(bool forkOnly);
 
-    QString takeData()
-    {
-        QString tmp = m_pendingData;
-        m_pendingData = QString();
-        return tmp;
-    }
+    QString takeData();
 
 private slots:
     void resize(int rows, int columns);
-    void readActivated();
+    void onChildExited();
 
 signals:
     void dataAvailable();
     void hangupReceived();
 
-private slots:
-    void checkForDeadPids();
-
 private:
     Q_DISABLE_COPY(PtyIFace)
 
     void writeTerm(const QByteArray& chars);
 
+    bool readAvailable() override;
+    void childExited() override;
+
     Terminal* iTerm;
     int iPid;
     int iMasterFd;
@@ -67,15 +79,14 @@ private:
     bool m_childProcessQuit;
     int m_childProcessPid;
 
-    QSocketNotifier* iReadNotifier;
-
     QTextCodec* iTextCodec;
 
+    // Read and decoded on the reactor thread, and taken on ours.
+    QMutex m_lock;
+    QTextDecoder* m_decoder;
     QString m_pendingData;
-
-    static void sighandler(int sig);
-    static std::vector<int> m_deadPids;
-    static bool m_initializedSignalHandler;
+    bool m_readPaused;
+    PtyRecorder* m_recorder;
 };
 
 #endif // PTYIFACE_H
@@ -0,0 +1,513 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QSemaphore>
+
+extern "C" {
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(Q_OS_LINUX)
+#    include <sys/epoll.h>
+#    include <sys/syscall.h>
+#    ifndef SYS_pidfd_open
+#        define SYS_pidfd_open 434
+#    endif
+#else
+#    include <poll.h>
+#endif
+}
+
+#include "catch.hpp"
+#include "ptyreactor.h"
+
+/*!
+ * \class PtyReactor
+ * \internal
+ *
+ * PtyReactor waits for output on the master side of every pty in the process,
+ * and for their child processes to exit, on a thread of its own. That keeps
+ * the GUI thread from waking up for each read, and from scanning every session
+ * whenever a child exits.
+ *
+ * Each fd is watched one shot at a time (EPOLLONESHOT on Linux, poll()
+ * elsewhere): after Client::readAvailable() the fd is only watched again if it
+ * asks for it, or when rearm() is called. A client whose reader has fallen
+ * behind can stop watching until it catches up, and the kernel buffer then
+ * blocks the child.
+ *
+ * On Linux 5.3 and later, each child is watched through a pidfd, which becomes
+ * readable when that child exits. As nobody else reaps it, the pid can't be
+ * reused in between, so this is exact. Elsewhere (and on older kernels),
+ * SIGCHLD is turned into a write to a pipe, and the reactor tries waitpid() on
+ * every child it knows of. Either way, the children of clients removed before
+ * their child was gone are reaped as well.
+ *
+ * signalfd would need SIGCHLD blocked in every thread, including those Qt
+ * started before us, so the pipe is used instead.
+ */
+
+static PtyReactor* s_instance = 0;
+static int s_sigchldPipe[2] = { -1, -1 };
+
+static void makePipe(int fds[2])
+{
+    if (pipe(fds) != 0)
+        qFatal("PtyReactor: pipe failed");
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+}
+
+static void drain(int fd)
+{
+    char buf[256];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+}
+
+static void poke(int fd)
+{
+    char c = 0;
+    if (write(fd, &c, 1) < 0) {
+        // full already, which will wake the reactor just as well
+    }
+}
+
+PtyReactor* PtyReactor::instance()
+{
+    if (!s_instance) {
+        s_instance = new PtyReactor;
+        s_instance->start();
+        qAddPostRoutine(&PtyReactor::shutdown);
+    }
+    return s_instance;
+}
+
+void PtyReactor::shutdown()
+{
+    {
+        QMutexLocker locker(&s_instance->m_lock);
+        s_instance->m_quit = true;
+    }
+    s_instance->wake();
+    s_instance->wait();
+    delete s_instance;
+    s_instance = 0;
+}
+
+PtyReactor::PtyReactor()
+    : m_catchingSigchld(false)
+    , m_quit(false)
+{
+    setObjectName("PtyReactor");
+    makePipe(m_wakePipe);
+    makePipe(s_sigchldPipe);
+
+#if defined(Q_OS_LINUX)
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0)
+        qFatal("PtyReactor: epoll_create1 failed");
+    for (int fd : { m_wakePipe[0], s_sigchldPipe[0] }) {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+#endif
+}
+
+PtyReactor::~PtyReactor()
+{
+    if (m_catchingSigchld)
+        signal(SIGCHLD, SIG_DFL);
+#if defined(Q_OS_LINUX)
+    close(m_epoll);
+#endif
+    for (auto it = m_pidfds.cbegin(); it != m_pidfds.cend(); ++it)
+        close(it.key());
+    for (int fd : { m_wakePipe[0], m_wakePipe[1], s_sigchldPipe[0], s_sigchldPipe[1] })
+        close(fd);
+    s_sigchldPipe[0] = s_sigchldPipe[1] = -1;
+}
+
+void PtyReactor::sigchldHandler(int)
+{
+    int savedErrno = errno;
+    poke(s_sigchldPipe[1]);
+    errno = savedErrno;
+}
+
+// Called with the reactor locked.
+void PtyReactor::catchSigchld()
+{
+    if (m_catchingSigchld)
+        return;
+    m_catchingSigchld = true;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &PtyReactor::sigchldHandler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, 0);
+}
+
+/*!
+ * Start watching for \a pid to exit. Returns its pidfd, or -1 if it has to be
+ * caught through SIGCHLD instead. Called with the reactor locked.
+ */
+int PtyReactor::watchChild(int pid)
+{
+#if defined(Q_OS_LINUX)
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd >= 0) {
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = pidfd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, pidfd, &event);
+        m_pidfds.insert(pidfd, pid);
+        return pidfd;
+    }
+#endif
+
+    catchSigchld();
+
+    // The child may well be gone already.
+    poke(s_sigchldPipe[1]);
+    return -1;
+}
+
+// Called with the reactor locked, once \a pidfd is readable.
+void PtyReactor::reapChild(int pidfd)
+{
+    int pid = m_pidfds.take(pidfd);
+    unwatch(pidfd);
+    close(pidfd);
+
+    int status = 0;
+    waitpid(pid, &status, WNOHANG);
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->pidfd == pidfd) {
+            it->pid = 0;
+            it->pidfd = -1;
+            it->client->childExited();
+            return;
+        }
+    }
+}
+
+/*!
+ * Start watching \a fd for \a client, along with the child process \a pid
+ * (if not 0).
+ */
+void PtyReactor::add(Client* client, int fd, int pid)
+{
+    QMutexLocker locker(&m_lock);
+    Entry entry = { client, pid, -1, true };
+    if (pid > 0)
+        entry.pidfd = watchChild(pid);
+    m_entries.insert(fd, entry);
+    watch(fd, false);
+}
+
+/*!
+ * Stop watching the fd and child of \a client. Once this returns, the client
+ * won't be called again, and its fd may be closed.
+ */
+void PtyReactor::remove(Client* client)
+{
+    QMutexLocker locker(&m_lock);
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->client == client) {
+            unwatch(it.key());
+            // A pidfd stays watched until the child is reaped.
+            if (it->pid > 0 && it->pidfd < 0)
+                m_orphans.append(it->pid);
+            m_entries.erase(it);
+            return;
+        }
+    }
+}
+
+/*!
+ * Watch the fd of \a client again, after its readAvailable() returned false.
+ */
+void PtyReactor::rearm(Client* client)
+{
+    QMutexLocker locker(&m_lock);
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->client == client) {
+            if (!it->armed) {
+                it->armed = true;
+                watch(it.key(), true);
+            }
+            return;
+        }
+    }
+}
+
+void PtyReactor::wake()
+{
+    poke(m_wakePipe[1]);
+}
+
+void PtyReactor::run()
+{
+    QVector<int> ready;
+    for (;;) {
+        ready.clear();
+        waitForEvents(&ready);
+
+        QMutexLocker locker(&m_lock);
+        if (m_quit)
+            return;
+
+        for (int fd : qAsConst(ready)) {
+            if (fd == m_wakePipe[0]) {
+                drain(fd);
+            } else if (fd == s_sigchldPipe[0]) {
+                drain(fd);
+                reapChildren();
+            } else if (m_pidfds.contains(fd)) {
+                reapChild(fd);
+            } else {
+                auto it = m_entries.find(fd);
+                if (it == m_entries.end() || !it->armed)
+                    continue;
+                it->armed = false;
+                if (it->client->readAvailable()) {
+                    it->armed = true;
+                    watch(fd, true);
+                }
+            }
+        }
+    }
+}
+
+// Called with the reactor locked.
+void PtyReactor::reapChildren()
+{
+    int status = 0;
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (it->pid <= 0 || it->pidfd >= 0)
+            continue;
+        int ret = waitpid(it->pid, &status, WNOHANG);
+        if (ret == it->pid || (ret < 0 && errno == ECHILD)) {
+            it->pid = 0;
+            it->client->childExited();
+        }
+    }
+
+    for (int i = 0; i < m_orphans.size();) {
+        if (waitpid(m_orphans.at(i), &status, WNOHANG) != 0)
+            m_orphans.remove(i);
+        else
+            i++;
+    }
+}
+
+#if defined(Q_OS_LINUX)
+
+void PtyReactor::watch(int fd, bool added)
+{
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = fd;
+    epoll_ctl(m_epoll, added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+}
+
+void PtyReactor::unwatch(int fd)
+{
+    epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, 0);
+}
+
+void PtyReactor::waitForEvents(QVector<int>* ready)
+{
+    epoll_event events[64];
+    int count = epoll_wait(m_epoll, events, 64, -1);
+    for (int i = 0; i < count; i++)
+        ready->append(events[i].data.fd);
+}
+
+#else
+
+// The set of fds to poll is rebuilt on every iteration, from the armed
+// entries, so only another thread changing it needs to wake the reactor.
+void PtyReactor::watch(int, bool)
+{
+    if (QThread::currentThread() != this)
+        wake();
+}
+
+void PtyReactor::unwatch(int)
+{
+}
+
+void PtyReactor::waitForEvents(QVector<int>* ready)
+{
+    QVector<pollfd> fds;
+    fds.append({ m_wakePipe[0], POLLIN, 0 });
+    fds.append({ s_sigchldPipe[0], POLLIN, 0 });
+    {
+        QMutexLocker locker(&m_lock);
+        for (auto it = m_entries.cbegin(); it != m_entries.cend(); ++it) {
+            if (it->armed)
+                fds.append({ it.key(), POLLIN, 0 });
+        }
+    }
+
+    if (poll(fds.data(), fds.size(), -1) <= 0)
+        return;
+    for (const pollfd& fd : qAsConst(fds)) {
+        if (fd.revents)
+            ready->append(fd.fd);
+    }
+}
+
+#endif
+
+#if defined(TEST_MODE)
+
+struct TestReactorClient : public PtyReactor::Client
+{
+    TestReactorClient(int fd)
+        : fd(fd)
+        , keepWatching(true)
+    {
+    }
+
+    bool readAvailable() override
+    {
+        char buf[64];
+        ssize_t ret;
+        while ((ret = read(fd, buf, sizeof(buf))) > 0)
+            data.append(buf, ret);
+        reads.release();
+        return keepWatching;
+    }
+
+    void childExited() override
+    {
+        exits.release();
+    }
+
+    int fd;
+    bool keepWatching;
+    QByteArray data;
+    QSemaphore reads;
+    QSemaphore exits;
+};
+
+TEST_CASE("PtyReactor: Reads and backpressure")
+{
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    TestReactorClient client(fds[0]);
+    client.keepWatching = false;
+    PtyReactor::instance()->add(&client, fds[0], 0);
+
+    REQUIRE(write(fds[1], "a", 1) == 1);
+    REQUIRE(client.reads.tryAcquire(1, 5000));
+    REQUIRE(client.data == "a");
+
+    // Not watched any more, until rearmed.
+    REQUIRE(write(fds[1], "b", 1) == 1);
+    REQUIRE(!client.reads.tryAcquire(1, 100));
+
+    client.keepWatching = true;
+    PtyReactor::instance()->rearm(&client);
+    REQUIRE(client.reads.tryAcquire(1, 5000));
+    REQUIRE(client.data == "ab");
+
+    REQUIRE(write(fds[1], "c", 1) == 1);
+    REQUIRE(client.reads.tryAcquire(1, 5000));
+    REQUIRE(client.data == "abc");
+
+    PtyReactor::instance()->remove(&client);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("PtyReactor: Child exits are reaped")
+{
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    // Make sure the handler is in place before the child exits.
+    PtyReactor::instance();
+
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0)
+        _exit(0);
+
+    TestReactorClient client(fds[0]);
+    PtyReactor::instance()->add(&client, fds[0], pid);
+    REQUIRE(client.exits.tryAcquire(1, 5000));
+
+    int status = 0;
+    REQUIRE(waitpid(pid, &status, WNOHANG) == -1);
+
+    PtyReactor::instance()->remove(&client);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_CASE("PtyReactor: Children of removed clients are reaped")
+{
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    PtyReactor::instance();
+
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+        usleep(100 * 1000);
+        _exit(0);
+    }
+
+    TestReactorClient client(fds[0]);
+    PtyReactor::instance()->add(&client, fds[0], pid);
+    PtyReactor::instance()->remove(&client);
+
+    // A zombie still takes signals; a reaped child is gone.
+    QElapsedTimer timer;
+    timer.start();
+    while (kill(pid, 0) == 0 && timer.elapsed() < 5000)
+        usleep(10 * 1000);
+    REQUIRE(kill(pid, 0) == -1);
+    REQUIRE(client.exits.available() == 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+#endif // TEST_MODE
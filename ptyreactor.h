@@ -0,0 +1,89 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PTYREACTOR_H
+#define PTYREACTOR_H
+
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+class PtyReactor : public QThread
+{
+public:
+    // Both are called on the reactor thread, with the reactor locked, so a
+    // client is never called after remove() has returned.
+    class Client
+    {
+    public:
+        virtual ~Client() {}
+
+        // The fd is readable. Return false to stop watching it until rearm().
+        virtual bool readAvailable() = 0;
+
+        // The child process has exited, and has been reaped.
+        virtual void childExited() = 0;
+    };
+
+    static PtyReactor* instance();
+
+    void add(Client* client, int fd, int pid);
+    void remove(Client* client);
+    void rearm(Client* client);
+
+protected:
+    void run() override;
+
+private:
+    PtyReactor();
+    ~PtyReactor();
+    Q_DISABLE_COPY(PtyReactor)
+
+    struct Entry
+    {
+        Client* client;
+        int pid;
+        int pidfd; // -1 if the child is watched through SIGCHLD
+        bool armed;
+    };
+
+    void watch(int fd, bool added);
+    void unwatch(int fd);
+    void waitForEvents(QVector<int>* ready);
+    void wake();
+    int watchChild(int pid);
+    void reapChild(int pidfd);
+    void reapChildren();
+    void catchSigchld();
+
+    static void shutdown();
+    static void sigchldHandler(int sig);
+
+    QMutex m_lock;
+    QHash<int, Entry> m_entries; // by fd
+    QHash<int, int> m_pidfds;    // pid by pidfd, for children with one
+    QVector<int> m_orphans;      // children of removed clients, to reap on SIGCHLD
+    bool m_catchingSigchld;
+    bool m_quit;
+    int m_wakePipe[2];
+#if defined(Q_OS_LINUX)
+    int m_epoll;
+#endif
+};
+
+#endif // PTYREACTOR_H
@@ -0,0 +1,248 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QBuffer>
+#include <QIODevice>
+
+#include "catch.hpp"
+#include "ptyrecording.h"
+
+/*!
+ * \class PtyRecorder
+ * \internal
+ *
+ * PtyRecorder writes what a PtyIFace reads from the master side of its pty to
+ * a file, along with resizes of the terminal, so that a session can later be
+ * replayed (see PtyRecordingReader).
+ *
+ * The format is meant to be cheap to write and small:
+ *
+ *  "LITERMREC" <version: byte> <charset length: number> <charset>
+ *  then any number of records:
+ *  'D' <time delta: number> <length: number> <bytes>   data read from the pty
+ *  'R' <time delta: number> <rows: number> <columns: number>   resize
+ *
+ * Numbers are unsigned LEB128 (7 bits per byte, high bit set on all but the
+ * last byte). Time deltas are in microseconds since the previous record.
+ */
+
+static const char recordingMagic[] = "LITERMREC";
+static const int recordingMagicSize = sizeof(recordingMagic) - 1;
+static const char recordingVersion = 1;
+
+PtyRecorder::PtyRecorder(QIODevice* device, const QByteArray& charset)
+    : m_device(device)
+    , m_lastTime(0)
+{
+    m_device->write(recordingMagic, recordingMagicSize);
+    m_device->putChar(recordingVersion);
+    writeNumber(charset.size());
+    m_device->write(charset);
+    m_clock.start();
+}
+
+PtyRecorder::~PtyRecorder()
+{
+    delete m_device;
+}
+
+void PtyRecorder::recordData(const char* data, int size)
+{
+    beginRecord('D');
+    writeNumber(size);
+    m_device->write(data, size);
+}
+
+void PtyRecorder::recordResize(int rows, int columns)
+{
+    beginRecord('R');
+    writeNumber(qMax(0, rows));
+    writeNumber(qMax(0, columns));
+}
+
+void PtyRecorder::beginRecord(char type)
+{
+    qint64 now = m_clock.nsecsElapsed() / 1000;
+    m_device->putChar(type);
+    writeNumber(now - m_lastTime);
+    m_lastTime = now;
+}
+
+void PtyRecorder::writeNumber(quint64 value)
+{
+    char buf[10];
+    int len = 0;
+    do {
+        char byte = value & 0x7f;
+        value >>= 7;
+        if (value)
+            byte |= 0x80;
+        buf[len++] = byte;
+    } while (value);
+    m_device->write(buf, len);
+}
+
+/*!
+ * \class PtyRecordingReader
+ * \internal
+ *
+ * Reads back a recording made by PtyRecorder, one event at a time.
+ */
+
+PtyRecordingReader::PtyRecordingReader(QIODevice* device)
+    : m_device(device)
+    , m_time(0)
+    , m_valid(false)
+{
+    QByteArray magic = m_device->read(recordingMagicSize);
+    char version = 0;
+    if (magic != QByteArray(recordingMagic) || !m_device->getChar(&version) || version != recordingVersion)
+        return;
+
+    quint64 charsetSize = 0;
+    if (!readNumber(&charsetSize) || charsetSize > 256)
+        return;
+    m_charset = m_device->read(charsetSize);
+    m_valid = quint64(m_charset.size()) == charsetSize;
+}
+
+/*!
+ * Read the next event into \a event. Returns false at the end of the
+ * recording, or if it is truncated or corrupt.
+ */
+bool PtyRecordingReader::readNext(PtyRecordingEvent* event)
+{
+    if (!m_valid)
+        return false;
+
+    char type = 0;
+    quint64 delta = 0;
+    if (!m_device->getChar(&type) || !readNumber(&delta))
+        return false;
+
+    m_time += delta;
+    event->time = m_time;
+
+    if (type == 'D') {
+        quint64 size = 0;
+        if (!readNumber(&size) || size > 64 * 1024 * 1024)
+            return false;
+        event->type = PtyRecordingEvent::Data;
+        event->data = m_device->read(size);
+        event->size = QSize();
+        return quint64(event->data.size()) == size;
+    } else if (type == 'R') {
+        quint64 rows = 0;
+        quint64 columns = 0;
+        if (!readNumber(&rows) || !readNumber(&columns))
+            return false;
+        event->type = PtyRecordingEvent::Resize;
+        event->data.clear();
+        event->size = QSize(columns, rows);
+        return true;
+    }
+
+    m_valid = false;
+    return false;
+}
+
+bool PtyRecordingReader::readNumber(quint64* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        char byte;
+        if (!m_device->getChar(&byte))
+            return false;
+        *value |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+#if defined(TEST_MODE)
+
+TEST_CASE("PtyRecording: Round trip")
+{
+    QBuffer* out = new QBuffer;
+    out->open(QIODevice::WriteOnly);
+
+    QByteArray big(100000, 'x');
+    QByteArray recording;
+    {
+        PtyRecorder recorder(out, "UTF-8");
+        recorder.recordResize(24, 80);
+        recorder.recordData("hello", 5);
+        recorder.recordData(big.constData(), big.size());
+        recorder.recordResize(50, 132);
+        recording = out->data();
+    }
+
+    QBuffer in(&recording);
+    in.open(QIODevice::ReadOnly);
+    PtyRecordingReader reader(&in);
+    REQUIRE(reader.isValid());
+    REQUIRE(reader.charset() == "UTF-8");
+
+    PtyRecordingEvent event;
+    REQUIRE(reader.readNext(&event));
+    REQUIRE(event.type == PtyRecordingEvent::Resize);
+    REQUIRE(event.size == QSize(80, 24));
+
+    qint64 lastTime = event.time;
+    REQUIRE(reader.readNext(&event));
+    REQUIRE(event.type == PtyRecordingEvent::Data);
+    REQUIRE(event.data == "hello");
+    REQUIRE(event.time >= lastTime);
+
+    REQUIRE(reader.readNext(&event));
+    REQUIRE(event.data == big);
+
+    REQUIRE(reader.readNext(&event));
+    REQUIRE(event.type == PtyRecordingEvent::Resize);
+    REQUIRE(event.size == QSize(132, 50));
+
+    REQUIRE(!reader.readNext(&event));
+}
+
+TEST_CASE("PtyRecording: Rejects garbage and truncation")
+{
+    QByteArray garbage("not a recording");
+    QBuffer in(&garbage);
+    in.open(QIODevice::ReadOnly);
+    PtyRecordingReader reader(&in);
+    REQUIRE(!reader.isValid());
+
+    QBuffer* out = new QBuffer;
+    out->open(QIODevice::WriteOnly);
+    QByteArray recording;
+    {
+        PtyRecorder recorder(out, "UTF-8");
+        recorder.recordData("hello world", 11);
+        recording = out->data();
+    }
+    recording.chop(3);
+
+    QBuffer truncated(&recording);
+    truncated.open(QIODevice::ReadOnly);
+    PtyRecordingReader truncatedReader(&truncated);
+    REQUIRE(truncatedReader.isValid());
+    PtyRecordingEvent event;
+    REQUIRE(!truncatedReader.readNext(&event));
+}
+
+#endif // TEST_MODE
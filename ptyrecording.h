@@ -0,0 +1,84 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PTYRECORDING_H
+#define PTYRECORDING_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QSize>
+
+class QIODevice;
+
+struct PtyRecordingEvent
+{
+    enum Type
+    {
+        Data,
+        Resize
+    };
+
+    Type type;
+    qint64 time; // microseconds since the start of the recording
+    QByteArray data;
+    QSize size; // columns x rows
+};
+
+class PtyRecorder
+{
+public:
+    // Takes ownership of device, which must already be open for writing.
+    PtyRecorder(QIODevice* device, const QByteArray& charset);
+    ~PtyRecorder();
+
+    void recordData(const char* data, int size);
+    void recordResize(int rows, int columns);
+
+private:
+    Q_DISABLE_COPY(PtyRecorder)
+
+    void beginRecord(char type);
+    void writeNumber(quint64 value);
+
+    QIODevice* m_device;
+    QElapsedTimer m_clock;
+    qint64 m_lastTime;
+};
+
+class PtyRecordingReader
+{
+public:
+    // Does not take ownership of device, which must be open for reading.
+    explicit PtyRecordingReader(QIODevice* device);
+
+    bool isValid() const { return m_valid; }
+    QByteArray charset() const { return m_charset; }
+
+    bool readNext(PtyRecordingEvent* event);
+
+private:
+    Q_DISABLE_COPY(PtyRecordingReader)
+
+    bool readNumber(quint64* value);
+
+    QIODevice* m_device;
+    QByteArray m_charset;
+    qint64 m_time;
+    bool m_valid;
+};
+
+#endif // PTYRECORDING_H
@@ -100,7 +100,9 @@ Rectangle {
                     textrender.y = 0;
                 }
                 onTitleChanged: {
-                    Util.windowTitle = title
+                    // The title of this window, not whichever has focus.
+                    if (Window.window)
+                        Window.window.title = title
                 }
                 dragMode: Util.dragMode
                 onVisualBell: {
@@ -131,79 +133,20 @@ Rectangle {
                 cellDelegate: Rectangle {
                 }
                 cellContentsDelegate: Text {
-                    id: text
-                    property bool blinking: false
-
                     textFormat: Text.PlainText
-                    opacity: blinking ? 0.5 : 1.0
-                    SequentialAnimation {
-                        running: blinking
-                        loops: Animation.Infinite
-                        NumberAnimation {
-                            target: text
-                            property: "opacity"
-                            to: 0.8
-                            duration: 200
-                        }
-                        PauseAnimation {
-                            duration: 400
-                        }
-                        NumberAnimation {
-                            target: text
-                            property: "opacity"
-                            to: 0.5
-                            duration: 200
-                        }
-                    }
                 }
                 cursorDelegate: Rectangle {
-                    id: cursor
-                    opacity: 0.5
-                    SequentialAnimation {
-                        running: {
-                            if (Qt.application.state != Qt.ApplicationActive) {
-                                return false;
-                            }
-
-                            return startPauseAnim.duration > 0 ||
-                                   fadeInAnim.duration > 0 ||
-                                   middlePauseAnim.duration > 0 ||
-                                   fadeOutAnim.duration > 0 ||
-                                   endPauseAnim.duration > 0
-                        }
-                        loops: Animation.Infinite
-                        PauseAnimation {
-                            id: startPauseAnim
-                            duration: Util.cursorAnimationStartPauseDuration
-                        }
-                        NumberAnimation {
-                            id: fadeInAnim
-                            target: cursor
-                            property: "opacity"
-                            to: 0.8
-                            duration: Util.cursorAnimationFadeInDuration
-                        }
-                        PauseAnimation {
-                            id: middlePauseAnim
-                            duration: Util.cursorAnimationMiddlePauseDuration
-                        }
-                        NumberAnimation {
-                            id: fadeOutAnim
-                            target: cursor
-                            property: "opacity"
-                            to: 0.5
-                            duration: Util.cursorAnimationFadeOutDuration
-                        }
-                        PauseAnimation {
-                            id: endPauseAnim
-                            duration: Util.cursorAnimationEndPauseDuration
-                        }
-                    }
+                    opacity: textrender.blinkOn ? 0.5 : 0.8
                 }
                 selectionDelegate: Rectangle {
                     color: "blue"
                     opacity: 0.5
                 }
+                searchHighlightDelegate: Rectangle {
+                    property bool current
+                    color: current ? "#ff9900" : "#ffff00"
+                    opacity: current ? 0.6 : 0.35
+                }
 
                 Rectangle {
                     id: bellTimerRect
@@ -224,7 +167,7 @@ Rectangle {
                 anchors.fill: parent
                 font.family: Util.fontFamily
                 font.pointSize: Util.fontSize
-                allowGestures: !menu.showing && !urlWindow.show && !aboutDialog.show && !layoutWindow.show
+                allowGestures: !(menu.item && menu.item.showing) && !urlWindow.show && !aboutDialog.show && !layoutWindow.show
 
                 onCutAfterChanged: {
                     // this property is used in the paint function, so make sure that the element gets
@@ -244,7 +187,7 @@ Rectangle {
 
         function closeTab(screenItem) {
             if (tabView.count == 1) {
-                Qt.quit();
+                Window.window.close();
                 return;
             }
             for (var i = 0; i < tabView.count; i++) {
@@ -340,6 +283,12 @@ Rectangle {
                     tabView.currentIndex = 9 // yes, this is right. 0 indexed.
             }
         }
+        Shortcut {
+            sequence: Qt.platform.os == "osx" ? "Ctrl+F" : "Ctrl+Shift+F"
+            onActivated: {
+                searchBar.open();
+            }
+        }
         Shortcut {
             sequence: Qt.platform.os == "osx" ? "Ctrl+T" : "Ctrl+Shift+T"
             onActivated: {
@@ -370,13 +319,25 @@ Rectangle {
         }
     }
 
+    SearchBar {
+        id: searchBar
+
+        anchors.right: parent.right
+        anchors.bottom: parent.bottom
+        anchors.margins: window.paddingMedium
+        terminal: tabView.activeTabItem
+    }
+
     MouseArea {
         //top right corner menu button
         x: window.width - width
         width: menuImg.width + 60*window.pixelRatio
         height: menuImg.height + 30*window.pixelRatio
         opacity: 0.5
-        onClicked: menu.showing = true
+        onClicked: {
+            menu.active = true
+            menu.item.showing = true
+        }
 
         Image {
             id: menuImg
@@ -404,10 +365,14 @@ Rectangle {
         }
     }
 
-    MenuLiterm {
+    // Created the first time it's opened, along with the menu.xml model.
+    Loader {
         id: menu
         anchors.fill: parent
-        activeTerminal: tabView.activeTabItem
+        active: false
+        sourceComponent: MenuLiterm {
+            activeTerminal: tabView.activeTabItem
+        }
     }
 
     Text {
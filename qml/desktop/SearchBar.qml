@@ -0,0 +1,160 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software. you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+import QtQuick 2.6
+
+Rectangle {
+    id: searchBar
+
+    // The TextRender to search.
+    property Item terminal
+    property bool show
+    property bool regularExpression
+    property bool caseSensitive
+
+    // The one searched last, to end its search when switching tabs.
+    property Item searchedTerminal
+
+    visible: show
+    width: row.width + 2*window.paddingMedium
+    height: row.height + 2*window.paddingSmall
+    color: "#202020"
+    border.color: "#303030"
+    border.width: 1
+    radius: window.radiusSmall
+
+    onTerminalChanged: {
+        if (show)
+            search()
+    }
+    onRegularExpressionChanged: search()
+    onCaseSensitiveChanged: search()
+
+    Row {
+        id: row
+
+        anchors.centerIn: parent
+        spacing: window.paddingMedium
+
+        Rectangle {
+            width: 200*window.pixelRatio
+            height: input.height + 2*window.paddingSmall
+            anchors.verticalCenter: parent.verticalCenter
+            color: "#000000"
+            border.color: searchBar.terminal && !searchBar.terminal.searchValid ? "#ff3030" : "#606060"
+            border.width: 1
+
+            TextInput {
+                id: input
+
+                anchors.left: parent.left
+                anchors.right: parent.right
+                anchors.verticalCenter: parent.verticalCenter
+                anchors.margins: window.paddingSmall
+                color: "#ffffff"
+                clip: true
+                font.pointSize: window.uiFontSize > 0 ? window.uiFontSize : 12
+
+                onTextChanged: searchBar.search()
+
+                // Down to the next match, or up with shift.
+                Keys.onPressed: {
+                    if (event.key != Qt.Key_Return && event.key != Qt.Key_Enter)
+                        return;
+                    event.accepted = true;
+                    if (!searchBar.terminal)
+                        return;
+                    if (event.modifiers & Qt.ShiftModifier)
+                        searchBar.terminal.searchPrevious()
+                    else
+                        searchBar.terminal.searchNext()
+                }
+                Keys.onEscapePressed: searchBar.close()
+            }
+        }
+
+        Text {
+            anchors.verticalCenter: parent.verticalCenter
+            width: 80*window.pixelRatio
+            color: "#ffffff"
+            font.pointSize: window.uiFontSize > 0 ? window.uiFontSize : 12
+            text: {
+                var t = searchBar.terminal;
+                if (!t || input.text == "")
+                    return "";
+                if (!t.searchValid)
+                    return "error";
+                var count = t.searchMatchCount + (t.searchBusy ? "+" : "");
+                if (t.searchCurrentMatch < 0)
+                    return count;
+                return (t.searchCurrentMatch + 1) + "/" + count;
+            }
+        }
+
+        Button {
+            text: "Aa"
+            width: window.buttonWidthSmall
+            height: window.buttonHeightSmall
+            highlighted: searchBar.caseSensitive
+            onClicked: searchBar.caseSensitive = !searchBar.caseSensitive
+        }
+
+        Button {
+            text: ".*"
+            width: window.buttonWidthSmall
+            height: window.buttonHeightSmall
+            highlighted: searchBar.regularExpression
+            onClicked: searchBar.regularExpression = !searchBar.regularExpression
+        }
+
+        Button {
+            text: "x"
+            width: window.buttonWidthSmall
+            height: window.buttonHeightSmall
+            onClicked: searchBar.close()
+        }
+    }
+
+    function open()
+    {
+        show = true;
+        input.selectAll();
+        input.forceActiveFocus();
+        search();
+    }
+
+    function close()
+    {
+        show = false;
+        if (searchedTerminal)
+            searchedTerminal.endSearch();
+        searchedTerminal = null;
+        if (terminal)
+            terminal.forceActiveFocus();
+    }
+
+    function search()
+    {
+        if (!show)
+            return;
+        if (searchedTerminal && searchedTerminal !== terminal)
+            searchedTerminal.endSearch();
+        searchedTerminal = terminal;
+        if (terminal)
+            terminal.search(input.text, regularExpression, caseSensitive);
+    }
+}
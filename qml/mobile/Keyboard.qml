@@ -21,7 +21,11 @@ import literm 1.0
 Item {
     id: keyboard
 
-    property int keyModifiers
+    property bool active
+    // Key.qml delegates instead of the KeyboardItem, for restyling.
+    property bool useKeyDelegates: Util.keyDelegates
+
+    property int keyModifiers: useKeyDelegates ? 0 : keyboardItem.keyModifiers
     property Key resetSticky
     property Key currentStickyPressed
     property Key currentKeyPressed
@@ -37,7 +41,49 @@ Item {
     property real keywidth: (keyboard.width - keyspacing*keysPerRow - outmargins*2)/keysPerRow;
 
     width: parent.width
-    height: childrenRect.height + outmargins
+    height: useKeyDelegates ? keyboardLoader.height + outmargins : keyboardItem.implicitHeight
+
+    KeyboardItem {
+        id: keyboardItem
+
+        visible: !keyboard.useKeyDelegates
+        width: keyboard.width
+        height: implicitHeight
+
+        layout: KeyLoader
+        active: keyboard.active
+
+        keyFgColor: keyboard.keyFgColor
+        keyBgColor: keyboard.keyBgColor
+        keyHilightBgColor: keyboard.keyHilightBgColor
+        keyBorderColor: keyboard.keyBorderColor
+        fontFamily: Util.fontFamily
+        fontSizeSmall: window.fontSizeSmall
+        fontSizeLarge: window.fontSizeLarge
+        radius: window.radiusSmall
+        pixelRatio: window.pixelRatio
+
+        margins: keyboard.outmargins
+        keySpacing: keyboard.keyspacing
+        keyHeight: window.height/8 < 55*window.pixelRatio ? window.height/8 : 55*window.pixelRatio
+
+        onKeyPressed: window.vkbKeypress(code, modifiers)
+
+        onPressedKeyChanged: {
+            if (pressedLabel !== "") {
+                var rect = pressedKeyRect
+                visualKeyFeedbackRect.label = pressedLabel
+                visualKeyFeedbackRect.width = rect.width*1.5
+                visualKeyFeedbackRect.height = rect.height*1.5
+                var mappedCoord = window.mapFromItem(keyboardItem, rect.x, rect.y);
+                visualKeyFeedbackRect.x = mappedCoord.x - (visualKeyFeedbackRect.width-rect.width)/2
+                visualKeyFeedbackRect.y = mappedCoord.y - rect.height*1.5
+                visualKeyFeedbackRect.visible = true;
+            } else {
+                visualKeyFeedbackRect.visible = false;
+            }
+        }
+    }
 
     Component {
         id: keyboardContents
@@ -79,7 +125,8 @@ Item {
     }
 
     Component.onCompleted: {
-        keyboardLoader.sourceComponent = keyboardContents;
+        if (useKeyDelegates)
+            keyboardLoader.sourceComponent = keyboardContents;
     }
 
     onCurrentKeyPressedChanged: {
@@ -109,6 +156,8 @@ Item {
                     Qt.quit();
                 }
             }
+            if (!useKeyDelegates)
+                return; // KeyboardItem follows KeyLoader itself
             keyboard.keyModifiers = 0
             // makes the keyboard component reload itself with new data
             keyboardLoader.sourceComponent = undefined
@@ -116,6 +165,42 @@ Item {
         }
     }
 
+    // Touch points, by id, in (x, y) of our parent, which handles touch.
+    property var pressedKeys: ({})
+
+    function press(pointId, x, y) {
+        if (!useKeyDelegates) {
+            keyboardItem.press(pointId, x - keyboard.x, y - keyboard.y)
+            return
+        }
+        var key = keyAt(x, y)
+        if (key != null) {
+            key.handlePress(keyboard.parent, x, y)
+            pressedKeys[pointId] = key
+        }
+    }
+
+    function move(pointId, x, y) {
+        if (!useKeyDelegates) {
+            keyboardItem.move(pointId, x - keyboard.x, y - keyboard.y)
+            return
+        }
+        var key = pressedKeys[pointId]
+        if (key != null && !key.handleMove(keyboard.parent, x, y))
+            delete pressedKeys[pointId]
+    }
+
+    function release(pointId, x, y) {
+        if (!useKeyDelegates) {
+            keyboardItem.release(pointId, x - keyboard.x, y - keyboard.y)
+            return
+        }
+        var key = pressedKeys[pointId]
+        if (key != null)
+            key.handleRelease(keyboard.parent, x, y)
+        delete pressedKeys[pointId]
+    }
+
     //borrowed from nemo-keyboard
     //Parameters: (x, y) in view coordinates
     function keyAt(x, y) {
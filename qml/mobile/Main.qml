@@ -17,7 +17,7 @@
 
 import QtQuick 2.0
 import literm 1.0
-import QtQuick.Window 2.0
+import QtQuick.Window 2.2
 
 Item {
     id: root
@@ -88,7 +88,7 @@ Item {
                 focus: true
 
                 onHangupReceived: {
-                    Qt.quit()
+                    Window.window.close()
                 }
                 onPanLeft: {
                     Util.notifyText(Util.panLeftTitle)
@@ -109,7 +109,9 @@ Item {
 
                 onDisplayBufferChanged: window.displayBufferChanged()
                 onTitleChanged: {
-                    Util.windowTitle = title
+                    // The title of this window, not whichever has focus.
+                    if (Window.window)
+                        Window.window.title = title
                 }
                 dragMode: Util.dragMode
                 onVisualBell: {
@@ -132,53 +134,10 @@ Item {
                 cellDelegate: Rectangle {
                 }
                 cellContentsDelegate: Text {
-                    id: text
-                    property bool blinking: false
-
                     textFormat: Text.PlainText
-                    opacity: blinking ? 0.5 : 1.0
-                    SequentialAnimation {
-                        running: blinking
-                        loops: Animation.Infinite
-                        NumberAnimation {
-                            target: text
-                            property: "opacity"
-                            to: 0.8
-                            duration: 200
-                        }
-                        PauseAnimation {
-                            duration: 400
-                        }
-                        NumberAnimation {
-                            target: text
-                            property: "opacity"
-                            to: 0.5
-                            duration: 200
-                        }
-                    }
                 }
                 cursorDelegate: Rectangle {
-                    id: cursor
-                    opacity: 0.5
-                    SequentialAnimation {
-                        running: Qt.application.state == Qt.ApplicationActive
-                        loops: Animation.Infinite
-                        NumberAnimation {
-                            target: cursor
-                            property: "opacity"
-                            to: 0.8
-                            duration: 200
-                        }
-                        PauseAnimation {
-                            duration: 400
-                        }
-                        NumberAnimation {
-                            target: cursor
-                            property: "opacity"
-                            to: 0.5
-                            duration: 200
-                        }
-                    }
+                    opacity: textrender.blinkOn ? 0.5 : 0.8
                 }
                 selectionDelegate: Rectangle {
                     color: "blue"
@@ -224,7 +183,6 @@ Item {
                 Keyboard {
                     id: vkb
 
-                    property bool active
                     property bool keyboardEnabled: (Util.keyboardMode == Util.KeyboardMove)
                                                     || (Util.keyboardMode == Util.KeyboardFade)
 
@@ -244,7 +202,6 @@ Item {
                     anchors.fill: parent
 
                     property int firstTouchId: -1
-                    property var pressedKeys: ({})
 
                     onPressed: {
                         touchPoints.forEach(function (touchPoint) {
@@ -253,11 +210,7 @@ Item {
                                 //gestures c++ handler
                                 textrender.mousePress(touchPoint.x, touchPoint.y)
                             }
-                            var key = vkb.keyAt(touchPoint.x, touchPoint.y)
-                            if (key != null) {
-                                key.handlePress(multiTouchArea, touchPoint.x, touchPoint.y)
-                            }
-                            multiTouchArea.pressedKeys[touchPoint.pointId] = key
+                            vkb.press(touchPoint.pointId, touchPoint.x, touchPoint.y)
                         })
                     }
                     onUpdated: {
@@ -266,12 +219,7 @@ Item {
                                 //gestures c++ handler
                                 textrender.mouseMove(touchPoint.x, touchPoint.y);
                             }
-                            var key = multiTouchArea.pressedKeys[touchPoint.pointId]
-                            if (key != null) {
-                                if (!key.handleMove(multiTouchArea, touchPoint.x, touchPoint.y)) {
-                                    delete multiTouchArea.pressedKeys[touchPoint.pointId];
-                                }
-                            }
+                            vkb.move(touchPoint.pointId, touchPoint.x, touchPoint.y)
                         })
                     }
                     onReleased: {
@@ -294,11 +242,7 @@ Item {
                                 textrender.mouseRelease(touchPoint.x, touchPoint.y)
                                 multiTouchArea.firstTouchId = -1
                             }
-                            var key = multiTouchArea.pressedKeys[touchPoint.pointId]
-                            if (key != null) {
-                                key.handleRelease(multiTouchArea, touchPoint.x, touchPoint.y)
-                            }
-                            delete multiTouchArea.pressedKeys[touchPoint.pointId]
+                            vkb.release(touchPoint.pointId, touchPoint.x, touchPoint.y)
                         })
                     }
                 }
@@ -310,7 +254,10 @@ Item {
                 width: menuImg.width + 60*window.pixelRatio
                 height: menuImg.height + 30*window.pixelRatio
                 opacity: 0.5
-                onClicked: menu.showing = true
+                onClicked: {
+                    menu.active = true
+                    menu.item.showing = true
+                }
 
                 Image {
                     id: menuImg
@@ -356,8 +303,13 @@ Item {
                 }
             }
 
-            MenuLiterm {
+            // Created the first time it's opened, along with the menu.xml model.
+            Loader {
                 id: menu
+                anchors.fill: parent
+                active: false
+                sourceComponent: MenuLiterm {
+                }
             }
 
             Text {
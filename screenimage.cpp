@@ -0,0 +1,258 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <QQmlComponent>
+#include <cmath>
+
+#if defined(TEST_MODE)
+#    include <QFontMetricsF>
+#    include "testterminal.h"
+#endif
+
+#include "catch.hpp"
+#include "parser.h"
+#include "screenimage.h"
+#include "sessionmanager.h"
+#include "terminal.h"
+#include "textrender.h"
+
+/*!
+ * \class ScreenImage
+ * \internal
+ *
+ * ScreenImage takes pictures of a Terminal as TextRender draws it. It puts a
+ * TextRender, with the delegates of the desktop Main.qml, in a window of its
+ * own that is never shown, and grabs the window's contents. What ends up in
+ * the image is the scene graph TextRender builds, rendered for real.
+ *
+ * Grabbing a window that was never exposed needs the software scene graph
+ * backend, which must be chosen before the first window is created:
+ *
+ *     QQuickWindow::setSceneGraphBackend(QSGRendererInterface::Software);
+ *
+ * It is used by the tests to check colors and layout, and by the benchmarks
+ * to time drawing a screen and to save and compare pictures of one.
+ *
+ * Nothing runs the event loop in between, so the window's BlinkClock stays in
+ * its "on" phase: blinking text and the cursor are always drawn as they are
+ * in that phase.
+ */
+
+/*!
+ * Show \a terminal, which stays owned by the caller. The window is sized for
+ * the terminal's size at this point.
+ */
+ScreenImage::ScreenImage(Terminal* terminal)
+    : m_terminal(terminal)
+{
+    static bool registered = false;
+    if (!registered) {
+        qmlRegisterType<TextRender>("literm", 1, 0, "TextRender");
+        registered = true;
+    }
+
+    // Have the TextRender pick up the terminal as it starts, as it would a
+    // detached session, rather than start a shell of its own.
+    std::unique_ptr<SessionManager> ownSessions;
+    SessionManager* sessions = SessionManager::instance();
+    if (!sessions) {
+        ownSessions.reset(new SessionManager);
+        sessions = ownSessions.get();
+    }
+    sessions->detach(m_terminal);
+    sessions->requestAttach();
+
+    QQmlComponent component(&m_engine);
+    component.setData(
+        "import QtQuick 2.0\n"
+        "import literm 1.0\n"
+        "TextRender {\n"
+        "    id: textrender\n"
+        "    property int cutAfter: height\n"
+        "    font.family: \"monospace\"; font.pointSize: 10\n"
+        "    contentItem: Item {}\n"
+        "    cellDelegate: Rectangle {}\n"
+        "    cellContentsDelegate: Text { textFormat: Text.PlainText }\n"
+        "    cursorDelegate: Rectangle { opacity: textrender.blinkOn ? 0.5 : 0.8 }\n"
+        "    selectionDelegate: Rectangle { color: \"blue\"; opacity: 0.5 }\n"
+        "    searchHighlightDelegate: Rectangle {\n"
+        "        property bool current\n"
+        "        color: current ? \"#ff9900\" : \"#ffff00\"\n"
+        "        opacity: current ? 0.6 : 0.35\n"
+        "    }\n"
+        "}\n",
+        QUrl());
+    m_render.reset(qobject_cast<TextRender*>(component.create()));
+    if (!m_render || m_terminal->parent() != m_render.get())
+        qFatal("ScreenImage: %s", qPrintable(component.errorString()));
+
+    // Room for exactly the terminal's rows and columns, inside the margins
+    // TextRender keeps.
+    QSizeF cell = m_render->cellSize();
+    QSize size(std::ceil(m_terminal->columns() * cell.width()) + 4,
+        std::ceil(m_terminal->rows() * cell.height()) + 4);
+
+    // The background of Main.qml.
+    m_window.setColor(QColor("#000000"));
+    m_window.resize(size);
+    m_render->setSize(size);
+    m_render->setParentItem(m_window.contentItem());
+}
+
+ScreenImage::~ScreenImage()
+{
+    // The TextRender would take the terminal along with it.
+    m_terminal->setParent(0);
+}
+
+/*!
+ * Polish and render the window, and read it back. This is the whole cost of
+ * getting a changed screen drawn, plus that of the read back.
+ */
+QImage ScreenImage::grab()
+{
+    return m_window.grabWindow();
+}
+
+/*!
+ * Compare two images, returning the number of pixels where any channel differs
+ * by more than \a tolerance. Images of different sizes never match.
+ */
+int ScreenImage::compare(const QImage& a, const QImage& b, int tolerance)
+{
+    if (a.size() != b.size())
+        return qMax(a.width() * a.height(), b.width() * b.height());
+
+    QImage ca = a.convertToFormat(QImage::Format_ARGB32);
+    QImage cb = b.convertToFormat(QImage::Format_ARGB32);
+
+    int differences = 0;
+    for (int y = 0; y < ca.height(); y++) {
+        const QRgb* la = reinterpret_cast<const QRgb*>(ca.constScanLine(y));
+        const QRgb* lb = reinterpret_cast<const QRgb*>(cb.constScanLine(y));
+        for (int x = 0; x < ca.width(); x++) {
+            if (qAbs(qRed(la[x]) - qRed(lb[x])) > tolerance
+                || qAbs(qGreen(la[x]) - qGreen(lb[x])) > tolerance
+                || qAbs(qBlue(la[x]) - qBlue(lb[x])) > tolerance
+                || qAbs(qAlpha(la[x]) - qAlpha(lb[x])) > tolerance) {
+                differences++;
+            }
+        }
+    }
+    return differences;
+}
+
+#if defined(TEST_MODE)
+
+static std::unique_ptr<TestTerminal> setupRenderTerminal(const QString& contents)
+{
+    auto terminal = setupTestTerminal();
+    terminal->setTermSize(QSize(20, 5));
+    terminal->insertInBuffer(contents);
+    return terminal;
+}
+
+// Sample the middle of a cell, which is clear of any glyph in these tests.
+static QRgb cellPixel(const QImage& image, const ScreenImage& screen, int column, int row)
+{
+    QSizeF cell = screen.textRender()->cellSize();
+    qreal descent = QFontMetricsF(screen.textRender()->font()).descent();
+    QPoint p(2 + cell.width() * (column - 1) + cell.width() / 2,
+        descent + cell.height() * (row - 1) + cell.height() / 2);
+    return image.pixel(p) & 0xffffff;
+}
+
+TEST_CASE("ScreenImage: Image covers the terminal")
+{
+    auto terminal = setupRenderTerminal("");
+    ScreenImage screen(terminal.get());
+    QImage image = screen.grab();
+    REQUIRE(image.size() == screen.imageSize());
+    REQUIRE(image.width() >= 20 * screen.textRender()->cellSize().width());
+    REQUIRE(image.height() >= 5 * screen.textRender()->cellSize().height());
+
+    // It is the size TextRender got to pick.
+    REQUIRE(terminal->columns() == 20);
+    REQUIRE(terminal->rows() == 5);
+    REQUIRE(terminal->parent() == screen.textRender());
+}
+
+TEST_CASE("ScreenImage: Background colors")
+{
+    // Hide the cursor so it doesn't cover any samples.
+    auto terminal = setupRenderTerminal("\e[?25l\e[41m   \e[0m   \e[7m   \e[0m");
+    ScreenImage screen(terminal.get());
+    QImage image = screen.grab();
+
+    QRgb bg = Parser::fetchDefaultBgColor() & 0xffffff;
+    QRgb fg = Parser::fetchDefaultFgColor() & 0xffffff;
+    QRgb red = terminal->buffer().at(0).at(0).bgColor & 0xffffff;
+
+    REQUIRE(red != bg);
+    REQUIRE(cellPixel(image, screen, 1, 1) == red);
+    REQUIRE(cellPixel(image, screen, 5, 1) == bg);
+    REQUIRE(cellPixel(image, screen, 8, 1) == fg);
+    REQUIRE(cellPixel(image, screen, 1, 3) == bg);
+}
+
+TEST_CASE("ScreenImage: Inverse video")
+{
+    auto terminal = setupRenderTerminal("\e[?25l\e[?5h");
+    REQUIRE(terminal->inverseVideoMode());
+    ScreenImage screen(terminal.get());
+    QImage image = screen.grab();
+
+    REQUIRE(cellPixel(image, screen, 1, 1) == (Parser::fetchDefaultFgColor() & 0xffffff));
+    REQUIRE(cellPixel(image, screen, 20, 5) == (Parser::fetchDefaultFgColor() & 0xffffff));
+}
+
+TEST_CASE("ScreenImage: Cursor and selection")
+{
+    auto terminal = setupRenderTerminal("");
+    ScreenImage screen(terminal.get());
+
+    QImage plain = screen.grab();
+    QRgb bg = Parser::fetchDefaultBgColor() & 0xffffff;
+    REQUIRE(cellPixel(plain, screen, 1, 1) != bg);
+    REQUIRE(cellPixel(plain, screen, 2, 1) == bg);
+
+    terminal->setSelection(QPoint(3, 2), QPoint(6, 2), false);
+    QImage selected = screen.grab();
+    REQUIRE(cellPixel(selected, screen, 4, 2) != bg);
+    REQUIRE(cellPixel(selected, screen, 4, 3) == bg);
+    REQUIRE(ScreenImage::compare(plain, selected) > 0);
+}
+
+TEST_CASE("ScreenImage: Follows the terminal")
+{
+    auto terminal = setupRenderTerminal("\e[?25l");
+    ScreenImage screen(terminal.get());
+    QImage empty = screen.grab();
+
+    terminal->insertInBuffer("hello \e[1mbold\e[0m \e[4munder\e[0m\r\n\e[32mgreen\e[0m");
+    QImage first = screen.grab();
+    REQUIRE(ScreenImage::compare(first, empty) > 0);
+
+    // Nothing changed, nothing moves.
+    REQUIRE(ScreenImage::compare(first, screen.grab()) == 0);
+
+    // A window of its own draws the same screen the same way.
+    auto again = setupRenderTerminal("\e[?25lhello \e[1mbold\e[0m \e[4munder\e[0m\r\n\e[32mgreen\e[0m");
+    ScreenImage other(again.get());
+    REQUIRE(ScreenImage::compare(first, other.grab()) == 0);
+}
+
+#endif // TEST_MODE
@@ -0,0 +1,50 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SCREENIMAGE_H
+#define SCREENIMAGE_H
+
+#include <QImage>
+#include <QQmlEngine>
+#include <QQuickWindow>
+#include <memory>
+
+class Terminal;
+class TextRender;
+
+class ScreenImage
+{
+public:
+    explicit ScreenImage(Terminal* terminal);
+    ~ScreenImage();
+
+    TextRender* textRender() const { return m_render.get(); }
+    QSize imageSize() const { return m_window.size(); }
+
+    QImage grab();
+
+    static int compare(const QImage& a, const QImage& b, int tolerance = 0);
+
+private:
+    Q_DISABLE_COPY(ScreenImage)
+
+    Terminal* m_terminal;
+    QQmlEngine m_engine;
+    QQuickWindow m_window;
+    std::unique_ptr<TextRender> m_render;
+};
+
+#endif // SCREENIMAGE_H
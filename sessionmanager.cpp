@@ -0,0 +1,202 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QPointer>
+
+#include "catch.hpp"
+#include "sessionmanager.h"
+#include "terminal.h"
+#include "utilities.h"
+
+/*!
+ * \class SessionManager
+ * \internal
+ *
+ * SessionManager keeps sessions (a Terminal, with its pty and child process)
+ * running after the window showing them is closed, in the literm server, so
+ * that they can be attached to a new window later.
+ *
+ * A detached Terminal goes on reading and parsing output (throttled, like a
+ * hidden tab), so attaching it only takes laying out the screen. It is deleted
+ * if its child exits while detached.
+ */
+
+static SessionManager* s_instance;
+
+SessionManager::SessionManager(QObject* parent)
+    : QObject(parent)
+    , m_prestarted(0)
+    , m_keepSessions(false)
+    , m_attachRequested(false)
+{
+    Q_ASSERT(s_instance == nullptr);
+    s_instance = this;
+}
+
+SessionManager::~SessionManager()
+{
+    s_instance = nullptr;
+}
+
+SessionManager* SessionManager::instance()
+{
+    return s_instance;
+}
+
+/*!
+ * Whether sessions are detached when their window is closed, rather than
+ * hung up.
+ */
+void SessionManager::setKeepSessions(bool keep)
+{
+    m_keepSessions = keep;
+}
+
+/*!
+ * Take over \a terminal, whose view is going away.
+ */
+void SessionManager::detach(Terminal* terminal)
+{
+    terminal->setParent(this);
+    terminal->setThrottled(true);
+    m_detached.append(terminal);
+
+    connect(terminal, &Terminal::hangupReceived, this, [this, terminal]() {
+        m_detached.removeOne(terminal);
+        terminal->deleteLater();
+    });
+}
+
+/*!
+ * Have the next TextRender to start attach the most recently detached session,
+ * if there is one, instead of starting a new one.
+ */
+void SessionManager::requestAttach()
+{
+    m_attachRequested = true;
+}
+
+/*!
+ * The session asked for by requestAttach(), if any. The request is used up
+ * either way, so that it doesn't carry over to some later window.
+ */
+Terminal* SessionManager::takeSessionToAttach()
+{
+    bool requested = m_attachRequested;
+    m_attachRequested = false;
+    if (!requested || m_detached.isEmpty())
+        return 0;
+
+    Terminal* terminal = m_detached.takeLast();
+    disconnect(terminal, 0, this, 0);
+    terminal->setParent(0);
+    return terminal;
+}
+
+/*!
+ * Start the session for the next TextRender right away, so that the shell
+ * gets going while the window is still being loaded. Its size is a guess until
+ * it is shown.
+ */
+void SessionManager::prestart()
+{
+    if (m_prestarted)
+        return;
+
+    m_prestarted = new Terminal(this);
+    m_prestarted->setTermSize(QSize(80, 24));
+    m_prestarted->init();
+}
+
+/*!
+ * The session started by prestart(), if it hasn't been taken yet. It may have
+ * hung up already.
+ */
+Terminal* SessionManager::takePrestarted()
+{
+    Terminal* terminal = m_prestarted;
+    if (terminal) {
+        m_prestarted = 0;
+        terminal->setParent(0);
+    }
+    return terminal;
+}
+
+#if defined(TEST_MODE)
+
+TEST_CASE("SessionManager: Detach and attach")
+{
+    if (Util::instance() == nullptr)
+        new Util("");
+
+    SessionManager sessions;
+    QPointer<Terminal> first = new Terminal;
+    QPointer<Terminal> second = new Terminal;
+
+    sessions.detach(first);
+    sessions.detach(second);
+    REQUIRE(sessions.detachedCount() == 2);
+    REQUIRE(first->parent() == &sessions);
+    REQUIRE(first->isThrottled());
+
+    // Only when asked for.
+    REQUIRE(sessions.takeSessionToAttach() == nullptr);
+
+    sessions.requestAttach();
+    Terminal* attached = sessions.takeSessionToAttach();
+    REQUIRE(attached == second);
+    REQUIRE(attached->parent() == nullptr);
+    REQUIRE(sessions.detachedCount() == 1);
+    REQUIRE(sessions.takeSessionToAttach() == nullptr);
+
+    // Attached sessions are no longer looked after.
+    emit attached->hangupReceived();
+    REQUIRE(sessions.detachedCount() == 1);
+    delete attached;
+
+    // Detached sessions that hang up go away.
+    emit first->hangupReceived();
+    REQUIRE(sessions.detachedCount() == 0);
+
+    // A request with nothing to attach isn't kept for the next one detached.
+    sessions.requestAttach();
+    REQUIRE(sessions.takeSessionToAttach() == nullptr);
+    QPointer<Terminal> third = new Terminal;
+    sessions.detach(third);
+    REQUIRE(sessions.takeSessionToAttach() == nullptr);
+    REQUIRE(sessions.detachedCount() == 1);
+}
+
+TEST_CASE("SessionManager: Prestarted session")
+{
+    if (Util::instance() == nullptr)
+        new Util("");
+
+    SessionManager sessions;
+    REQUIRE(sessions.takePrestarted() == nullptr);
+
+    Util::instance()->setNextLaunch({ "true", QString(), QStringList() });
+    sessions.prestart();
+    Terminal* terminal = sessions.takePrestarted();
+    REQUIRE(terminal != nullptr);
+    REQUIRE(terminal->parent() == nullptr);
+    REQUIRE(terminal->columns() == 80);
+    REQUIRE(sessions.takePrestarted() == nullptr);
+    delete terminal;
+}
+
+#endif // TEST_MODE
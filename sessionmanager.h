@@ -0,0 +1,56 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SESSIONMANAGER_H
+#define SESSIONMANAGER_H
+
+#include <QList>
+#include <QObject>
+
+class Terminal;
+
+class SessionManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SessionManager(QObject* parent = 0);
+    virtual ~SessionManager();
+
+    static SessionManager* instance();
+
+    bool keepsSessions() const { return m_keepSessions; }
+    void setKeepSessions(bool keep);
+
+    void detach(Terminal* terminal);
+    int detachedCount() const { return m_detached.size(); }
+
+    void requestAttach();
+    Terminal* takeSessionToAttach();
+
+    void prestart();
+    Terminal* takePrestarted();
+
+private:
+    Q_DISABLE_COPY(SessionManager)
+
+    QList<Terminal*> m_detached; // oldest first
+    Terminal* m_prestarted;
+    bool m_keepSessions;
+    bool m_attachRequested;
+};
+
+#endif // SESSIONMANAGER_H
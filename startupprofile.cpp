@@ -0,0 +1,190 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QMutex>
+#include <QStringList>
+#include <QVector>
+#include <algorithm>
+
+#include "catch.hpp"
+#include "startupprofile.h"
+
+/*!
+ * \class StartupProfile
+ * \internal
+ *
+ * StartupProfile records when each phase of starting up (see Phase) is first
+ * reached, from the start of main() until the first output of the shell is on
+ * screen.
+ *
+ * The output phases are only taken in order: a frame only counts as having
+ * the output on it once that output has been read, parsed and polished. When
+ * the first output is presented, the completion handler is called on the GUI
+ * thread.
+ *
+ * As with LatencyProbe, mark() is a single predictable branch when disabled
+ * (the default). Phases may be marked from the reactor and render threads, so
+ * recording takes a lock.
+ */
+
+bool StartupProfile::s_enabled = false;
+
+static QMutex s_lock;
+static QElapsedTimer s_clock;
+static QVector<qint64> s_time(StartupProfile::PhaseCount, -1);
+static void (*s_completionHandler)() = 0;
+
+static const char* const phaseNames[] = {
+    "main",
+    "application",
+    "settings",
+    "shellStarted",
+    "configCopied",
+    "keyboardLoaded",
+    "qmlLoaded",
+    "windowShown",
+    "firstFrame",
+    "outputRead",
+    "outputParsed",
+    "outputPolished",
+    "outputPresented",
+};
+
+/*!
+ * Enabling starts the clock, so this should be the first thing in main().
+ */
+void StartupProfile::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&s_lock);
+    if (!s_clock.isValid())
+        s_clock.start();
+    s_enabled = enabled;
+}
+
+void StartupProfile::setCompletionHandler(void (*handler)())
+{
+    QMutexLocker locker(&s_lock);
+    s_completionHandler = handler;
+}
+
+void StartupProfile::record(Phase phase)
+{
+    QMutexLocker locker(&s_lock);
+    if (s_time[phase] >= 0)
+        return;
+    if (phase > OutputRead && s_time[phase - 1] < 0)
+        return;
+
+    s_time[phase] = s_clock.nsecsElapsed();
+
+    void (*handler)() = s_completionHandler;
+    if (phase == OutputPresented && handler && QCoreApplication::instance())
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [handler]() { handler(); }, Qt::QueuedConnection);
+}
+
+bool StartupProfile::isComplete()
+{
+    QMutexLocker locker(&s_lock);
+    return s_time[OutputPresented] >= 0;
+}
+
+/*!
+ * The phases reached so far, in the order they were reached, each with the
+ * time since main() and since the phase before, in milliseconds.
+ */
+QJsonObject StartupProfile::timeline()
+{
+    QMutexLocker locker(&s_lock);
+
+    QVector<int> reached;
+    for (int phase = 0; phase < PhaseCount; phase++) {
+        if (s_time[phase] >= 0)
+            reached.append(phase);
+    }
+    std::stable_sort(reached.begin(), reached.end(), [](int a, int b) { return s_time[a] < s_time[b]; });
+
+    QJsonArray phases;
+    qint64 previous = 0;
+    for (int phase : qAsConst(reached)) {
+        QJsonObject entry;
+        entry["phase"] = phaseNames[phase];
+        entry["ms"] = s_time[phase] / 1e6;
+        entry["deltaMs"] = (s_time[phase] - previous) / 1e6;
+        phases.append(entry);
+        previous = s_time[phase];
+    }
+
+    QJsonObject out;
+    out["phases"] = phases;
+    if (s_time[OutputPresented] >= 0)
+        out["firstOutputMs"] = s_time[OutputPresented] / 1e6;
+    return out;
+}
+
+void StartupProfile::reset()
+{
+    QMutexLocker locker(&s_lock);
+    s_time.fill(-1);
+}
+
+#if defined(TEST_MODE)
+
+TEST_CASE("StartupProfile: Disabled by default")
+{
+    REQUIRE(!StartupProfile::isEnabled());
+    StartupProfile::mark(StartupProfile::Main);
+    REQUIRE(StartupProfile::timeline()["phases"].toArray().isEmpty());
+}
+
+TEST_CASE("StartupProfile: Output phases are taken in order")
+{
+    StartupProfile::setEnabled(true);
+    StartupProfile::reset();
+
+    StartupProfile::mark(StartupProfile::Main);
+    StartupProfile::mark(StartupProfile::ShellStarted);
+    StartupProfile::mark(StartupProfile::Main);
+
+    // A frame without output, and output that isn't polished yet.
+    StartupProfile::mark(StartupProfile::FirstFrame);
+    StartupProfile::mark(StartupProfile::OutputPresented);
+    StartupProfile::mark(StartupProfile::OutputParsed);
+    StartupProfile::mark(StartupProfile::OutputRead);
+    StartupProfile::mark(StartupProfile::OutputPresented);
+    REQUIRE(!StartupProfile::isComplete());
+
+    StartupProfile::mark(StartupProfile::OutputParsed);
+    StartupProfile::mark(StartupProfile::OutputPolished);
+    StartupProfile::mark(StartupProfile::OutputPresented);
+    REQUIRE(StartupProfile::isComplete());
+
+    QJsonObject timeline = StartupProfile::timeline();
+    QJsonArray phases = timeline["phases"].toArray();
+    QStringList names;
+    for (const QJsonValue& phase : phases)
+        names.append(phase.toObject()["phase"].toString());
+    REQUIRE(names == QStringList({ "main", "shellStarted", "firstFrame", "outputRead", "outputParsed", "outputPolished", "outputPresented" }));
+    REQUIRE(timeline["firstOutputMs"].toDouble() >= phases.at(0).toObject()["ms"].toDouble());
+
+    StartupProfile::reset();
+    StartupProfile::setEnabled(false);
+}
+
+#endif // TEST_MODE
@@ -0,0 +1,63 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STARTUPPROFILE_H
+#define STARTUPPROFILE_H
+
+#include <QJsonObject>
+
+class StartupProfile
+{
+public:
+    enum Phase
+    {
+        Main,            // main() entered
+        Application,     // QGuiApplication created
+        Settings,        // Util has read the settings
+        ShellStarted,    // PtyIFace has started the first child
+        ConfigCopied,    // default config files are in place
+        KeyboardLoaded,  // KeyLoader::loadLayout
+        QmlLoaded,       // the first window's Main.qml is created
+        WindowShown,     // ... and shown
+        FirstFrame,      // QQuickWindow::frameSwapped
+        OutputRead,      // PtyIFace::readAvailable, with the first output
+        OutputParsed,    // Terminal::insertInBuffer is done with it
+        OutputPolished,  // TextRender::updatePolish
+        OutputPresented, // QQuickWindow::frameSwapped
+        PhaseCount
+    };
+
+    static bool isEnabled() { return s_enabled; }
+    static void setEnabled(bool enabled);
+    static void setCompletionHandler(void (*handler)());
+
+    static void mark(Phase phase)
+    {
+        if (Q_UNLIKELY(s_enabled))
+            record(phase);
+    }
+
+    static bool isComplete();
+    static QJsonObject timeline();
+    static void reset();
+
+private:
+    static void record(Phase phase);
+    static bool s_enabled;
+};
+
+#endif // STARTUPPROFILE_H
@@ -23,13 +23,21 @@
 #include <QRegularExpression>
 
 #if defined(TEST_MODE)
+#    include <QElapsedTimer>
 #    include <QSignalSpy>
+
+#    include "allocationcounter.h"
+#    include "testterminal.h"
 #endif
 
 #include "catch.hpp"
+#include "latencyprobe.h"
 #include "parser.h"
 #include "ptyiface.h"
+#include "startupprofile.h"
 #include "terminal.h"
+#include "terminalsearch.h"
+#include "trace.h"
 #include "utilities.h"
 
 #if defined(Q_OS_MAC)
@@ -55,6 +63,46 @@ Q_LOGGING_CATEGORY(tunimp, "literm.terminal.unimplemented", QtDebugMsg)
     A TerminalBuffer is a collection of TerminalLine instances.
 */
 
+/*!
+    Remove the first \a count lines.
+
+    The back buffer has lines removed from the front every time the screen
+    scrolls once it is full, so this must not cost O(size()). The lines are
+    released right away, but the storage is only compacted once more than half
+    of it is unused, making this amortized O(count).
+*/
+void TerminalBuffer::removeFirst(int count)
+{
+    count = qMin(count, size());
+    if (count <= 0)
+        return;
+
+    for (int i = 0; i < count; i++)
+        m_buffer[m_head + i] = TerminalLine();
+    m_head += count;
+
+    if (m_head > size()) {
+        m_buffer.remove(0, m_head);
+        m_head = 0;
+    }
+}
+
+qint64 TerminalBuffer::memoryUsage() const
+{
+    qint64 bytes = 0;
+    for (int i = 0; i < size(); i++)
+        bytes += at(i).memoryUsage();
+    return bytes;
+}
+
+// How often a throttled terminal parses its output, in milliseconds.
+static const int throttledDispatchInterval = 100;
+
+// All terminals in the process, for the scrollback memory budget.
+static QVector<Terminal*> s_terminals;
+static qint64 s_totalBackBufferMemoryUsage = 0;
+static quint64 s_viewCounter = 0;
+
 static bool charIsHexDigit(QChar ch)
 {
     if (ch.isDigit()) // 0-9
@@ -69,6 +117,7 @@ static bool charIsHexDigit(QChar ch)
 
 Terminal::Terminal(QObject* parent)
     : QObject(parent)
+    , m_pty(0)
     , iTermSize(0, 0)
     , iEmitCursorChangeSignal(true)
     , iShowCursor(true)
@@ -78,13 +127,21 @@ Terminal::Terminal(QObject* parent)
     , iNewLineMode(false)
     , iBackBufferScrollPos(0)
     , m_dispatch_timer(0)
+    , m_backBufferMemoryUsage(0)
+    , m_squeezedLines(0)
+    , m_droppedLines(0)
+    , m_search(0)
+    , m_lastViewed(++s_viewCounter)
+    , m_throttled(false)
 {
+    s_terminals.append(this);
+
     zeroChar.c = ' ';
     zeroChar.bgColor = Parser::fetchDefaultBgColor();
     zeroChar.fgColor = Parser::fetchDefaultFgColor();
     zeroChar.attrib = TermChar::NoAttributes;
 
-    escape = -1;
+    resetEscape();
 
     iTermAttribs.currentFgColor = Parser::fetchDefaultFgColor();
     iTermAttribs.currentBgColor = Parser::fetchDefaultBgColor();
@@ -102,10 +159,21 @@ Terminal::Terminal(QObject* parent)
     resetTerminal(ResetMode::Hard);
 }
 
+Terminal::~Terminal()
+{
+    // Before the buffers it reads go away.
+    delete m_search;
+    s_terminals.removeOne(this);
+    s_totalBackBufferMemoryUsage -= m_backBufferMemoryUsage;
+}
+
 void Terminal::init()
 {
     auto u = Util::instance();
-    m_pty = new PtyIFace(this, u->charset(), u->terminalEmulator(), u->terminalCommand(), this);
+    PtyLaunchOptions launch = u->takeNextLaunch();
+    if (launch.command.isEmpty())
+        launch.command = u->terminalCommand();
+    m_pty = new PtyIFace(this, u->charset(), u->terminalEmulator(), launch, this);
     if (m_pty->failed())
         qFatal("pty failure");
     connect(m_pty, SIGNAL(dataAvailable()), this, SLOT(onDataAvailable()));
@@ -117,6 +185,13 @@ void Terminal::onDataAvailable()
     if (m_dispatch_timer)
         return;
 
+    // Nobody is looking, so there's no hurry: parse everything that arrives
+    // in a while in one go.
+    if (m_throttled) {
+        m_dispatch_timer = startTimer(throttledDispatchInterval, Qt::CoarseTimer);
+        return;
+    }
+
     // instantly dispatch
     insertInBuffer(m_pty->takeData());
 
@@ -124,6 +199,31 @@ void Terminal::onDataAvailable()
     m_dispatch_timer = startTimer(3);
 }
 
+/*!
+ * Whether the child process was started, and hasn't exited yet.
+ */
+bool Terminal::isRunning() const
+{
+    return m_pty && m_pty->isRunning();
+}
+
+/*!
+ * Parse output in larger batches, for when the terminal isn't visible.
+ */
+void Terminal::setThrottled(bool throttled)
+{
+    if (m_throttled == throttled)
+        return;
+    m_throttled = throttled;
+
+    // Catch up right away when shown again.
+    if (!m_throttled && m_dispatch_timer) {
+        killTimer(m_dispatch_timer);
+        m_dispatch_timer = 0;
+        onDataAvailable();
+    }
+}
+
 void Terminal::timerEvent(QTimerEvent*)
 {
     killTimer(m_dispatch_timer);
@@ -391,6 +491,7 @@ void Terminal::keyPress(int key, int modifiers, const QString& text)
         }
 
         if (!toWrite.isEmpty()) {
+            LatencyProbe::mark(LatencyProbe::KeyPress);
             resetBackBufferScrollPos();
             if (!toWrite.startsWith('\e')) {
                 // Only affect selection if not writing escape codes
@@ -430,23 +531,84 @@ void Terminal::keyPress(int key, int modifiers, const QString& text)
         }
     }
 
+    if (!toWrite.isEmpty())
+        LatencyProbe::mark(LatencyProbe::KeyPress);
     resetBackBufferScrollPos();
     clearSelection();
     m_pty->writeTerm(toWrite);
     return;
 }
 
+// Sequences longer than these are abandoned: the rest of the sequence is still
+// consumed up to its terminator, but it is not stored or acted on.
+static const int maxCsiLength = 512;
+static const int maxOscLength = 16 * 1024;
+
+// Control strings whose payload is consumed and discarded: DCS, SOS, PM and
+// APC. Like OSC, they run until ST (ESC \).
+static bool isDiscardedString(int escape)
+{
+    return escape == 'P' || escape == 'X' || escape == '^' || escape == '_';
+}
+
 void Terminal::insertInBuffer(const QString& chars)
 {
     if (iTermSize.isNull())
         return;
 
+    LITERM_TRACE_SPAN(span, "terminal", "parse");
+    LITERM_TRACE_ARG(span, "chars", chars.size());
+
     iEmitCursorChangeSignal = false;
 
     for (int i = 0; i < chars.size(); i++) {
         const QChar& ch = chars.at(i);
         auto scalar = ch.toLatin1();
 
+        // CAN and SUB abort any sequence in progress.
+        if (ch.unicode() == 24 || ch.unicode() == 26) {
+            resetEscape();
+            continue;
+        }
+
+        // Inside a control string, everything up to the terminator is payload,
+        // including other control characters.
+        if (escape == ']' || isDiscardedString(escape)) {
+            if (scalar == '\e') {
+                stringEscape = escape;
+                escape = 0;
+            } else if (scalar == '\a' && escape == ']') { // BEL also ends OSC sequence
+                LITERM_TRACE_ADD(span, "osc", 1);
+                if (!escapeOverflow)
+                    oscSequence(oscSeq);
+                resetEscape();
+            } else if (escape == ']' && !escapeOverflow) {
+                if (oscSeq.size() < maxOscLength) {
+                    oscSeq += ch;
+                } else {
+                    qCWarning(tlog) << "discarding OSC sequence longer than" << maxOscLength;
+                    escapeOverflow = true;
+                    oscSeq.clear();
+                }
+            }
+            continue;
+        }
+
+        // ESC inside a control string is either the start of ST, or the start
+        // of a new sequence that cuts the string short.
+        if (escape == 0 && stringEscape >= 0) {
+            bool terminated = scalar == '\\';
+            if (terminated && stringEscape == ']') {
+                LITERM_TRACE_ADD(span, "osc", 1);
+                if (!escapeOverflow)
+                    oscSequence(oscSeq);
+            }
+            resetEscape();
+            if (terminated)
+                continue;
+            escape = 0;
+        }
+
         switch (scalar) {
         case '\n':
         case 11: // vertical tab
@@ -471,14 +633,8 @@ void Terminal::insertInBuffer(const QString& chars)
             // only move cursor, don't actually erase.
             setCursorPos(QPoint(cursorPos().x() - 1, cursorPos().y()));
             break;
-        case '\a':               // BEL
-            if (escape == ']') { // BEL also ends OSC sequence
-                escape = -1;
-                oscSequence(oscSeq);
-                oscSeq.clear();
-            } else {
-                emit visualBell();
-            }
+        case '\a': // BEL
+            emit visualBell();
             break;
         case '\t':
             forwardTab();
@@ -489,41 +645,50 @@ void Terminal::insertInBuffer(const QString& chars)
             break;
         default:
             if (escape >= 0) {
-                if (escape == 0 && (scalar == '[')) {
-                    escape = '['; //ansi sequence
-                    escSeq += ch;
-                } else if (escape == 0 && (scalar == ']')) {
-                    escape = ']'; //osc sequence
-                    oscSeq += ch;
-                } else if (escape == 0 && multiCharEscapes.contains(scalar)) {
-                    escape = scalar;
-                    escSeq += ch;
-                } else if (escape == 0 && scalar == '\\') { // ESC\ also ends OSC sequence
-                    escape = -1;
-                    oscSequence(oscSeq);
-                    oscSeq.clear();
-                } else if (scalar == '\e') {
+                if (scalar == '\e') {
+                    // A new sequence cuts short the one in progress.
+                    resetEscape();
                     escape = 0;
-                } else if (escape == '[' || multiCharEscapes.contains(escape)) {
-                    escSeq += ch;
-                } else if (escape == ']') {
-                    oscSeq += ch;
-                } else if (multiCharEscapes.contains(escape)) {
-                    escSeq += ch;
+                } else if (escape == 0) {
+                    if (scalar == '[') {
+                        escape = '['; //ansi sequence
+                        escSeq += ch;
+                    } else if (scalar == ']') {
+                        escape = ']'; //osc sequence
+                        oscSeq += ch;
+                    } else if (isDiscardedString(scalar)) {
+                        escape = scalar;
+                    } else if (multiCharEscapes.contains(scalar)) {
+                        escape = scalar;
+                        escSeq += ch;
+                    } else if (scalar == '\\') {
+                        escape = -1; // ST with no string to terminate
+                    } else {
+                        LITERM_TRACE_ADD(span, "esc", 1);
+                        escControlChar(QByteArray(1, scalar));
+                        escape = -1;
+                    }
+                } else if (escape == '[') {
+                    if (escSeq.size() < maxCsiLength) {
+                        escSeq += ch;
+                    } else if (!escapeOverflow) {
+                        qCWarning(tlog) << "discarding CSI sequence longer than" << maxCsiLength;
+                        escapeOverflow = true;
+                    }
+
+                    if (scalar >= 64 && scalar <= 126 && scalar != '[') {
+                        LITERM_TRACE_ADD(span, "csi", 1);
+                        if (!escapeOverflow)
+                            ansiSequence(escSeq);
+                        resetEscape();
+                    }
                 } else {
-                    escControlChar(QByteArray(1, scalar));
-                    escape = -1;
-                }
-
-                if (escape == '[' && scalar >= 64 && scalar <= 126 && scalar != '[') {
-                    ansiSequence(escSeq);
-                    escape = -1;
-                    escSeq.clear();
-                }
-                if (multiCharEscapes.contains(escape) && escSeq.length() >= 2) {
-                    escControlChar(escSeq);
-                    escape = -1;
-                    escSeq.clear();
+                    escSeq += ch;
+                    if (escSeq.length() >= 2) {
+                        LITERM_TRACE_ADD(span, "esc", 1);
+                        escControlChar(escSeq);
+                        resetEscape();
+                    }
                 }
             } else {
                 if (scalar == '\e') {
@@ -538,6 +703,23 @@ void Terminal::insertInBuffer(const QString& chars)
 
     iEmitCursorChangeSignal = true;
     emit displayBufferChanged();
+
+    LatencyProbe::mark(LatencyProbe::Parsed);
+    StartupProfile::mark(StartupProfile::OutputParsed);
+}
+
+/*! \internal
+ *
+ * Abandon any escape sequence or control string in progress, and go back to
+ * handling plain text.
+ */
+void Terminal::resetEscape()
+{
+    escape = -1;
+    stringEscape = -1;
+    escapeOverflow = false;
+    escSeq.clear();
+    oscSeq.clear();
 }
 
 void Terminal::insertAtCursor(QChar c, bool overwriteMode, bool advanceCursor)
@@ -598,7 +780,7 @@ void Terminal::clearAll(bool wholeBuffer)
 {
     clearSelection();
     if (wholeBuffer) {
-        backBuffer().clear();
+        clearBackBuffer();
         resetBackBufferScrollPos();
         clearSelection();
     }
@@ -858,7 +1040,8 @@ void Terminal::ansiSequence(const QString& seq)
             params.append(0);
         if (params.count() == 1 && params.at(0) == 0) {
             QString toWrite = QString("%1[?1;2c").arg('\e').toLatin1();
-            m_pty->writeTerm(toWrite);
+            if (m_pty)
+                m_pty->writeTerm(toWrite);
         } else
             unhandled = true;
         break;
@@ -892,7 +1075,8 @@ void Terminal::ansiSequence(const QString& seq)
     case 'n':
         if (params.count() >= 1 && params.at(0) == 6 && extra == "") { // write cursor pos
             QString toWrite = QString("%1[%2;%3R").arg('\e').arg(cursorPos().y()).arg(cursorPos().x()).toLatin1();
-            m_pty->writeTerm(toWrite);
+            if (m_pty)
+                m_pty->writeTerm(toWrite);
         } else {
             unhandled = true;
         }
@@ -1253,7 +1437,8 @@ void Terminal::oscSequence(const QString& seq)
         if (seq.at(0) == ']') {
             if ((seq.at(1) == '0' || seq.at(1) == '2') && seq.at(2) == ';') {
                 // set window title
-                emit windowTitleChanged(seq.mid(3));
+                m_windowTitle = seq.mid(3);
+                emit windowTitleChanged(m_windowTitle);
                 return;
             } else if (seq.at(1) == '7' && seq.at(2) == ';') {
                 // working directory changed
@@ -1372,12 +1557,16 @@ const QStringList Terminal::printableLinesFromCursor(int lines)
     int start = cursorPos().y() - lines;
     int end = cursorPos().y() + lines;
 
+    // Only read through const references here: lines may be shared with the
+    // renderer, and non-const access would detach them.
+    const TerminalBuffer& buf = buffer();
     for (int l = start - 1; l < end; l++) {
         ret.append("");
-        if (l >= 0 && l < buffer().size()) {
-            for (int i = 0; i < buffer()[l].size(); i++) {
-                if (buffer()[l][i].c.isPrint())
-                    ret[ret.size() - 1].append(buffer()[l][i].c);
+        if (l >= 0 && l < buf.size()) {
+            const TerminalLine& line = buf.at(l);
+            for (int i = 0; i < line.size(); i++) {
+                if (line.at(i).c.isPrint())
+                    ret[ret.size() - 1].append(line.at(i).c);
             }
         }
     }
@@ -1387,9 +1576,138 @@ const QStringList Terminal::printableLinesFromCursor(int lines)
 
 void Terminal::trimBackBuffer()
 {
-    // ### this could be done better (removeN)
-    while (backBuffer().size() > Util::instance()->terminalScrollbackSize()) {
-        backBuffer().removeAt(0);
+    int excess = backBuffer().size() - Util::instance()->terminalScrollbackSize();
+    if (excess > 0)
+        removeFromBackBuffer(excess);
+
+    qint64 budget = Util::instance()->scrollbackMemoryLimit();
+    if (budget > 0 && s_totalBackBufferMemoryUsage > budget)
+        enforceMemoryBudget(budget);
+}
+
+void Terminal::appendToBackBuffer(const TerminalLine& line)
+{
+    iBackBuffer.append(line);
+    adjustBackBufferMemoryUsage(line.memoryUsage());
+}
+
+TerminalLine Terminal::takeLastFromBackBuffer()
+{
+    TerminalLine line = iBackBuffer.takeAt(iBackBuffer.size() - 1);
+    adjustBackBufferMemoryUsage(-line.memoryUsage());
+    m_squeezedLines = qMin(m_squeezedLines, iBackBuffer.size());
+    return line;
+}
+
+/*! \internal
+ *
+ * Remove the oldest \a count lines of the back buffer.
+ */
+void Terminal::removeFromBackBuffer(int count)
+{
+    count = qMin(count, iBackBuffer.size());
+    if (count <= 0)
+        return;
+
+    qint64 bytes = 0;
+    for (int i = 0; i < count; i++)
+        bytes += iBackBuffer.at(i).memoryUsage();
+    iBackBuffer.removeFirst(count);
+    m_droppedLines += count;
+    adjustBackBufferMemoryUsage(-bytes);
+    m_squeezedLines = qMax(0, m_squeezedLines - count);
+
+    if (iBackBufferScrollPos > iBackBuffer.size()) {
+        iBackBufferScrollPos = iBackBuffer.size();
+        emit scrollBackBufferAdjusted(false);
+    }
+}
+
+void Terminal::clearBackBuffer()
+{
+    m_droppedLines += iBackBuffer.size();
+    iBackBuffer.clear();
+    adjustBackBufferMemoryUsage(-m_backBufferMemoryUsage);
+    m_squeezedLines = 0;
+}
+
+/*! \internal
+ *
+ * Release the unused capacity of lines in the back buffer. Lines grow as
+ * they're written to, and usually end up with room to spare by the time they
+ * scroll off the screen.
+ */
+void Terminal::squeezeBackBuffer()
+{
+    qint64 delta = 0;
+    for (int i = m_squeezedLines; i < iBackBuffer.size(); i++) {
+        TerminalLine& line = iBackBuffer[i];
+        int before = line.memoryUsage();
+        line.squeeze();
+        delta += line.memoryUsage() - before;
+    }
+    m_squeezedLines = iBackBuffer.size();
+    adjustBackBufferMemoryUsage(delta);
+}
+
+void Terminal::adjustBackBufferMemoryUsage(qint64 delta)
+{
+    m_backBufferMemoryUsage += delta;
+    s_totalBackBufferMemoryUsage += delta;
+}
+
+/*!
+ * Note that the terminal is being looked at, so that its scrollback is the
+ * last to go when over the memory budget.
+ */
+void Terminal::markViewed()
+{
+    m_lastViewed = ++s_viewCounter;
+}
+
+/*!
+ * The memory used by the back buffers of all terminals in the process.
+ */
+qint64 Terminal::totalBackBufferMemoryUsage()
+{
+    return s_totalBackBufferMemoryUsage;
+}
+
+/*!
+ * Bring the memory used by all back buffers under \a budget bytes.
+ *
+ * The back buffers of the least recently viewed terminals are squeezed first,
+ * and if that isn't enough, their oldest lines are dropped. To avoid doing
+ * this on every line of output once the budget is reached, usage is brought
+ * down to a little below the budget.
+ */
+void Terminal::enforceMemoryBudget(qint64 budget)
+{
+    if (s_totalBackBufferMemoryUsage <= budget)
+        return;
+
+    const qint64 target = budget - budget / 8;
+
+    QVector<Terminal*> terminals = s_terminals;
+    std::sort(terminals.begin(), terminals.end(), [](const Terminal* a, const Terminal* b) {
+        return a->m_lastViewed < b->m_lastViewed;
+    });
+
+    for (Terminal* terminal : qAsConst(terminals)) {
+        if (s_totalBackBufferMemoryUsage <= target)
+            return;
+        terminal->squeezeBackBuffer();
+    }
+
+    for (Terminal* terminal : qAsConst(terminals)) {
+        if (s_totalBackBufferMemoryUsage <= target)
+            return;
+
+        int count = 0;
+        qint64 excess = s_totalBackBufferMemoryUsage - target;
+        while (excess > 0 && count < terminal->iBackBuffer.size())
+            excess -= terminal->iBackBuffer.at(count++).memoryUsage();
+        terminal->removeFromBackBuffer(count);
     }
 }
 
@@ -1398,6 +1716,9 @@ void Terminal::scrollBack(int lines, int insertAt)
     if (lines <= 0)
         return;
 
+    LITERM_TRACE_SPAN(span, "terminal", "scrollBack");
+    LITERM_TRACE_ARG(span, "lines", lines);
+
     adjustSelectionPosition(lines);
 
     bool useBackbuffer = true;
@@ -1410,7 +1731,7 @@ void Terminal::scrollBack(int lines, int insertAt)
     while (lines > 0) {
         if (!iUseAltScreenBuffer) {
             if (iBackBuffer.size() > 0 && useBackbuffer)
-                buffer().insert(insertAt, iBackBuffer.takeAt(iBackBuffer.size() - 1));
+                buffer().insert(insertAt, takeLastFromBackBuffer());
             else
                 buffer().insert(insertAt, TerminalLine());
         } else {
@@ -1432,6 +1753,9 @@ void Terminal::scrollFwd(int lines, int removeAt)
     if (lines <= 0)
         return;
 
+    LITERM_TRACE_SPAN(span, "terminal", "scrollFwd");
+    LITERM_TRACE_ARG(span, "lines", lines);
+
     adjustSelectionPosition(-lines);
 
     if (removeAt == -1) {
@@ -1446,7 +1770,7 @@ void Terminal::scrollFwd(int lines, int removeAt)
         buffer().insert(iMarginBottom, TerminalLine());
 
         if (!iUseAltScreenBuffer)
-            iBackBuffer.append(buffer().takeAt(removeAt));
+            appendToBackBuffer(buffer().takeAt(removeAt));
         else
             buffer().removeAt(removeAt);
 
@@ -1463,7 +1787,7 @@ void Terminal::resetTerminal(ResetMode mode)
     if (mode == ResetMode::Hard) {
         iBuffer.clear();
         iAltBuffer.clear();
-        iBackBuffer.clear();
+        clearBackBuffer();
         iTermAttribs.cursorPos = QPoint(1, 1);
     }
 
@@ -1528,37 +1852,31 @@ const QStringList Terminal::grabURLsFromBuffer()
     QStringList ret;
     QByteArray buf;
 
+    auto appendLine = [&](const TerminalLine& line) {
+        for (int j = 0; j < line.size(); j++) {
+            if (line.at(j).c.isPrint()) {
+                buf.append(QString(line.at(j).c).toUtf8());
+            } else if (line.at(j).c == 0) {
+                buf.append(' ');
+            }
+        }
+        if (line.size() < iTermSize.width()) {
+            buf.append(' ');
+        }
+    };
+
     //backbuffer
     if (!iUseAltScreenBuffer
         || backBufferScrollPos() > 0) //a lazy workaround: just grab everything when the buffer is being scrolled (TODO: make a proper fix)
     {
-        for (int i = 0; i < iBackBuffer.size(); i++) {
-            for (int j = 0; j < iBackBuffer[i].size(); j++) {
-                if (iBackBuffer[i][j].c.isPrint()) {
-                    buf.append(QString(iBackBuffer[i][j].c).toUtf8());
-                } else if (iBackBuffer[i][j].c == 0) {
-                    buf.append(' ');
-                }
-            }
-            if (iBackBuffer[i].size() < iTermSize.width()) {
-                buf.append(' ');
-            }
-        }
+        for (int i = 0; i < iBackBuffer.size(); i++)
+            appendLine(iBackBuffer.at(i));
     }
 
     //main buffer
-    for (int i = 0; i < buffer().size(); i++) {
-        for (int j = 0; j < buffer()[i].size(); j++) {
-            if (buffer()[i][j].c.isPrint()) {
-                buf.append(QString(buffer()[i][j].c).toUtf8());
-            } else if (buffer()[i][j].c == 0) {
-                buf.append(' ');
-            }
-        }
-        if (buffer()[i].size() < iTermSize.width()) {
-            buf.append(' ');
-        }
-    }
+    const TerminalBuffer& screen = buffer();
+    for (int i = 0; i < screen.size(); i++)
+        appendLine(screen.at(i));
 
     /* http://blog.mattheworiordan.com/post/13174566389/url-regular-expression-for-links-with-or-without-the */
     QRegularExpression re("("
@@ -1589,6 +1907,17 @@ const QStringList Terminal::grabURLsFromBuffer()
     return ret;
 }
 
+/*!
+ * The search through this terminal's scrollback and screen, created the first
+ * time it is asked for.
+ */
+TerminalSearch* Terminal::search()
+{
+    if (!m_search)
+        m_search = new TerminalSearch(this);
+    return m_search;
+}
+
 void Terminal::scrollBackBufferFwd(int lines)
 {
     if (lines <= 0)
@@ -1667,9 +1996,10 @@ QString Terminal::selectedText() const
 
         for (int i = lineFrom; i <= lineTo; i++) {
             if (i >= 0 && i < iBackBuffer.size()) {
+                const TerminalLine& l = iBackBuffer.at(i);
                 line.clear();
                 int start = 0;
-                int end = iBackBuffer[i].size() - 1;
+                int end = l.size() - 1;
                 if (i == lineFrom) {
                     start = selection().left() - 1;
                 }
@@ -1677,8 +2007,8 @@ QString Terminal::selectedText() const
                     end = selection().right() - 1;
                 }
                 for (int j = start; j <= end; j++) {
-                    if (j >= 0 && j < iBackBuffer[i].size() && iBackBuffer[i][j].c.isPrint())
-                        line += iBackBuffer[i][j].c;
+                    if (j >= 0 && j < l.size() && l.at(j).c.isPrint())
+                        line += l.at(j).c;
                 }
                 text += line.trimmed() + "\n";
             }
@@ -1690,9 +2020,10 @@ QString Terminal::selectedText() const
     int lineTo = selection().bottom() - 1 - iBackBufferScrollPos;
     for (int i = lineFrom; i <= lineTo; i++) {
         if (i >= 0 && i < buffer().size()) {
+            const TerminalLine& l = buffer().at(i);
             line.clear();
             int start = 0;
-            int end = buffer()[i].size() - 1;
+            int end = l.size() - 1;
             if (i == lineFrom) {
                 start = selection().left() - 1;
             }
@@ -1700,8 +2031,8 @@ QString Terminal::selectedText() const
                 end = selection().right() - 1;
             }
             for (int j = start; j <= end; j++) {
-                if (j >= 0 && j < buffer()[i].size() && buffer()[i][j].c.isPrint())
-                    line += buffer()[i][j].c;
+                if (j >= 0 && j < l.size() && l.at(j).c.isPrint())
+                    line += l.at(j).c;
             }
             text += line.trimmed() + "\n";
         }
@@ -1793,20 +2124,21 @@ QRect Terminal::selection() const
 
 #if defined(TEST_MODE)
 
-class TestTerminal : public Terminal
+static QString lineText(const TerminalLine& line)
 {
-public:
-    void insertInBuffer(const QString& characters)
-    {
-        Terminal::insertInBuffer(characters);
-    }
-};
+    QString text;
+    for (int i = 0; i < line.size(); i++)
+        text += line.at(i).c;
+    while (text.endsWith(' '))
+        text.chop(1);
+    return text;
+}
 
 static Util* s_testUtil = nullptr;
 
-static std::unique_ptr<TestTerminal> setupTestTerminal()
+std::unique_ptr<TestTerminal> setupTestTerminal()
 {
-    if (s_testUtil == nullptr) {
+    if (Util::instance() == nullptr) {
         s_testUtil = new Util("");
     }
     auto terminal = std::make_unique<TestTerminal>();
@@ -1834,6 +2166,7 @@ TEST_CASE("Terminal: windowTitleChanged")
     t->insertInBuffer("\x1b]2;world\x1b\\");
     REQUIRE(spy.count() == 1);
     REQUIRE(spy.at(0)[0] == "world");
+    REQUIRE(t->windowTitle() == "world");
 }
 
 TEST_CASE("Terminal: IL: No param doesn't crash")
@@ -1851,4 +2184,389 @@ TEST_CASE("Terminal: DCH: No param doesn't crash")
     requireSuccessfulParse("\x1b[P");
 }
 
+TEST_CASE("TerminalBuffer: removeFirst")
+{
+    TerminalBuffer buffer;
+    for (int i = 0; i < 10; i++) {
+        TerminalLine line;
+        TermChar c;
+        c.c = QChar('0' + i);
+        line.append(c);
+        buffer.append(line);
+    }
+
+    buffer.removeFirst(3);
+    REQUIRE(buffer.size() == 7);
+    REQUIRE(buffer.at(0).at(0).c == '3');
+    REQUIRE(buffer.at(6).at(0).c == '9');
+
+    // Enough to trigger compaction.
+    buffer.removeFirst(3);
+    REQUIRE(buffer.size() == 4);
+    REQUIRE(buffer.at(0).at(0).c == '6');
+
+    TerminalLine last = buffer.at(3);
+    buffer.insert(0, last);
+    REQUIRE(buffer.at(0).at(0).c == '9');
+    REQUIRE(buffer.takeAt(1).at(0).c == '6');
+    REQUIRE(buffer.size() == 4);
+
+    buffer.removeFirst(100);
+    REQUIRE(buffer.size() == 0);
+}
+
+TEST_CASE("Terminal: Scrolling keeps unmodified lines shared")
+{
+    // TextRender relies on this to move rows rather than rebuild them.
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(10, 3));
+    t->insertInBuffer("a\r\nb\r\nc");
+
+    TerminalLine second = t->buffer().at(1);
+    t->insertInBuffer("\r\nd");
+    REQUIRE(t->buffer().at(0).isSharedWith(second));
+
+    TerminalLine last = t->buffer().at(2);
+    t->insertInBuffer("e");
+    REQUIRE(!t->buffer().at(2).isSharedWith(last));
+}
+
+TEST_CASE("Terminal: Selecting text keeps lines shared")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(10, 3));
+    t->insertInBuffer("abc\r\ndef");
+
+    TerminalLine first = t->buffer().at(0);
+    TerminalLine second = t->buffer().at(1);
+    t->setSelection(QPoint(1, 1), QPoint(3, 2), false);
+    REQUIRE(t->selectedText() == "abc\ndef");
+    REQUIRE(t->buffer().at(0).isSharedWith(first));
+    REQUIRE(t->buffer().at(1).isSharedWith(second));
+}
+
+TEST_CASE("Terminal: Back buffer memory is accounted")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(10, 3));
+    t->insertInBuffer(QString("0123456789\r\n").repeated(100));
+    REQUIRE(t->backBuffer().size() > 0);
+    REQUIRE(t->backBufferMemoryUsage() == t->backBuffer().memoryUsage());
+    REQUIRE(Terminal::totalBackBufferMemoryUsage() == t->backBufferMemoryUsage());
+
+    // Reverse index at the top brings a line back from the back buffer.
+    t->insertInBuffer("\x1b[H\x1bM");
+    REQUIRE(t->backBufferMemoryUsage() == t->backBuffer().memoryUsage());
+
+    t->insertInBuffer("\x1b" "c");
+    REQUIRE(t->backBuffer().size() == 0);
+    REQUIRE(t->backBufferMemoryUsage() == 0);
+}
+
+TEST_CASE("Terminal: Memory budget drops the least recently viewed scrollback first")
+{
+    auto older = setupTestTerminal();
+    auto newer = setupTestTerminal();
+    older->setTermSize(QSize(10, 3));
+    newer->setTermSize(QSize(10, 3));
+    older->insertInBuffer(QString("0123456789\r\n").repeated(200));
+    newer->insertInBuffer(QString("0123456789\r\n").repeated(200));
+    newer->markViewed();
+
+    const int newerLines = newer->backBuffer().size();
+    const qint64 budget = newer->backBufferMemoryUsage() * 3 / 2;
+    Terminal::enforceMemoryBudget(budget);
+
+    REQUIRE(Terminal::totalBackBufferMemoryUsage() <= budget);
+    REQUIRE(newer->backBuffer().size() == newerLines);
+    REQUIRE(older->backBuffer().size() < newerLines);
+    REQUIRE(older->backBufferMemoryUsage() == older->backBuffer().memoryUsage());
+    REQUIRE(newer->backBufferMemoryUsage() == newer->backBuffer().memoryUsage());
+}
+
+TEST_CASE("Terminal: Control string payloads are discarded")
+{
+    // DCS, SOS, PM and APC, with control characters in the payload.
+    const char* const strings[] = {
+        "\x1bP1;2|payload\r\n\x1b\\",
+        "\x1bXsos\n\x1b\\",
+        "\x1b^pm\a\x1b\\",
+        "\x1b_apc\x1b\\",
+    };
+    for (const char* string : strings) {
+        auto t = setupTestTerminal();
+        QSignalSpy spy(t.get(), &Terminal::visualBell);
+        t->insertInBuffer(QString("a") + string + "b");
+        REQUIRE(lineText(t->buffer().at(0)) == "ab");
+        REQUIRE(t->cursorPos() == QPoint(3, 1));
+        REQUIRE(spy.count() == 0);
+    }
+}
+
+TEST_CASE("Terminal: CAN and SUB abort sequences")
+{
+    auto t = setupTestTerminal();
+    QSignalSpy spy(t.get(), &Terminal::windowTitleChanged);
+    t->insertInBuffer("\x1b]2;title\x18"
+                      "a\x1b[31\x1a"
+                      "b\x1bPpayload\x18"
+                      "c");
+    REQUIRE(spy.count() == 0);
+    REQUIRE(lineText(t->buffer().at(0)) == "abc");
+    REQUIRE(t->buffer().at(0).at(1).fgColor == Parser::fetchDefaultFgColor());
+}
+
+TEST_CASE("Terminal: A new sequence cuts short the one in progress")
+{
+    auto t = setupTestTerminal();
+    QSignalSpy spy(t.get(), &Terminal::windowTitleChanged);
+
+    // An unterminated OSC, followed by cursor addressing.
+    t->insertInBuffer("\x1b]2;never\x1b[3;5Hx");
+    REQUIRE(spy.count() == 0);
+    REQUIRE(t->buffer().at(2).at(4).c == 'x');
+
+    // An interrupted CSI doesn't leave its parameters behind.
+    t->insertInBuffer("\x1b[12\x1b[Hy");
+    REQUIRE(t->buffer().at(0).at(0).c == 'y');
+
+    // A stray ST doesn't act on an old OSC.
+    t->insertInBuffer("\x1b\\");
+    REQUIRE(spy.count() == 0);
+}
+
+TEST_CASE("Terminal: Unterminated sequences use bounded memory")
+{
+    const QString junk = QString("0123456789;").repeated(100000);
+    const QString prefixes[] = { "\x1b]2;", "\x1bP", "\x1b[" };
+    for (const QString& prefix : prefixes) {
+        auto t = setupTestTerminal();
+        QSignalSpy spy(t.get(), &Terminal::windowTitleChanged);
+        for (int i = 0; i < 10; i++) {
+            t->insertInBuffer(i == 0 ? prefix + junk : junk);
+            REQUIRE(t->pendingSequenceCapacity() <= 64 * 1024);
+        }
+
+        // The overlong sequence is dropped, and parsing carries on after it.
+        t->insertInBuffer(prefix == "\x1b[" ? "Hx" : "\x1b\\x");
+        REQUIRE(spy.count() == 0);
+        REQUIRE(lineText(t->buffer().at(0)) == "x");
+        REQUIRE(t->pendingSequenceCapacity() == 0);
+    }
+}
+
+// Inputs that used to take quadratic time, or memory, to get through.
+struct PathologicalStream
+{
+    const char* name;
+    QString (*generate)(int);
+    int escape; // what the parser is in the middle of at the end
+    bool overflows; // and whether it has given up on storing it
+};
+
+static const PathologicalStream pathologicalStreams[] = {
+    { "unterminated OSC", [](int n) { return "\x1b]2;" + QString(n, 'x'); }, ']', true },
+    { "DCS payload", [](int n) { return "\x1bP" + QString("data\r\n").repeated(n / 6); }, 'P', false },
+    { "long CSI", [](int n) { return "\x1b[" + QString("1;").repeated(n / 2); }, '[', true },
+    { "lone ESCs", [](int n) { return QString(n, QChar('\x1b')); }, 0, false },
+    { "interrupted OSCs", [](int n) { return QString("\x1b]2;abc").repeated(n / 7); }, ']', false },
+    { "short sequences", [](int n) { return QString("\x1b[1;31mx\x1b[0m").repeated(n / 14); }, -1, false },
+};
+
+TEST_CASE("Terminal: Pathological input is parsed in linear time")
+{
+    // Each character is looked at once, and what is kept of a sequence in
+    // progress is bounded, so nothing is scanned or copied more than a bounded
+    // number of times, however long the input goes on.
+    for (const PathologicalStream& stream : pathologicalStreams) {
+        INFO(stream.name);
+        const QString input = stream.generate(1024 * 1024);
+        auto t = setupTestTerminal();
+
+        // Chunked the way PtyIFace reads it.
+        for (int i = 0; i < input.size(); i += 4096) {
+            t->insertInBuffer(input.mid(i, 4096));
+            REQUIRE(t->pendingSequenceCapacity() <= 64 * 1024);
+        }
+
+        REQUIRE(t->pendingEscape() == stream.escape);
+        REQUIRE(t->pendingSequenceOverflowed() == stream.overflows);
+        // A discarded string's payload isn't kept at all.
+        if (stream.escape == 'P')
+            REQUIRE(t->pendingSequenceCapacity() == 0);
+    }
+}
+
+#    if defined(CATCH_CONFIG_ENABLE_BENCHMARKING)
+
+// Run with: ./apptest "[!benchmark]"
+// Inputs are fixed, so that results can be compared between builds.
+
+TEST_CASE("Terminal: Pathological input timing", "[!benchmark]")
+{
+    // Best of a few runs, to keep noise out.
+    auto timeToParse = [](const QString& stream) {
+        qint64 best = 0;
+        for (int run = 0; run < 3; run++) {
+            auto t = setupTestTerminal();
+            QElapsedTimer timer;
+            timer.start();
+            t->insertInBuffer(stream);
+            qint64 elapsed = timer.nsecsElapsed();
+            if (run == 0 || elapsed < best)
+                best = elapsed;
+        }
+        return qMax(best, qint64(1));
+    };
+
+    const int size = 256 * 1024;
+    for (const PathologicalStream& stream : pathologicalStreams) {
+        qint64 small = timeToParse(stream.generate(size));
+        qint64 large = timeToParse(stream.generate(size * 4));
+        INFO(stream.name << ": " << small << "ns for " << size << " chars, " << large << "ns for " << size * 4);
+        // Four times the input should take about four times as long.
+        REQUIRE(large < small * 12 + 10 * 1000 * 1000);
+    }
+}
+
+TEST_CASE("Terminal: Allocations during ingest", "[!benchmark]")
+{
+    // Qt's containers allocate with malloc(), which is only counted on glibc.
+    if (!AllocationCounter::countsMalloc())
+        return;
+
+    // Reported in allocations per MB of input. There are no budgets yet: they
+    // are to be set from runs on the supported Qt versions.
+    struct Stream
+    {
+        const char* name;
+        QString (*generate)();
+    };
+    const Stream streams[] = {
+        { "plain", []() {
+             QString out;
+             for (int y = 0; out.size() < 1024 * 1024; y++) {
+                 for (int x = 0; x < 79; x++)
+                     out += QChar('!' + (x * 7 + y) % 94);
+                 out += "\r\n";
+             }
+             return out;
+         } },
+        { "sgr", []() {
+             QString out;
+             for (int c = 0; out.size() < 1024 * 1024; c++) {
+                 out += "\x1b[48;2;" + QString::number(c % 256) + ";" + QString::number(255 - c % 256) + ";0m ";
+                 if (c % 80 == 79)
+                     out += "\x1b[0m\r\n";
+             }
+             return out;
+         } },
+        { "cursor addressing", []() {
+             QString out;
+             for (int frame = 0; out.size() < 1024 * 1024; frame++) {
+                 for (int row = 1; row <= 24; row++)
+                     out += "\x1b[" + QString::number(row) + ";1H\x1b[3" + QString::number(row % 8) + "mrow " + QString::number(frame * row) + "\x1b[0m\x1b[K";
+             }
+             return out;
+         } },
+        { "unicode", []() {
+             const QString line = QString::fromUtf8("åäö ÅÄÖ ñ ü ß — “quotes” 日本語のテキスト 한국어 😀 👍 🎉\r\n");
+             QString out;
+             while (out.size() < 1024 * 1024)
+                 out += line;
+             return out;
+         } },
+    };
+
+    for (const Stream& stream : streams) {
+        const QString input = stream.generate();
+        auto t = setupTestTerminal();
+        t->setTermSize(QSize(80, 24));
+
+        // Chunked the way PtyIFace reads it.
+        QStringList chunks;
+        for (int i = 0; i < input.size(); i += 4096)
+            chunks.append(input.mid(i, 4096));
+
+        AllocationCounter counter;
+        for (const QString& chunk : qAsConst(chunks))
+            t->insertInBuffer(chunk);
+        qint64 perMB = counter.allocations() * 1024 * 1024 / input.size();
+
+        WARN(stream.name << ": " << perMB << " allocations per MB");
+    }
+}
+
+TEST_CASE("Terminal: ansiSequence benchmark", "[!benchmark]")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(80, 24));
+
+    BENCHMARK("CUP home") { t->ansiSequence("[H"); };
+    BENCHMARK("CUP row;column") { t->ansiSequence("[10;20H"); };
+    BENCHMARK("CUU") { t->ansiSequence("[5A"); };
+    BENCHMARK("EL") { t->ansiSequence("[K"); };
+    BENCHMARK("ED") { t->ansiSequence("[2J"); };
+    BENCHMARK("SGR") { t->ansiSequence("[0;1;31m"); };
+    BENCHMARK("SGR 24 bit") { t->ansiSequence("[38;2;10;20;30m"); };
+    BENCHMARK("DECTCEM") { t->ansiSequence("[?25l"); };
+}
+
+TEST_CASE("Terminal: insertAtCursor benchmark", "[!benchmark]")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(80, 24));
+
+    BENCHMARK("80 columns")
+    {
+        t->setCursorPos(QPoint(1, 1));
+        for (int i = 0; i < 80; i++)
+            t->insertAtCursor(QChar('a' + i % 26));
+    };
+}
+
+TEST_CASE("Terminal: scrollFwd benchmark", "[!benchmark]")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(80, 24));
+
+    // Fill the back buffer up to its limit, so that every scroll also trims.
+    const int limit = Util::instance()->terminalScrollbackSize();
+    t->insertInBuffer(QString(QString(80, 'x') + "\r\n").repeated(limit + 24));
+    REQUIRE(t->backBuffer().size() == limit);
+
+    BENCHMARK("one line, full scrollback") { t->scrollFwd(1); };
+}
+
+TEST_CASE("Terminal: selectedText benchmark", "[!benchmark]")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(200, 100));
+    QString line;
+    for (int i = 0; i < 200; i++)
+        line += QChar('a' + i % 26);
+    t->insertInBuffer(QString(line + "\r\n").repeated(99) + line);
+    t->setSelection(QPoint(1, 1), QPoint(200, 100), false);
+
+    BENCHMARK("200x100") { return t->selectedText(); };
+}
+
+TEST_CASE("Terminal: grabURLsFromBuffer benchmark", "[!benchmark]")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(80, 24));
+    QString lines;
+    for (int i = 0; i < Util::instance()->terminalScrollbackSize() + 24; i++) {
+        if (i % 10 == 0)
+            lines += "see https://example.com/page/" + QString::number(i) + " for details\r\n";
+        else
+            lines += "plain output line " + QString::number(i) + " with no links in it\r\n";
+    }
+    t->insertInBuffer(lines);
+
+    BENCHMARK("full scrollback") { return t->grabURLsFromBuffer(); };
+}
+
+#    endif // CATCH_CONFIG_ENABLE_BENCHMARKING
+
 #endif
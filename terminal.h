@@ -25,6 +25,8 @@
 
 #include "ptyiface.h"
 
+class TerminalSearch;
+
 struct TermChar
 {
     // TODO: Replace with the version in Parser.
@@ -77,6 +79,19 @@ public:
     const TermChar& operator[](int pos) const { return m_contents[pos]; }
     const TermChar& at(int pos) const { return m_contents.at(pos); }
 
+    // True if both lines share the same (implicitly shared) data, which means
+    // neither has been modified since one was copied from the other.
+    bool isSharedWith(const TerminalLine& other) const { return m_contents.constData() == other.m_contents.constData(); }
+
+    // Approximate number of bytes used by the line, including its storage.
+    int memoryUsage() const
+    {
+        if (!m_contents.capacity())
+            return sizeof(TerminalLine);
+        return sizeof(TerminalLine) + sizeof(QArrayData) + m_contents.capacity() * sizeof(TermChar);
+    }
+    void squeeze() { m_contents.squeeze(); }
+
 private:
     QVector<TermChar> m_contents;
 };
@@ -84,18 +99,34 @@ private:
 class TerminalBuffer
 {
 public:
-    int size() const { return m_buffer.size(); }
+    TerminalBuffer()
+        : m_head(0)
+    {
+    }
+
+    int size() const { return m_buffer.size() - m_head; }
     void append(const TerminalLine& l) { m_buffer.append(l); }
-    void insert(int pos, const TerminalLine& l) { m_buffer.insert(pos, l); }
-    void removeAt(int pos) { m_buffer.removeAt(pos); }
-    TerminalLine takeAt(int pos) { return m_buffer.takeAt(pos); }
-    void clear() { m_buffer.clear(); }
-    TerminalLine& operator[](int pos) { return m_buffer[pos]; }
-    const TerminalLine& operator[](int pos) const { return m_buffer[pos]; }
-    const TerminalLine& at(int pos) const { return m_buffer.at(pos); }
+    void insert(int pos, const TerminalLine& l) { m_buffer.insert(m_head + pos, l); }
+    void removeAt(int pos) { m_buffer.removeAt(m_head + pos); }
+    void removeFirst(int count);
+    TerminalLine takeAt(int pos) { return m_buffer.takeAt(m_head + pos); }
+    void clear()
+    {
+        m_buffer.clear();
+        m_head = 0;
+    }
+    TerminalLine& operator[](int pos) { return m_buffer[m_head + pos]; }
+    const TerminalLine& operator[](int pos) const { return m_buffer[m_head + pos]; }
+    const TerminalLine& at(int pos) const { return m_buffer.at(m_head + pos); }
+
+    qint64 memoryUsage() const;
 
 private:
     QVector<TerminalLine> m_buffer;
+
+    // Lines before m_head have been removed by removeFirst(), but the storage
+    // has not been compacted yet.
+    int m_head;
 };
 
 class Terminal : public QObject
@@ -104,7 +135,7 @@ class Terminal : public QObject
 
 public:
     explicit Terminal(QObject* parent = 0);
-    virtual ~Terminal() { }
+    virtual ~Terminal();
 
     void init();
 
@@ -119,6 +150,9 @@ public:
     const TerminalBuffer& buffer() const;
     TerminalBuffer& backBuffer() { return iBackBuffer; }
     const TerminalBuffer& backBuffer() const { return iBackBuffer; }
+    // Lines that have left the front of the back buffer, so that line i of
+    // the back buffer is line droppedLines() + i of the session's output.
+    qint64 droppedLines() const { return m_droppedLines; }
 
     TerminalLine& currentLine();
 
@@ -129,6 +163,7 @@ public:
     void putString(QString str);
     void paste(const QString& text);
     const QStringList grabURLsFromBuffer();
+    TerminalSearch* search();
 
     void scrollBackBufferFwd(int lines);
     void scrollBackBufferBack(int lines);
@@ -145,6 +180,20 @@ public:
 
     bool useAltScreenBuffer() const { return iUseAltScreenBuffer; }
 
+    qint64 screenMemoryUsage() const { return iBuffer.memoryUsage(); }
+    qint64 altScreenMemoryUsage() const { return iAltBuffer.memoryUsage(); }
+    qint64 backBufferMemoryUsage() const { return m_backBufferMemoryUsage; }
+    void markViewed();
+
+    QString windowTitle() const { return m_windowTitle; }
+    bool isRunning() const;
+
+    bool isThrottled() const { return m_throttled; }
+    void setThrottled(bool throttled);
+
+    static qint64 totalBackBufferMemoryUsage();
+    static void enforceMemoryBudget(qint64 budget);
+
     TermChar zeroChar;
 
 signals:
@@ -183,7 +232,14 @@ private:
     bool handleECH(const QList<int>& params, const QString& extra);
     void oscSequence(const QString& seq);
     void escControlChar(const QString& seq);
+    void resetEscape();
     void trimBackBuffer();
+    void appendToBackBuffer(const TerminalLine& line);
+    TerminalLine takeLastFromBackBuffer();
+    void removeFromBackBuffer(int count);
+    void clearBackBuffer();
+    void squeezeBackBuffer();
+    void adjustBackBufferMemoryUsage(qint64 delta);
     void scrollBack(int lines, int insertAt = -1);
     void scrollFwd(int lines, int removeAt = -1);
 
@@ -229,11 +285,25 @@ private:
     QString escSeq;
     QString oscSeq;
     int escape;
+    int stringEscape;
+    bool escapeOverflow;
     QRect iSelection;
     QVector<QRgb> iColorTable;
     int m_dispatch_timer;
 
+    // Kept up to date as lines enter and leave the back buffer, which (unlike
+    // the screen buffers) has its lines only added and removed, never modified.
+    qint64 m_backBufferMemoryUsage;
+    // Lines at the front of the back buffer that have been squeezed already.
+    int m_squeezedLines;
+    qint64 m_droppedLines;
+    TerminalSearch* m_search;
+    quint64 m_lastViewed;
+    bool m_throttled;
+    QString m_windowTitle;
+
     friend class TextRender;
+    friend class TestTerminal;
 };
 
 #endif // TERMINAL_H
@@ -0,0 +1,618 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QRunnable>
+
+#if defined(TEST_MODE)
+#    include <QElapsedTimer>
+#    include <QThread>
+
+#    include "testterminal.h"
+#    include "utilities.h"
+#endif
+
+#include "catch.hpp"
+#include "terminal.h"
+#include "terminalsearch.h"
+
+/*!
+ * \class TerminalSearch
+ * \internal
+ *
+ * TerminalSearch finds a string or a regular expression in the back buffer
+ * and screen of a Terminal, and goes on finding it in new output for as long
+ * as it is active. Matches don't span lines.
+ *
+ * The screen is small, and changes all the time, so it is searched again on
+ * the GUI thread whenever it has changed. The back buffer can be a million
+ * lines, but its lines are only ever added at the end and dropped from the
+ * front, never modified. It is searched on a worker thread, a chunk of lines
+ * at a time: the GUI thread copies the lines of the next chunk (which only
+ * shares their data), and the worker hands back the matches in them. The
+ * newest lines go first, so what was just on screen is found right away.
+ *
+ * Literal strings are found with QStringMatcher, which skips ahead through
+ * the line rather than comparing at every position.
+ */
+
+static const int ChunkLines = 4096;
+static const int UpdateInterval = 16; // ms, at most about once a frame
+
+class TerminalSearchJob : public QRunnable
+{
+public:
+    TerminalSearchJob(TerminalSearch* search, int generation, const TerminalSearch::Pattern& pattern, bool older, qint64 from, const QVector<TerminalLine>& lines)
+        : m_search(search)
+        , m_generation(generation)
+        , m_pattern(pattern)
+        , m_older(older)
+        , m_from(from)
+        , m_lines(lines)
+    {
+    }
+
+    void run() override
+    {
+        QVector<TerminalSearch::Match> matches;
+        QString text;
+        for (int i = 0; i < m_lines.size(); i++) {
+            // Searching for something else already.
+            if (m_search->m_generation.load(std::memory_order_relaxed) != m_generation)
+                return;
+            TerminalSearch::findMatches(m_pattern, m_lines.at(i), m_from + i, &text, &matches);
+        }
+
+        TerminalSearch* search = m_search;
+        int generation = m_generation;
+        bool older = m_older;
+        qint64 from = m_from;
+        qint64 to = m_from + m_lines.size();
+        QMetaObject::invokeMethod(search, [search, generation, older, from, to, matches]() {
+            search->chunkScanned(generation, older, from, to, matches);
+        }, Qt::QueuedConnection);
+    }
+
+private:
+    TerminalSearch* m_search;
+    int m_generation;
+    TerminalSearch::Pattern m_pattern;
+    bool m_older;
+    qint64 m_from;
+    QVector<TerminalLine> m_lines;
+};
+
+TerminalSearch::TerminalSearch(Terminal* terminal)
+    : QObject(terminal)
+    , m_terminal(terminal)
+    , m_active(false)
+    , m_busy(false)
+    , m_hasCurrent(false)
+    , m_current()
+    , m_newerHead(0)
+    , m_scannedFrom(0)
+    , m_scannedTo(0)
+    , m_generation(0)
+    , m_jobRunning(false)
+{
+    m_pattern.regular = false;
+
+    // One chunk at a time, so that they come back in order.
+    m_pool.setMaxThreadCount(1);
+
+    m_updateTimer.setSingleShot(true);
+    m_updateTimer.setInterval(UpdateInterval);
+    connect(&m_updateTimer, SIGNAL(timeout()), this, SLOT(update()));
+    connect(terminal, SIGNAL(displayBufferChanged()), this, SLOT(scheduleUpdate()));
+    connect(terminal, SIGNAL(termSizeChanged(int, int)), this, SLOT(scheduleUpdate()));
+}
+
+TerminalSearch::~TerminalSearch()
+{
+    m_generation++;
+    m_pool.waitForDone();
+}
+
+/*!
+ * Search for \a pattern, instead of whatever was searched for before. An
+ * empty pattern stops searching.
+ */
+void TerminalSearch::start(const QString& pattern, Options options)
+{
+    stop();
+    if (pattern.isEmpty())
+        return;
+
+    m_pattern.regular = options & RegularExpression;
+    if (m_pattern.regular) {
+        QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
+        if (!(options & CaseSensitive))
+            patternOptions |= QRegularExpression::CaseInsensitiveOption;
+        m_pattern.expression = QRegularExpression(pattern, patternOptions);
+        m_pattern.expression.optimize();
+        m_pattern.literal = QStringMatcher();
+    } else {
+        m_pattern.literal = QStringMatcher(pattern, options & CaseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+        m_pattern.expression = QRegularExpression();
+    }
+
+    m_active = true;
+    m_scannedFrom = m_scannedTo = m_terminal->droppedLines() + m_terminal->backBuffer().size();
+    update();
+}
+
+void TerminalSearch::stop()
+{
+    m_generation++;
+    m_jobRunning = false;
+    m_updateTimer.stop();
+    m_olderMatches.clear();
+    m_newerMatches.clear();
+    m_newerHead = 0;
+    m_screenMatches.clear();
+    setBusy(false);
+
+    if (m_active) {
+        m_active = false;
+        emit matchesChanged();
+    }
+    if (m_hasCurrent) {
+        m_hasCurrent = false;
+        emit currentChanged();
+    }
+}
+
+/*!
+ * False while searching for a regular expression with an error in it, which
+ * matches nothing.
+ */
+bool TerminalSearch::isValid() const
+{
+    return !m_active || !m_pattern.regular || m_pattern.expression.isValid();
+}
+
+int TerminalSearch::matchCount() const
+{
+    return backMatchCount() + m_screenMatches.size();
+}
+
+/*!
+ * The index of the current match, or -1 if there is none, or it has left the
+ * back buffer.
+ */
+int TerminalSearch::currentIndex() const
+{
+    if (!m_hasCurrent)
+        return -1;
+
+    int index = lowerBound(m_current.line, m_current.column);
+    if (index < matchCount() && matchAt(index).line == m_current.line && matchAt(index).column == m_current.column)
+        return index;
+    return -1;
+}
+
+bool TerminalSearch::currentMatch(Match* match) const
+{
+    if (!m_hasCurrent)
+        return false;
+    *match = m_current;
+    return true;
+}
+
+/*!
+ * Go to the match after the current one, further down, wrapping around to
+ * the first.
+ */
+void TerminalSearch::next()
+{
+    int count = matchCount();
+    if (count == 0)
+        return;
+
+    int index = count - 1;
+    if (m_hasCurrent) {
+        index = lowerBound(m_current.line, m_current.column);
+        if (index < count && matchAt(index).line == m_current.line && matchAt(index).column == m_current.column)
+            index++;
+        if (index == count)
+            index = 0;
+    }
+    setCurrent(index);
+}
+
+/*!
+ * Go to the match before the current one, further up, wrapping around to the
+ * last.
+ */
+void TerminalSearch::previous()
+{
+    int count = matchCount();
+    if (count == 0)
+        return;
+
+    int index = count - 1;
+    if (m_hasCurrent) {
+        index = lowerBound(m_current.line, m_current.column) - 1;
+        if (index < 0)
+            index = count - 1;
+    }
+    setCurrent(index);
+}
+
+/*!
+ * The matches on \a lineCount lines from \a firstLine, to highlight.
+ */
+QVector<TerminalSearch::Match> TerminalSearch::matchesOn(qint64 firstLine, int lineCount) const
+{
+    QVector<Match> matches;
+    int count = matchCount();
+    for (int i = lowerBound(firstLine, 0); i < count && matchAt(i).line < firstLine + lineCount; i++)
+        matches.append(matchAt(i));
+    return matches;
+}
+
+/*! \internal
+ *
+ * Find the matches of \a pattern in \a line, using \a text for its
+ * characters.
+ */
+void TerminalSearch::findMatches(const Pattern& pattern, const TerminalLine& line, qint64 lineNumber, QString* text, QVector<Match>* matches)
+{
+    // The characters are spread out among their attributes; gather them.
+    text->resize(line.size());
+    QChar* out = text->data();
+    for (int i = 0; i < line.size(); i++) {
+        QChar c = line.at(i).c;
+        out[i] = c.isNull() ? QChar(' ') : c;
+    }
+
+    if (pattern.regular) {
+        QRegularExpressionMatchIterator it = pattern.expression.globalMatch(*text);
+        while (it.hasNext()) {
+            QRegularExpressionMatch match = it.next();
+            if (match.capturedLength() > 0)
+                matches->append({ lineNumber, match.capturedStart(), match.capturedLength() });
+        }
+    } else {
+        int length = pattern.literal.pattern().size();
+        for (int at = pattern.literal.indexIn(*text); at != -1; at = pattern.literal.indexIn(*text, at + length))
+            matches->append({ lineNumber, at, length });
+    }
+}
+
+/*! \internal
+ *
+ * The back buffer isn't shown along with the alternate screen, so it isn't
+ * searched either (as in Terminal::grabURLsFromBuffer()).
+ */
+int TerminalSearch::backMatchCount() const
+{
+    if (m_terminal->useAltScreenBuffer())
+        return 0;
+    return m_olderMatches.size() + m_newerMatches.size() - m_newerHead;
+}
+
+/*! \internal
+ *
+ * Matches are in order from the front of the back buffer to the bottom of the
+ * screen.
+ */
+const TerminalSearch::Match& TerminalSearch::matchAt(int index) const
+{
+    int back = backMatchCount();
+    if (index >= back)
+        return m_screenMatches.at(index - back);
+    if (index < m_olderMatches.size())
+        return m_olderMatches.at(m_olderMatches.size() - 1 - index);
+    return m_newerMatches.at(m_newerHead + index - m_olderMatches.size());
+}
+
+/*! \internal
+ *
+ * The index of the first match at or after \a column on \a line.
+ */
+int TerminalSearch::lowerBound(qint64 line, int column) const
+{
+    int low = 0;
+    int high = matchCount();
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        const Match& match = matchAt(middle);
+        if (match.line < line || (match.line == line && match.column < column))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void TerminalSearch::scheduleUpdate()
+{
+    // Not restarted, so that a steady stream of output doesn't hold it off.
+    if (m_active && !m_updateTimer.isActive())
+        m_updateTimer.start();
+}
+
+void TerminalSearch::update()
+{
+    if (!m_active || !isValid())
+        return;
+
+    qint64 origin = m_terminal->droppedLines();
+    qint64 end = origin + m_terminal->backBuffer().size();
+    dropBackMatches(origin, end);
+    m_scannedFrom = qBound(origin, m_scannedFrom, end);
+    m_scannedTo = qBound(origin, m_scannedTo, end);
+
+    scanScreen();
+    if (!m_jobRunning)
+        scanNextChunk();
+
+    pickCurrent();
+    emit matchesChanged();
+}
+
+/*! \internal
+ *
+ * Forget the matches on lines no longer in the back buffer, which only has
+ * lines from \a origin to \a end.
+ */
+void TerminalSearch::dropBackMatches(qint64 origin, qint64 end)
+{
+    // Dropped from the front, as it grew past its limit or was cleared.
+    while (!m_olderMatches.isEmpty() && m_olderMatches.last().line < origin)
+        m_olderMatches.removeLast();
+    if (m_olderMatches.isEmpty()) {
+        while (m_newerHead < m_newerMatches.size() && m_newerMatches.at(m_newerHead).line < origin)
+            m_newerHead++;
+        if (m_newerHead > m_newerMatches.size() / 2) {
+            m_newerMatches.remove(0, m_newerHead);
+            m_newerHead = 0;
+        }
+    }
+
+    // Taken from the end, back onto the screen.
+    while (m_newerMatches.size() > m_newerHead && m_newerMatches.last().line >= end)
+        m_newerMatches.removeLast();
+    if (m_newerMatches.size() == m_newerHead) {
+        while (!m_olderMatches.isEmpty() && m_olderMatches.first().line >= end)
+            m_olderMatches.removeFirst();
+    }
+}
+
+void TerminalSearch::scanScreen()
+{
+    qint64 first = m_terminal->droppedLines() + m_terminal->backBuffer().size();
+    const TerminalBuffer& screen = m_terminal->buffer();
+
+    m_screenMatches.clear();
+    QString text;
+    for (int i = 0; i < screen.size(); i++)
+        findMatches(m_pattern, screen.at(i), first + i, &text, &m_screenMatches);
+}
+
+/*! \internal
+ *
+ * Hand the next chunk of the back buffer to the worker: new lines first, then
+ * older ones.
+ */
+void TerminalSearch::scanNextChunk()
+{
+    const TerminalBuffer& backBuffer = m_terminal->backBuffer();
+    qint64 origin = m_terminal->droppedLines();
+    qint64 end = origin + backBuffer.size();
+
+    bool older;
+    qint64 from;
+    qint64 to;
+    if (m_scannedTo < end) {
+        older = false;
+        from = m_scannedTo;
+        to = qMin(end, from + ChunkLines);
+    } else if (m_scannedFrom > origin) {
+        older = true;
+        to = m_scannedFrom;
+        from = qMax(origin, to - ChunkLines);
+    } else {
+        setBusy(false);
+        return;
+    }
+
+    QVector<TerminalLine> lines;
+    lines.reserve(int(to - from));
+    for (qint64 line = from; line < to; line++)
+        lines.append(backBuffer.at(int(line - origin)));
+
+    m_pool.start(new TerminalSearchJob(this, m_generation, m_pattern, older, from, lines));
+    m_jobRunning = true;
+    setBusy(true);
+}
+
+void TerminalSearch::chunkScanned(int generation, bool older, qint64 from, qint64 to, const QVector<Match>& matches)
+{
+    if (generation != m_generation)
+        return;
+    m_jobRunning = false;
+
+    // Some of the chunk may have left the back buffer in the meantime.
+    qint64 origin = m_terminal->droppedLines();
+    qint64 end = origin + m_terminal->backBuffer().size();
+    dropBackMatches(origin, end);
+
+    if (older) {
+        for (int i = matches.size() - 1; i >= 0; i--) {
+            const Match& match = matches.at(i);
+            if (match.line >= origin && match.line < end)
+                m_olderMatches.append(match);
+        }
+        m_scannedFrom = qBound(origin, qMin(m_scannedFrom, from), end);
+    } else {
+        for (const Match& match : matches) {
+            if (match.line >= origin && match.line < end)
+                m_newerMatches.append(match);
+        }
+        m_scannedTo = qBound(origin, qMax(m_scannedTo, to), end);
+    }
+
+    scanNextChunk();
+    if (!matches.isEmpty()) {
+        pickCurrent();
+        emit matchesChanged();
+    }
+}
+
+void TerminalSearch::setCurrent(int index)
+{
+    m_current = matchAt(index);
+    m_hasCurrent = true;
+    emit currentChanged();
+}
+
+/*! \internal
+ *
+ * Start at the last match, the one closest to the bottom, once there is one.
+ */
+void TerminalSearch::pickCurrent()
+{
+    if (!m_hasCurrent && matchCount() > 0)
+        setCurrent(matchCount() - 1);
+}
+
+void TerminalSearch::setBusy(bool busy)
+{
+    if (m_busy == busy)
+        return;
+    m_busy = busy;
+    emit busyChanged();
+}
+
+#if defined(TEST_MODE)
+
+// Let the scheduled update run, and the chunks it hands out come back.
+static bool waitForSearch(TerminalSearch* search)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < 10000) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        if (!search->isBusy() && timer.elapsed() > 100)
+            return true;
+        QThread::msleep(1);
+    }
+    return false;
+}
+
+static QString numberedLines(int count, int every)
+{
+    QString lines;
+    for (int i = 0; i < count; i++) {
+        lines += "line " + QString::number(i);
+        if (i % every == 0)
+            lines += " Needle";
+        lines += "\r\n";
+    }
+    return lines;
+}
+
+TEST_CASE("TerminalSearch: Literal and regular expression matches")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(40, 5));
+    t->insertInBuffer(numberedLines(50, 10));
+    TerminalSearch* search = t->search();
+
+    search->start("needle");
+    REQUIRE(waitForSearch(search));
+    REQUIRE(search->isActive());
+    REQUIRE(search->matchCount() == 5);
+
+    // The last one to begin with, going down wraps around to the first.
+    REQUIRE(search->currentIndex() == 4);
+    TerminalSearch::Match match;
+    REQUIRE(search->currentMatch(&match));
+    REQUIRE(match.column == 8);
+    REQUIRE(match.length == 6);
+    search->next();
+    REQUIRE(search->currentIndex() == 0);
+    search->previous();
+    REQUIRE(search->currentIndex() == 4);
+    search->previous();
+    REQUIRE(search->currentIndex() == 3);
+
+    // Lines 0, 10, ... in the order they were output.
+    QVector<TerminalSearch::Match> matches = search->matchesOn(t->droppedLines(), 100);
+    REQUIRE(matches.size() == 5);
+    for (int i = 1; i < matches.size(); i++)
+        REQUIRE(matches.at(i).line == matches.at(i - 1).line + 10);
+
+    search->start("needle", TerminalSearch::CaseSensitive);
+    REQUIRE(waitForSearch(search));
+    REQUIRE(search->matchCount() == 0);
+    REQUIRE(search->currentIndex() == -1);
+
+    search->start("line \\d*5\\b", TerminalSearch::RegularExpression);
+    REQUIRE(waitForSearch(search));
+    REQUIRE(search->isValid());
+    REQUIRE(search->matchCount() == 5);
+
+    search->start("line (", TerminalSearch::RegularExpression);
+    REQUIRE(waitForSearch(search));
+    REQUIRE(!search->isValid());
+    REQUIRE(search->matchCount() == 0);
+
+    search->stop();
+    REQUIRE(!search->isActive());
+    REQUIRE(search->matchCount() == 0);
+}
+
+TEST_CASE("TerminalSearch: Follows the scrollback")
+{
+    auto t = setupTestTerminal();
+    t->setTermSize(QSize(40, 5));
+    Util* util = Util::instance();
+    int limit = util->terminalScrollbackSize();
+    util->setSettingsValue("terminal/scrollbackLineLimit", 20000);
+
+    // More than a chunk, found newest first and kept in order.
+    t->insertInBuffer(numberedLines(10000, 100));
+    TerminalSearch* search = t->search();
+    search->start("needle");
+    REQUIRE(waitForSearch(search));
+    REQUIRE(search->matchCount() == 100);
+    QVector<TerminalSearch::Match> matches = search->matchesOn(t->droppedLines(), 20000);
+    REQUIRE(matches.size() == 100);
+    for (int i = 1; i < matches.size(); i++)
+        REQUIRE(matches.at(i).line == matches.at(i - 1).line + 100);
+
+    // New output is searched as it arrives.
+    t->insertInBuffer("another needle\r\n");
+    REQUIRE(waitForSearch(search));
+    REQUIRE(search->matchCount() == 101);
+
+    // Lines leaving the back buffer take their matches along.
+    util->setSettingsValue("terminal/scrollbackLineLimit", 1000);
+    t->insertInBuffer("\r\n");
+    REQUIRE(waitForSearch(search));
+    REQUIRE(search->matchCount() > 0);
+    REQUIRE(search->matchCount() < 101);
+    matches = search->matchesOn(0, 20000);
+    REQUIRE(matches.size() == search->matchCount());
+    REQUIRE(matches.first().line >= t->droppedLines());
+
+    util->setSettingsValue("terminal/scrollbackLineLimit", limit);
+}
+
+#endif // TEST_MODE
@@ -0,0 +1,130 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TERMINALSEARCH_H
+#define TERMINALSEARCH_H
+
+#include <QObject>
+#include <QRegularExpression>
+#include <QStringMatcher>
+#include <QThreadPool>
+#include <QTimer>
+#include <QVector>
+#include <atomic>
+
+class Terminal;
+class TerminalLine;
+
+class TerminalSearch : public QObject
+{
+    Q_OBJECT
+public:
+    enum Option
+    {
+        NoOptions = 0x0,
+        RegularExpression = 0x1,
+        CaseSensitive = 0x2
+    };
+    Q_DECLARE_FLAGS(Options, Option)
+
+    // Lines are numbered as by Terminal::droppedLines(), with the screen
+    // following the back buffer, so that a line keeps its number as it
+    // scrolls.
+    struct Match
+    {
+        qint64 line;
+        int column;
+        int length;
+    };
+
+    explicit TerminalSearch(Terminal* terminal);
+    ~TerminalSearch();
+
+    void start(const QString& pattern, Options options = NoOptions);
+    void stop();
+    bool isActive() const { return m_active; }
+    bool isValid() const;
+    bool isBusy() const { return m_busy; }
+
+    int matchCount() const;
+    int currentIndex() const;
+    bool currentMatch(Match* match) const;
+    void next();
+    void previous();
+
+    QVector<Match> matchesOn(qint64 firstLine, int lineCount) const;
+
+signals:
+    void matchesChanged();
+    void currentChanged();
+    void busyChanged();
+
+private slots:
+    void scheduleUpdate();
+    void update();
+
+private:
+    Q_DISABLE_COPY(TerminalSearch)
+    friend class TerminalSearchJob;
+
+    struct Pattern
+    {
+        bool regular;
+        QStringMatcher literal;
+        QRegularExpression expression;
+    };
+
+    static void findMatches(const Pattern& pattern, const TerminalLine& line, qint64 lineNumber, QString* text, QVector<Match>* matches);
+
+    int backMatchCount() const;
+    const Match& matchAt(int index) const;
+    int lowerBound(qint64 line, int column) const;
+    void scanNextChunk();
+    void chunkScanned(int generation, bool older, qint64 from, qint64 to, const QVector<Match>& matches);
+    void scanScreen();
+    void dropBackMatches(qint64 origin, qint64 end);
+    void setCurrent(int index);
+    void pickCurrent();
+    void setBusy(bool busy);
+
+    Terminal* m_terminal;
+    Pattern m_pattern;
+    bool m_active;
+    bool m_busy;
+    bool m_hasCurrent;
+    Match m_current;
+
+    // The back buffer is scanned from where it ended when the search started
+    // towards its front, while new lines entering it are scanned as they
+    // come. Matches from before the start are kept newest first, so both
+    // grow at the end.
+    QVector<Match> m_olderMatches;
+    QVector<Match> m_newerMatches;
+    int m_newerHead; // matches before it have left the back buffer
+    QVector<Match> m_screenMatches;
+    qint64 m_scannedFrom;
+    qint64 m_scannedTo;
+
+    QThreadPool m_pool;
+    std::atomic<int> m_generation; // of the pattern, to drop stale results
+    bool m_jobRunning;
+    QTimer m_updateTimer;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(TerminalSearch::Options)
+
+#endif // TERMINALSEARCH_H
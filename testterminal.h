@@ -0,0 +1,54 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TESTTERMINAL_H
+#define TESTTERMINAL_H
+
+#include <memory>
+
+#include "terminal.h"
+
+// A Terminal that is fed its output directly, without a pty. Used by the tests
+// and the benchmarks.
+class TestTerminal : public Terminal
+{
+public:
+    void insertInBuffer(const QString& characters)
+    {
+        Terminal::insertInBuffer(characters);
+    }
+
+    int pendingSequenceCapacity() const
+    {
+        return escSeq.capacity() + oscSeq.capacity();
+    }
+
+    int pendingEscape() const { return escape; }
+    bool pendingSequenceOverflowed() const { return escapeOverflow; }
+
+    void ansiSequence(const QString& seq) { Terminal::ansiSequence(seq); }
+    void insertAtCursor(QChar c) { Terminal::insertAtCursor(c); }
+    void scrollFwd(int lines) { Terminal::scrollFwd(lines); }
+};
+
+#if defined(TEST_MODE)
+// A 100x100 TestTerminal, creating the Util it reads its settings through if
+// there is none yet.
+std::unique_ptr<TestTerminal> setupTestTerminal();
+#endif
+
+#endif // TESTTERMINAL_H
@@ -20,11 +20,28 @@
 #include <QCursor>
 #include <QFontMetrics>
 #include <QGuiApplication>
+#include <QQuickWindow>
 #include <cmath>
+#include <memory>
 
+#include "blinkclock.h"
+#include "catch.hpp"
+#include "latencyprobe.h"
 #include "parser.h"
+#include "sessionmanager.h"
+#include "startupprofile.h"
 #include "terminal.h"
+#include "terminalsearch.h"
 #include "textrender.h"
+#include "trace.h"
+
+#if defined(TEST_MODE)
+#    include <QQmlComponent>
+#    include <QQmlEngine>
+
+#    include "allocationcounter.h"
+#    include "utilities.h"
+#endif
 
 /*!
  * \internal
@@ -44,9 +61,14 @@
  * TextRender
  *      contentItem
  *          backgroundContainer
- *              cellDelegates
+ *              rows
+ *                  cellDelegates
  *          textContainer
- *              cellContentsDelegates
+ *              rows
+ *                  cellContentsDelegates
+ *          blinkContainer
+ *              rows
+ *                  cellContentsDelegates (blinking text only)
  *          overlayContainer
  *              cursorDelegate
  *              selectionDelegates
@@ -57,6 +79,18 @@
  * mobile UX for instance, where the keyboard is placed inside TextRender, and
  * opacity on the keyboard and TextRender's contentItem are swapped when the
  * keyboard transitions to and from active state.
+ *
+ * Each line on screen gets a row container in both the background and text
+ * containers. Rows are retained between paints, and a row is only rebuilt if
+ * the line it shows has changed. If the contents just moved (scrolling), the
+ * row is moved rather than rebuilt.
+ *
+ * Blinking text goes into the blinkContainer rather than the textContainer, so
+ * that blinking is a matter of toggling the visibility of a single item. The
+ * phase comes from the window's BlinkClock, which is shared by every TextRender
+ * in the window (and by the cursor delegate, through the blinkOn property). A
+ * TextRender only holds on to the clock while it shows blinking text or the
+ * cursor, so the clock stops when nothing on screen blinks.
  */
 
 TextRender::TextRender(QQuickItem* parent)
@@ -66,17 +100,28 @@ TextRender::TextRender(QQuickItem* parent)
     , m_contentItem(0)
     , m_backgroundContainer(0)
     , m_textContainer(0)
+    , m_blinkContainer(0)
     , m_overlayContainer(0)
     , m_cellDelegate(0)
     , m_cellContentsDelegate(0)
+    , m_rowColumns(0)
+    , m_rowInverseVideoMode(false)
     , m_cursorDelegate(0)
     , m_cursorDelegateInstance(0)
     , m_selectionDelegate(0)
     , m_topSelectionDelegateInstance(0)
     , m_middleSelectionDelegateInstance(0)
     , m_bottomSelectionDelegateInstance(0)
+    , m_searchHighlightDelegate(0)
+    , m_searchConnected(false)
     , m_dragMode(DragScroll)
     , m_dispatch_timer(0)
+    , m_contentsDirty(true)
+    , m_scrollOffset(0)
+    , m_flickTimer(0)
+    , m_flickVelocity(0)
+    , m_blinkClockUser(false)
+    , m_terminal(new Terminal(this))
 {
     setAcceptedMouseButtons(Qt::LeftButton);
     setCursor(Qt::IBeamCursor);
@@ -88,42 +133,246 @@ TextRender::TextRender(QQuickItem* parent)
 
     iShowBufferScrollIndicator = false;
 
-    connect(&m_terminal, SIGNAL(windowTitleChanged(const QString&)), this, SLOT(handleTitleChanged(const QString&)));
-    connect(&m_terminal, SIGNAL(visualBell()), this, SIGNAL(visualBell()));
-    connect(&m_terminal, SIGNAL(hangupReceived()), this, SIGNAL(hangupReceived()));
-    connect(&m_terminal, SIGNAL(displayBufferChanged()), this, SLOT(redraw()));
-    connect(&m_terminal, SIGNAL(displayBufferChanged()), this, SIGNAL(displayBufferChanged()));
-    connect(&m_terminal, SIGNAL(cursorPosChanged(QPoint)), this, SLOT(redraw()));
-    connect(&m_terminal, SIGNAL(termSizeChanged(int, int)), this, SLOT(redraw()));
-    connect(&m_terminal, SIGNAL(termSizeChanged(int, int)), this, SIGNAL(terminalSizeChanged()));
-    connect(&m_terminal, SIGNAL(selectionChanged()), this, SLOT(redraw()));
-    connect(&m_terminal, SIGNAL(scrollBackBufferAdjusted(bool)), this, SLOT(handleScrollBack(bool)));
-    connect(&m_terminal, SIGNAL(selectionChanged()), this, SIGNAL(selectionChanged()));
+    connectTerminal();
+}
+
+void TextRender::connectTerminal()
+{
+    connect(m_terminal, SIGNAL(windowTitleChanged(const QString&)), this, SLOT(handleTitleChanged(const QString&)));
+    connect(m_terminal, SIGNAL(visualBell()), this, SIGNAL(visualBell()));
+    connect(m_terminal, SIGNAL(hangupReceived()), this, SIGNAL(hangupReceived()));
+    connect(m_terminal, SIGNAL(displayBufferChanged()), this, SLOT(redraw()));
+    connect(m_terminal, SIGNAL(displayBufferChanged()), this, SIGNAL(displayBufferChanged()));
+    connect(m_terminal, SIGNAL(cursorPosChanged(QPoint)), this, SLOT(redrawOverlay()));
+    connect(m_terminal, SIGNAL(termSizeChanged(int, int)), this, SLOT(redraw()));
+    connect(m_terminal, SIGNAL(termSizeChanged(int, int)), this, SIGNAL(terminalSizeChanged()));
+    connect(m_terminal, SIGNAL(selectionChanged()), this, SLOT(redrawOverlay()));
+    connect(m_terminal, SIGNAL(scrollBackBufferAdjusted(bool)), this, SLOT(handleScrollBack(bool)));
+    connect(m_terminal, SIGNAL(selectionChanged()), this, SIGNAL(selectionChanged()));
+
+    // Connected to once there is a search, by terminalSearch().
+    m_searchConnected = false;
+}
+
+/*! \internal
+ *
+ * The terminal's search, created and connected to the first time it is used.
+ * Until then, the search properties read as having no matches, and painting
+ * doesn't create one.
+ */
+TerminalSearch* TextRender::terminalSearch()
+{
+    TerminalSearch* search = m_terminal->search();
+    if (!m_searchConnected) {
+        connect(search, SIGNAL(matchesChanged()), this, SLOT(redrawOverlay()));
+        connect(search, SIGNAL(matchesChanged()), this, SIGNAL(searchChanged()));
+        connect(search, SIGNAL(currentChanged()), this, SLOT(showSearchMatch()));
+        connect(search, SIGNAL(currentChanged()), this, SIGNAL(searchChanged()));
+        connect(search, SIGNAL(busyChanged()), this, SIGNAL(searchChanged()));
+        m_searchConnected = true;
+    }
+    return search;
 }
 
 TextRender::~TextRender()
 {
+    if (m_blinkClock && m_blinkClockUser)
+        m_blinkClock->removeUser(this);
+    qDeleteAll(m_rows);
+    qDeleteAll(m_freeRows);
 }
 
 const QStringList TextRender::printableLinesFromCursor(int lines)
 {
-    return m_terminal.printableLinesFromCursor(lines);
+    return m_terminal->printableLinesFromCursor(lines);
 }
 
 void TextRender::putString(QString str)
 {
-    m_terminal.putString(str);
+    m_terminal->putString(str);
 }
 
 const QStringList TextRender::grabURLsFromBuffer()
 {
-    return m_terminal.grabURLsFromBuffer();
+    return m_terminal->grabURLsFromBuffer();
+}
+
+/*!
+ * Approximate memory used by this terminal's buffers, in bytes, along with the
+ * scrollback of all terminals together (which the
+ * terminal/scrollbackMemoryLimit setting applies to).
+ */
+QVariantMap TextRender::memoryUsage() const
+{
+    QVariantMap usage;
+    usage["screen"] = m_terminal->screenMemoryUsage();
+    usage["altScreen"] = m_terminal->altScreenMemoryUsage();
+    usage["scrollback"] = m_terminal->backBufferMemoryUsage();
+    usage["scrollbackLines"] = m_terminal->backBuffer().size();
+    usage["total"] = m_terminal->screenMemoryUsage() + m_terminal->altScreenMemoryUsage() + m_terminal->backBufferMemoryUsage();
+    usage["allScrollback"] = Terminal::totalBackBufferMemoryUsage();
+    return usage;
 }
 
 void TextRender::componentComplete()
 {
     QQuickItem::componentComplete();
-    m_terminal.init();
+
+    // Pick up a detached session if asked to, or the one started ahead of the
+    // window, or start a new one.
+    SessionManager* sessions = SessionManager::instance();
+    Terminal* session = sessions ? sessions->takeSessionToAttach() : 0;
+    if (!session && sessions)
+        session = sessions->takePrestarted();
+    if (session)
+        attachSession(session);
+    else
+        m_terminal->init();
+}
+
+/*!
+ * Hand the session over to the SessionManager, to be kept running until it is
+ * attached again. Used when closing a window. This is left with a blank
+ * terminal of its own, and should be deleted right after.
+ */
+void TextRender::detachSession()
+{
+    SessionManager* sessions = SessionManager::instance();
+    if (!sessions || !m_terminal->isRunning())
+        return;
+
+    if (m_searchConnected) {
+        m_terminal->search()->stop();
+        disconnect(m_terminal->search(), 0, this, 0);
+    }
+    disconnect(m_terminal, 0, this, 0);
+    sessions->detach(m_terminal);
+    m_terminal = new Terminal(this);
+    connectTerminal();
+}
+
+/*!
+ * Show \a session, detached from some other TextRender earlier, or started
+ * ahead of it. It has been parsed all along, so only the screen needs to be
+ * laid out again.
+ */
+void TextRender::attachSession(Terminal* session)
+{
+    delete m_terminal;
+    m_terminal = session;
+    m_terminal->setParent(this);
+    m_terminal->setThrottled(!isVisible());
+    connectTerminal();
+
+    handleTitleChanged(m_terminal->windowTitle());
+    emit terminalSizeChanged();
+    emit displayBufferChanged();
+    redraw();
+
+    // Once whoever created us has connected to it.
+    if (!m_terminal->isRunning())
+        QMetaObject::invokeMethod(this, "hangupReceived", Qt::QueuedConnection);
+}
+
+// Report the frames of a window to whichever probes are on. This is done once
+// per window, however many TextRenders (tabs) it has, so that each frame is
+// counted once and the connections go away with the window.
+static void hookFrames(QQuickWindow* window)
+{
+    // Emitted on the render thread, hence the direct connections.
+    if (LatencyProbe::isEnabled()) {
+        QObject::connect(window, &QQuickWindow::frameSwapped, window, []() {
+            LatencyProbe::mark(LatencyProbe::Presented);
+        }, Qt::DirectConnection);
+    }
+    if (StartupProfile::isEnabled() && !StartupProfile::isComplete()) {
+        // Only until the first output is on screen, after which marking is of
+        // no use and would take the profile's lock every frame.
+        auto connection = std::make_shared<QMetaObject::Connection>();
+        *connection = QObject::connect(window, &QQuickWindow::frameSwapped, window, [connection]() {
+            StartupProfile::mark(StartupProfile::FirstFrame);
+            StartupProfile::mark(StartupProfile::OutputPresented);
+            if (StartupProfile::isComplete())
+                QObject::disconnect(*connection);
+        }, Qt::DirectConnection);
+    }
+    if (LITERM_TRACE_ENABLED()) {
+        QObject::connect(window, &QQuickWindow::frameSwapped, window, []() {
+            LITERM_TRACE_INSTANT("render", "frameSwapped");
+        }, Qt::DirectConnection);
+    }
+}
+
+void TextRender::itemChange(ItemChange change, const ItemChangeData& value)
+{
+    if (change == ItemSceneChange) {
+        // Each window has its own clock; move over to the new one.
+        if (m_blinkClock) {
+            if (m_blinkClockUser)
+                m_blinkClock->removeUser(this);
+            disconnect(m_blinkClock, SIGNAL(phaseChanged()), this, SLOT(handleBlinkPhase()));
+            m_blinkClock = 0;
+            m_blinkClockUser = false;
+        }
+        if (value.window) {
+            // The clock is made along with the first TextRender in the window,
+            // which is when its frames get hooked up, too.
+            if (!value.window->findChild<BlinkClock*>(QString(), Qt::FindDirectChildrenOnly))
+                hookFrames(value.window);
+            m_blinkClock = BlinkClock::forWindow(value.window);
+            connect(m_blinkClock, SIGNAL(phaseChanged()), this, SLOT(handleBlinkPhase()));
+            polish();
+        }
+        handleBlinkPhase();
+    } else if (change == ItemVisibleHasChanged) {
+        // Nothing is painted while hidden, and the terminal parses in larger
+        // batches; catch up in one go when shown again.
+        m_terminal->setThrottled(!isVisible());
+        if (isVisible())
+            polish();
+        updateBlinkClock();
+    }
+
+    QQuickItem::itemChange(change, value);
+}
+
+bool TextRender::blinkOn() const
+{
+    return !m_blinkClock || m_blinkClock->isOn();
+}
+
+void TextRender::handleBlinkPhase()
+{
+    if (m_blinkContainer)
+        m_blinkContainer->setVisible(blinkOn());
+    emit blinkOnChanged();
+}
+
+/*! \internal
+ *
+ * Hold on to the window's blink clock only while something on screen blinks,
+ * so that it can stop when nothing does.
+ */
+void TextRender::updateBlinkClock()
+{
+    if (!m_blinkClock)
+        return;
+
+    bool blinks = false;
+    if (isVisible()) {
+        blinks = m_cursorDelegateInstance && m_cursorDelegateInstance->isVisible();
+        for (int i = 0; !blinks && i < m_rows.size(); i++)
+            blinks = m_rows.at(i)->blinks;
+    }
+
+    if (blinks == m_blinkClockUser)
+        return;
+
+    m_blinkClockUser = blinks;
+    if (blinks)
+        m_blinkClock->addUser(this);
+    else
+        m_blinkClock->removeUser(this);
 }
 
 void TextRender::copy()
@@ -137,7 +386,7 @@ void TextRender::paste()
 {
     QClipboard* cb = QGuiApplication::clipboard();
     QString cbText = cb->text();
-    m_terminal.paste(cbText);
+    m_terminal->paste(cbText);
 }
 
 bool TextRender::canPaste() const
@@ -149,17 +398,17 @@ bool TextRender::canPaste() const
 
 void TextRender::deselect()
 {
-    m_terminal.clearSelection();
+    m_terminal->clearSelection();
 }
 
 QString TextRender::selectedText() const
 {
-    return m_terminal.selectedText();
+    return m_terminal->selectedText();
 }
 
 QSize TextRender::terminalSize() const
 {
-    return QSize(m_terminal.columns(), m_terminal.rows());
+    return QSize(m_terminal->columns(), m_terminal->rows());
 }
 
 QString TextRender::title() const
@@ -199,8 +448,11 @@ void TextRender::setContentItem(QQuickItem* contentItem)
     m_backgroundContainer->setClip(true);
     m_textContainer = new QQuickItem(m_contentItem);
     m_textContainer->setClip(true);
+    m_blinkContainer = new QQuickItem(m_contentItem);
+    m_blinkContainer->setClip(true);
     m_overlayContainer = new QQuickItem(m_contentItem);
     m_overlayContainer->setClip(true);
+    m_contentsDirty = true;
     polish();
 }
 
@@ -219,6 +471,7 @@ void TextRender::setFont(const QFont& font)
 
     iFontDescent = fontMetrics.descent();
 
+    invalidateRows();
     polish();
     emit fontChanged();
     emit cellSizeChanged();
@@ -233,17 +486,17 @@ QFont TextRender::font() const
  *
  * Fetch a cell from the free list (or allocate a new one, if required)
  */
-QQuickItem* TextRender::fetchFreeCell()
+QQuickItem* TextRender::fetchFreeCell(Row* row)
 {
     QQuickItem* it = nullptr;
     if (!m_freeCells.isEmpty()) {
-        it = m_freeCells.takeFirst();
+        it = m_freeCells.takeLast();
     } else {
         it = qobject_cast<QQuickItem*>(m_cellDelegate->create(qmlContext(this)));
     }
 
-    it->setParentItem(m_backgroundContainer);
-    m_cells.append(it);
+    it->setParentItem(row->background);
+    row->cells.append(it);
     return it;
 }
 
@@ -251,22 +504,90 @@ QQuickItem* TextRender::fetchFreeCell()
  *
  * Fetch a content cell from the free list (or allocate a new one, if required)
  */
-QQuickItem* TextRender::fetchFreeCellContent()
+QQuickItem* TextRender::fetchFreeCellContent(Row* row, bool blinking)
 {
     QQuickItem* it = nullptr;
     if (!m_freeCellsContent.isEmpty()) {
-        it = m_freeCellsContent.takeFirst();
+        it = m_freeCellsContent.takeLast();
     } else {
         it = qobject_cast<QQuickItem*>(m_cellContentsDelegate->create(qmlContext(this)));
     }
 
-    it->setParentItem(m_textContainer);
-    m_cellsContent.append(it);
+    if (blinking) {
+        it->setParentItem(row->blink);
+        row->blinks = true;
+    } else {
+        it->setParentItem(row->text);
+    }
+    row->cellsContent.append(it);
     return it;
 }
 
+/*! \internal
+ *
+ * Fetch a row from the free list (or allocate a new one, if required)
+ *
+ * A row is a set of containers, one each in the background, text and blink
+ * containers, holding the delegates for a single line of the terminal.
+ */
+TextRender::Row* TextRender::fetchFreeRow()
+{
+    if (!m_freeRows.isEmpty())
+        return m_freeRows.takeLast();
+
+    Row* row = new Row;
+    row->background = new QQuickItem(m_backgroundContainer);
+    row->text = new QQuickItem(m_textContainer);
+    row->blink = new QQuickItem(m_blinkContainer);
+    row->blinks = false;
+    return row;
+}
+
+/*! \internal
+ *
+ * Return a row (and its delegates) to the free lists.
+ */
+void TextRender::recycleRow(Row* row)
+{
+    for (QQuickItem* it : row->cells)
+        it->setVisible(false);
+    for (QQuickItem* it : row->cellsContent)
+        it->setVisible(false);
+    m_freeCells += row->cells;
+    m_freeCellsContent += row->cellsContent;
+    row->cells.clear();
+    row->cellsContent.clear();
+    row->line = TerminalLine();
+    row->background->setVisible(false);
+    row->text->setVisible(false);
+    row->blink->setVisible(false);
+    row->blinks = false;
+    m_freeRows.append(row);
+}
+
+/*! \internal
+ *
+ * Throw away all retained rows, so that the next paint builds them from scratch.
+ * This must be called whenever something other than the line contents affects
+ * how a row looks (font, columns, inverse video, delegates).
+ */
+void TextRender::invalidateRows()
+{
+    for (Row* row : m_rows) {
+        if (row)
+            recycleRow(row);
+    }
+    m_rows.clear();
+    m_contentsDirty = true;
+}
+
 void TextRender::updatePolish()
 {
+    if (!isVisible())
+        return;
+
+    LITERM_TRACE_SPAN(span, "render", "updatePolish");
+
     // ### these should be handled more carefully
     emit contentYChanged();
     emit visibleHeightChanged();
@@ -274,59 +595,169 @@ void TextRender::updatePolish()
 
     // Make sure the terminal's size is right
     QSize size((width() - 4) / iFontWidth, (height() - 4) / iFontHeight);
-    m_terminal.setTermSize(size);
+    m_terminal->setTermSize(size);
 
-    if (!m_contentItem || m_terminal.rows() == 0 || m_terminal.columns() == 0)
+    if (!m_contentItem || m_terminal->rows() == 0 || m_terminal->columns() == 0)
         return;
 
+    m_terminal->markViewed();
+
     m_contentItem->setWidth(width());
     m_contentItem->setHeight(height());
     m_backgroundContainer->setWidth(width());
     m_backgroundContainer->setHeight(height());
     m_textContainer->setWidth(width());
     m_textContainer->setHeight(height());
+    m_blinkContainer->setWidth(width());
+    m_blinkContainer->setHeight(height());
     m_overlayContainer->setWidth(width());
     m_overlayContainer->setHeight(height());
 
-    // Push everything back to the free list.
-    // We could optimize this by having a "dirty" area from the terminal backend.
-    m_freeCells += m_cells;
-    m_freeCellsContent += m_cellsContent;
+    if (m_contentsDirty) {
+        m_contentsDirty = false;
+        paintContents();
+    }
+
+    paintOverlay();
+    updateBlinkClock();
 
-    m_cells.clear();
-    m_cellsContent.clear();
+#if defined(LITERM_TRACING)
+    if (LITERM_TRACE_ENABLED()) {
+        int cells = 0;
+        for (const Row* row : qAsConst(m_rows))
+            cells += row->cells.size() + row->cellsContent.size();
+        LITERM_TRACE_COUNTER("render", "delegates", cells);
+        LITERM_TRACE_COUNTER("render", "freeDelegates", m_freeCells.size() + m_freeCellsContent.size());
+    }
+#endif
+
+    LatencyProbe::mark(LatencyProbe::Polished);
+    StartupProfile::mark(StartupProfile::OutputPolished);
+}
 
-    qreal y = 0;
-    int yDelegateIndex = 0;
-    if (m_terminal.backBufferScrollPos() != 0 && m_terminal.backBuffer().size() > 0) {
-        int from = m_terminal.backBuffer().size() - m_terminal.backBufferScrollPos();
+/*! \internal
+ *
+ * Rebuild the cell and cell contents delegates from the terminal's buffers.
+ */
+void TextRender::paintContents()
+{
+    LITERM_TRACE_SPAN(span, "render", "paintContents");
+
+    // Collect the lines that intersect the viewport. Only these get rows, so
+    // the cost of a paint does not depend on the size of the back buffer. When
+    // scrolled by a fraction of a line, one extra line is partially visible at
+    // the bottom.
+    int lineCount = m_terminal->rows();
+    if (m_scrollOffset != 0)
+        lineCount++;
+
+    QVector<const TerminalLine*> lines;
+    lines.reserve(lineCount);
+    if (m_terminal->backBufferScrollPos() != 0 && m_terminal->backBuffer().size() > 0) {
+        int from = m_terminal->backBuffer().size() - m_terminal->backBufferScrollPos();
         if (from < 0)
             from = 0;
-        int to = m_terminal.backBuffer().size();
-        if (to - from > m_terminal.rows())
-            to = from + m_terminal.rows();
-        paintFromBuffer(m_terminal.backBuffer(), from, to, y, yDelegateIndex);
-        if (to - from < m_terminal.rows() && m_terminal.buffer().size() > 0) {
-            int to2 = m_terminal.rows() - (to - from);
-            if (to2 > m_terminal.buffer().size())
-                to2 = m_terminal.buffer().size();
-            paintFromBuffer(m_terminal.buffer(), 0, to2, y, yDelegateIndex);
+        int to = m_terminal->backBuffer().size();
+        if (to - from > lineCount)
+            to = from + lineCount;
+        for (int i = from; i < to; i++)
+            lines.append(&m_terminal->backBuffer().at(i));
+        if (to - from < lineCount && m_terminal->buffer().size() > 0) {
+            int to2 = lineCount - (to - from);
+            if (to2 > m_terminal->buffer().size())
+                to2 = m_terminal->buffer().size();
+            for (int i = 0; i < to2; i++)
+                lines.append(&m_terminal->buffer().at(i));
         }
     } else {
-        int count = qMin(m_terminal.rows(), m_terminal.buffer().size());
-        paintFromBuffer(m_terminal.buffer(), 0, count, y, yDelegateIndex);
+        int count = qMin(lineCount, m_terminal->buffer().size());
+        for (int i = 0; i < count; i++)
+            lines.append(&m_terminal->buffer().at(i));
     }
 
-    // any remaining items in the free lists are unused
-    for (QQuickItem* it : m_freeCells) {
-        it->setVisible(false);
+    if (m_terminal->columns() != m_rowColumns || m_terminal->inverseVideoMode() != m_rowInverseVideoMode) {
+        invalidateRows();
+        m_rowColumns = m_terminal->columns();
+        m_rowInverseVideoMode = m_terminal->inverseVideoMode();
     }
-    for (QQuickItem* it : m_freeCellsContent) {
-        it->setVisible(false);
+
+    // Match the lines against the rows we painted last time. A row whose line
+    // still shares its data with the terminal's line is unchanged, and only
+    // needs to be moved. This makes scrolling (either through the back buffer,
+    // or by output scrolling the screen) cost only the newly exposed rows.
+    QVector<Row*> oldRows;
+    oldRows.swap(m_rows);
+    m_rows.resize(lines.size());
+
+    int hint = 0;
+    for (int i = 0; i < lines.size(); i++) {
+        const TerminalLine& line = *lines.at(i);
+
+        // Rows usually move as a block, so try the last offset first.
+        int match = -1;
+        int candidate = i + hint;
+        if (candidate >= 0 && candidate < oldRows.size() && oldRows.at(candidate) && oldRows.at(candidate)->line.isSharedWith(line)) {
+            match = candidate;
+        } else {
+            for (int j = 0; j < oldRows.size(); j++) {
+                if (oldRows.at(j) && oldRows.at(j)->line.isSharedWith(line)) {
+                    match = j;
+                    break;
+                }
+            }
+        }
+
+        if (match != -1) {
+            if (line.size() > 0)
+                hint = match - i;
+            m_rows[i] = oldRows.at(match);
+            oldRows[match] = nullptr;
+        }
+    }
+
+    // Anything left over has scrolled out of view or changed.
+    for (Row* row : oldRows) {
+        if (row)
+            recycleRow(row);
+    }
+
+    const int cutAfter = property("cutAfter").toInt() + iFontDescent;
+    for (int i = 0; i < lines.size(); i++) {
+        Row* row = m_rows.at(i);
+        if (!row) {
+            row = fetchFreeRow();
+            paintRow(row, *lines.at(i));
+            m_rows[i] = row;
+            LITERM_TRACE_ADD(span, "paintedRows", 1);
+        }
+
+        qreal y = iFontHeight * i + iFontDescent + m_scrollOffset;
+
+        qreal opacity = 1.0;
+        if (y - iFontDescent + iFontHeight >= cutAfter)
+            opacity = 0.3;
+
+        row->background->setY(y);
+        row->background->setOpacity(opacity);
+        row->background->setVisible(true);
+        row->text->setY(y);
+        row->text->setOpacity(opacity);
+        row->text->setVisible(true);
+        row->blink->setY(y);
+        row->blink->setOpacity(opacity);
+        row->blink->setVisible(row->blinks);
     }
+}
 
+/*! \internal
+ *
+ * Position the cursor and selection delegates. This is cheap compared to
+ * paintContents(), so cursor movement and selection changes only do this.
+ */
+void TextRender::paintOverlay()
+{
     // cursor
-    if (m_terminal.showCursor()) {
+    if (m_terminal->showCursor()) {
         if (!m_cursorDelegateInstance) {
             m_cursorDelegateInstance = qobject_cast<QQuickItem*>(m_cursorDelegate->create(qmlContext(this)));
             m_cursorDelegateInstance->setVisible(false);
@@ -345,7 +776,7 @@ void TextRender::updatePolish()
         m_cursorDelegateInstance->setVisible(false);
     }
 
-    QRect selection = m_terminal.selection();
+    QRect selection = m_terminal->selection();
     if (!selection.isNull()) {
         if (!m_topSelectionDelegateInstance) {
             m_topSelectionDelegateInstance = qobject_cast<QQuickItem*>(m_selectionDelegate->create(qmlContext(this)));
@@ -377,14 +808,14 @@ void TextRender::updatePolish()
             m_middleSelectionDelegateInstance->setVisible(true);
 
             QPointF start = charsToPixels(selection.topLeft());
-            QPointF end = charsToPixels(QPoint(m_terminal.columns(), selection.top()));
+            QPointF end = charsToPixels(QPoint(m_terminal->columns(), selection.top()));
             m_topSelectionDelegateInstance->setX(start.x());
             m_topSelectionDelegateInstance->setY(start.y());
             m_topSelectionDelegateInstance->setWidth(end.x() - start.x() + fontWidth());
             m_topSelectionDelegateInstance->setHeight(end.y() - start.y() + fontHeight());
 
             start = charsToPixels(QPoint(1, selection.top() + 1));
-            end = charsToPixels(QPoint(m_terminal.columns(), selection.bottom() - 1));
+            end = charsToPixels(QPoint(m_terminal->columns(), selection.bottom() - 1));
 
             m_middleSelectionDelegateInstance->setX(start.x());
             m_middleSelectionDelegateInstance->setY(start.y());
@@ -404,78 +835,118 @@ void TextRender::updatePolish()
         m_bottomSelectionDelegateInstance->setVisible(false);
         m_middleSelectionDelegateInstance->setVisible(false);
     }
+
+    paintSearchHighlights();
 }
 
-void TextRender::paintFromBuffer(const TerminalBuffer& buffer, int from, int to, qreal& y, int& yDelegateIndex)
+/*! \internal
+ *
+ * Position a search highlight delegate over each match in view, reusing the
+ * ones from last time.
+ */
+void TextRender::paintSearchHighlights()
+{
+    QVector<TerminalSearch::Match> matches;
+    TerminalSearch* search = m_searchConnected ? m_terminal->search() : 0;
+    TerminalSearch::Match current;
+    bool hasCurrent = search && search->currentMatch(&current);
+
+    // As paintContents() lays out the lines.
+    qint64 firstLine = m_terminal->droppedLines() + m_terminal->backBuffer().size();
+    if (!m_terminal->useAltScreenBuffer())
+        firstLine -= m_terminal->backBufferScrollPos();
+    if (m_searchHighlightDelegate && search && search->isActive())
+        matches = search->matchesOn(firstLine, m_terminal->rows());
+
+    int used = 0;
+    for (const TerminalSearch::Match& match : matches) {
+        if (match.column >= m_terminal->columns())
+            continue;
+
+        if (used == m_searchHighlights.size()) {
+            QQuickItem* it = qobject_cast<QQuickItem*>(m_searchHighlightDelegate->create(qmlContext(this)));
+            it->setParentItem(m_overlayContainer);
+            m_searchHighlights.append(it);
+        }
+        QQuickItem* it = m_searchHighlights.at(used++);
+
+        QPointF pos = charsToPixels(QPoint(match.column + 1, int(match.line - firstLine) + 1));
+        int length = qMin(match.length, m_terminal->columns() - match.column);
+        it->setX(pos.x());
+        it->setY(pos.y());
+        it->setWidth(length * fontWidth());
+        it->setHeight(fontHeight());
+        it->setProperty("current", hasCurrent && match.line == current.line && match.column == current.column);
+        it->setVisible(true);
+    }
+
+    for (int i = used; i < m_searchHighlights.size(); i++)
+        m_searchHighlights.at(i)->setVisible(false);
+}
+
+/*! \internal
+ *
+ * Build the delegates for a single line into \a row. Delegates are positioned
+ * relative to the row, so the row can later be moved without rebuilding it.
+ */
+void TextRender::paintRow(Row* row, const TerminalLine& lineBuffer)
 {
     const int leftmargin = 2;
-    int cutAfter = property("cutAfter").toInt() + iFontDescent;
 
-    TermChar tmp = m_terminal.zeroChar;
-    TermChar nextAttrib = m_terminal.zeroChar;
-    TermChar currAttrib = m_terminal.zeroChar;
-    qreal currentX = leftmargin;
+    row->line = lineBuffer;
 
-    for (int i = from; i < to; i++, yDelegateIndex++) {
-        y += iFontHeight;
+    TermChar tmp = m_terminal->zeroChar;
+    TermChar nextAttrib = m_terminal->zeroChar;
+    TermChar currAttrib = m_terminal->zeroChar;
+    qreal currentX = leftmargin;
 
-        // ### if the background containers also had a container per row, we
-        // could set the opacity there, rather than on each fragment.
-        qreal opacity = 1.0;
-        if (y >= cutAfter)
-            opacity = 0.3;
+    int xcount = qMin(lineBuffer.size(), m_terminal->columns());
 
-        const auto& lineBuffer = buffer.at(i);
-        int xcount = qMin(lineBuffer.size(), m_terminal.columns());
-
-        // background for the current line
-        currentX = leftmargin;
-        qreal fragWidth = 0;
-        for (int j = 0; j < xcount; j++) {
-            fragWidth += iFontWidth;
-            if (j == 0) {
-                tmp = lineBuffer.at(j);
-                currAttrib = tmp;
-                nextAttrib = tmp;
-            } else if (j < xcount - 1) {
-                nextAttrib = lineBuffer.at(j + 1);
-            }
+    // background for the current line
+    currentX = leftmargin;
+    qreal fragWidth = 0;
+    for (int j = 0; j < xcount; j++) {
+        fragWidth += iFontWidth;
+        if (j == 0) {
+            tmp = lineBuffer.at(j);
+            currAttrib = tmp;
+            nextAttrib = tmp;
+        } else if (j < xcount - 1) {
+            nextAttrib = lineBuffer.at(j + 1);
+        }
 
-            if (currAttrib.attrib != nextAttrib.attrib || currAttrib.bgColor != nextAttrib.bgColor || currAttrib.fgColor != nextAttrib.fgColor || j == xcount - 1) {
-                QQuickItem* backgroundRectangle = fetchFreeCell();
-                drawBgFragment(backgroundRectangle, currentX, y - iFontHeight + iFontDescent, std::ceil(fragWidth), currAttrib);
-                backgroundRectangle->setOpacity(opacity);
-                currentX += fragWidth;
-                fragWidth = 0;
-                currAttrib.attrib = nextAttrib.attrib;
-                currAttrib.bgColor = nextAttrib.bgColor;
-                currAttrib.fgColor = nextAttrib.fgColor;
-            }
+        if (currAttrib.attrib != nextAttrib.attrib || currAttrib.bgColor != nextAttrib.bgColor || currAttrib.fgColor != nextAttrib.fgColor || j == xcount - 1) {
+            QQuickItem* backgroundRectangle = fetchFreeCell(row);
+            drawBgFragment(backgroundRectangle, currentX, 0, std::ceil(fragWidth), currAttrib);
+            currentX += fragWidth;
+            fragWidth = 0;
+            currAttrib.attrib = nextAttrib.attrib;
+            currAttrib.bgColor = nextAttrib.bgColor;
+            currAttrib.fgColor = nextAttrib.fgColor;
         }
+    }
 
-        // text for the current line
-        QString line;
-        currentX = leftmargin;
-        for (int j = 0; j < xcount; j++) {
-            tmp = lineBuffer.at(j);
-            line += tmp.c;
-            if (j == 0) {
-                currAttrib = tmp;
-                nextAttrib = tmp;
-            } else if (j < xcount - 1) {
-                nextAttrib = lineBuffer.at(j + 1);
-            }
+    // text for the current line
+    QString line;
+    currentX = leftmargin;
+    for (int j = 0; j < xcount; j++) {
+        tmp = lineBuffer.at(j);
+        line += tmp.c;
+        if (j == 0) {
+            currAttrib = tmp;
+            nextAttrib = tmp;
+        } else if (j < xcount - 1) {
+            nextAttrib = lineBuffer.at(j + 1);
+        }
 
-            if (currAttrib.attrib != nextAttrib.attrib || currAttrib.bgColor != nextAttrib.bgColor || currAttrib.fgColor != nextAttrib.fgColor || j == xcount - 1) {
-                QQuickItem* foregroundText = fetchFreeCellContent();
-                drawTextFragment(foregroundText, currentX, y - iFontHeight + iFontDescent, line, currAttrib);
-                foregroundText->setOpacity(opacity);
-                currentX += iFontWidth * line.length();
-                line.clear();
-                currAttrib.attrib = nextAttrib.attrib;
-                currAttrib.bgColor = nextAttrib.bgColor;
-                currAttrib.fgColor = nextAttrib.fgColor;
-            }
+        if (currAttrib.attrib != nextAttrib.attrib || currAttrib.bgColor != nextAttrib.bgColor || currAttrib.fgColor != nextAttrib.fgColor || j == xcount - 1) {
+            QQuickItem* foregroundText = fetchFreeCellContent(row, currAttrib.attrib & TermChar::BlinkAttribute);
+            drawTextFragment(foregroundText, currentX, 0, line, currAttrib);
+            currentX += iFontWidth * line.length();
+            line.clear();
+            currAttrib.attrib = nextAttrib.attrib;
+            currAttrib.bgColor = nextAttrib.bgColor;
+            currAttrib.fgColor = nextAttrib.fgColor;
         }
     }
 }
@@ -490,7 +961,7 @@ void TextRender::drawBgFragment(QQuickItem* cellDelegate, qreal x, qreal y, int
 
     QColor qtColor;
 
-    if (m_terminal.inverseVideoMode() && style.bgColor == Parser::fetchDefaultBgColor()) {
+    if (m_terminal->inverseVideoMode() && style.bgColor == Parser::fetchDefaultBgColor()) {
         qtColor = Parser::fetchDefaultFgColor();
     } else {
         qtColor = style.bgColor;
@@ -529,7 +1000,7 @@ void TextRender::drawTextFragment(QQuickItem* cellContentsDelegate, qreal x, qre
 
     QColor qtColor;
 
-    if (m_terminal.inverseVideoMode() && style.fgColor == Parser::fetchDefaultFgColor()) {
+    if (m_terminal->inverseVideoMode() && style.fgColor == Parser::fetchDefaultFgColor()) {
         qtColor = Parser::fetchDefaultBgColor();
     } else {
         qtColor = style.fgColor;
@@ -542,18 +1013,14 @@ void TextRender::drawTextFragment(QQuickItem* cellContentsDelegate, qreal x, qre
     cellContentsDelegate->setProperty("text", text);
     cellContentsDelegate->setProperty("font", iFont);
 
-    if (style.attrib & TermChar::BlinkAttribute) {
-        cellContentsDelegate->setProperty("blinking", true);
-    } else {
-        cellContentsDelegate->setProperty("blinking", false);
-    }
-
     cellContentsDelegate->setVisible(true);
 }
 
 void TextRender::redraw()
 {
-    if (m_dispatch_timer)
+    m_contentsDirty = true;
+
+    if (m_dispatch_timer || !isVisible())
         return;
 
     // instantly polish
@@ -563,11 +1030,27 @@ void TextRender::redraw()
     m_dispatch_timer = startTimer(3);
 }
 
-void TextRender::timerEvent(QTimerEvent*)
+void TextRender::timerEvent(QTimerEvent* event)
 {
+    if (event->timerId() == m_flickTimer) {
+        flick();
+        return;
+    }
+
     killTimer(m_dispatch_timer);
     m_dispatch_timer = 0;
-    polish();
+    if (m_contentsDirty)
+        polish();
+}
+
+/*! \internal
+ *
+ * Only the cursor or selection moved, so there is no need to rebuild the cells.
+ */
+void TextRender::redrawOverlay()
+{
+    if (isVisible())
+        polish();
 }
 
 void TextRender::mousePressEvent(QMouseEvent* event)
@@ -586,8 +1069,11 @@ void TextRender::mousePress(float eventX, float eventY)
 
     dragOrigin = QPointF(eventX, eventY);
 
+    stopFlick();
+    m_dragTimer.start();
+
     if (m_dragMode == DragSelect) {
-        m_terminal.clearSelection();
+        m_terminal->clearSelection();
     }
 }
 
@@ -606,6 +1092,9 @@ void TextRender::mouseMove(float eventX, float eventY)
     QPointF eventPos(eventX, eventY);
 
     if (m_dragMode == DragScroll) {
+        qint64 elapsed = m_dragTimer.restart();
+        if (elapsed > 0)
+            m_flickVelocity = (eventPos.y() - dragOrigin.y()) / elapsed;
         dragOrigin = scrollBackBuffer(eventPos, dragOrigin);
     } else if (m_dragMode == DragSelect) {
         selectionHelper(eventPos, true);
@@ -640,6 +1129,13 @@ void TextRender::mouseRelease(float eventX, float eventY)
             emit panUp();
     } else if (m_dragMode == DragScroll) {
         scrollBackBuffer(eventPos, dragOrigin);
+
+        // Keep going if the finger was still moving when it was lifted.
+        const qreal minimumFlickVelocity = 0.2; // px/ms
+        if (m_dragTimer.elapsed() < 100 && qAbs(m_flickVelocity) > minimumFlickVelocity && !m_terminal->useAltScreenBuffer()) {
+            m_flickClock.start();
+            m_flickTimer = startTimer(16);
+        }
     } else if (m_dragMode == DragSelect) {
         selectionHelper(eventPos, false);
     }
@@ -647,7 +1143,7 @@ void TextRender::mouseRelease(float eventX, float eventY)
 
 void TextRender::keyPressEvent(QKeyEvent* event)
 {
-    m_terminal.keyPress(event->key(), event->modifiers(), event->text());
+    m_terminal->keyPress(event->key(), event->modifiers(), event->text());
 }
 
 void TextRender::wheelEvent(QWheelEvent* event)
@@ -663,7 +1159,7 @@ void TextRender::wheelEvent(QWheelEvent* event)
 
 void TextRender::selectionHelper(QPointF scenePos, bool selectionOngoing)
 {
-    int yCorr = fontDescent();
+    qreal yCorr = fontDescent() - m_scrollOffset;
 
     QPoint start(qRound((dragOrigin.x() + 2) / fontWidth()),
         qRound((dragOrigin.y() + yCorr) / fontHeight()));
@@ -671,23 +1167,28 @@ void TextRender::selectionHelper(QPointF scenePos, bool selectionOngoing)
         qRound((scenePos.y() + yCorr) / fontHeight()));
 
     if (start != end) {
-        m_terminal.setSelection(start, end, selectionOngoing);
+        m_terminal->setSelection(start, end, selectionOngoing);
     }
 }
 
 void TextRender::handleScrollBack(bool reset)
 {
+    if (m_terminal->backBufferScrollPos() == 0) {
+        m_scrollOffset = 0;
+        stopFlick();
+    }
+
     if (reset) {
         setShowBufferScrollIndicator(false);
     } else {
-        setShowBufferScrollIndicator(m_terminal.backBufferScrollPos() != 0);
+        setShowBufferScrollIndicator(m_terminal->backBufferScrollPos() != 0);
     }
     redraw();
 }
 
 QPointF TextRender::cursorPixelPos()
 {
-    return charsToPixels(m_terminal.cursorPos());
+    return charsToPixels(m_terminal->cursorPos());
 }
 
 QPointF TextRender::charsToPixels(QPoint pos)
@@ -695,7 +1196,7 @@ QPointF TextRender::charsToPixels(QPoint pos)
     qreal x = 2;                     // left margin
     x += iFontWidth * (pos.x() - 1); // 0 indexed, so -1
 
-    qreal y = iFontHeight * (pos.y() - 1) + iFontDescent + 1;
+    qreal y = iFontHeight * (pos.y() - 1) + iFontDescent + 1 + m_scrollOffset;
 
     return QPointF(x, y);
 }
@@ -732,9 +1233,8 @@ void TextRender::setCellDelegate(QQmlComponent* component)
     if (m_cellDelegate == component)
         return;
 
-    qDeleteAll(m_cells);
+    invalidateRows();
     qDeleteAll(m_freeCells);
-    m_cells.clear();
     m_freeCells.clear();
     m_cellDelegate = component;
     emit cellDelegateChanged();
@@ -751,9 +1251,8 @@ void TextRender::setCellContentsDelegate(QQmlComponent* component)
     if (m_cellContentsDelegate == component)
         return;
 
-    qDeleteAll(m_cellsContent);
+    invalidateRows();
     qDeleteAll(m_freeCellsContent);
-    m_cellsContent.clear();
     m_freeCellsContent.clear();
     m_cellContentsDelegate = component;
     emit cellContentsDelegateChanged();
@@ -801,43 +1300,404 @@ void TextRender::setSelectionDelegate(QQmlComponent* component)
     polish();
 }
 
+QQmlComponent* TextRender::searchHighlightDelegate() const
+{
+    return m_searchHighlightDelegate;
+}
+
+void TextRender::setSearchHighlightDelegate(QQmlComponent* component)
+{
+    if (m_searchHighlightDelegate == component)
+        return;
+
+    qDeleteAll(m_searchHighlights);
+    m_searchHighlights.clear();
+    m_searchHighlightDelegate = component;
+
+    emit searchHighlightDelegateChanged();
+    polish();
+}
+
+/*!
+ * Search the scrollback and screen for \a pattern, and highlight the matches
+ * with the searchHighlightDelegate. An empty pattern ends the search.
+ */
+void TextRender::search(const QString& pattern, bool regularExpression, bool caseSensitive)
+{
+    TerminalSearch::Options options = TerminalSearch::NoOptions;
+    if (regularExpression)
+        options |= TerminalSearch::RegularExpression;
+    if (caseSensitive)
+        options |= TerminalSearch::CaseSensitive;
+    terminalSearch()->start(pattern, options);
+    emit searchChanged();
+}
+
+void TextRender::searchNext()
+{
+    if (m_searchConnected)
+        m_terminal->search()->next();
+}
+
+void TextRender::searchPrevious()
+{
+    if (m_searchConnected)
+        m_terminal->search()->previous();
+}
+
+void TextRender::endSearch()
+{
+    if (!m_searchConnected)
+        return;
+    m_terminal->search()->stop();
+    emit searchChanged();
+}
+
+int TextRender::searchMatchCount() const
+{
+    return m_searchConnected ? m_terminal->search()->matchCount() : 0;
+}
+
+/*!
+ * The index of the current match, or -1 if there is none.
+ */
+int TextRender::searchCurrentMatch() const
+{
+    return m_searchConnected ? m_terminal->search()->currentIndex() : -1;
+}
+
+/*!
+ * True while the scrollback is still being searched, so that searchMatchCount
+ * may still go up.
+ */
+bool TextRender::searchBusy() const
+{
+    return m_searchConnected && m_terminal->search()->isBusy();
+}
+
+bool TextRender::searchValid() const
+{
+    return !m_searchConnected || m_terminal->search()->isValid();
+}
+
+/*! \internal
+ *
+ * Scroll the back buffer to bring the current search match into view,
+ * centered, if it isn't already.
+ */
+void TextRender::showSearchMatch()
+{
+    TerminalSearch::Match match;
+    if (!m_terminal->search()->currentMatch(&match) || m_terminal->useAltScreenBuffer())
+        return;
+
+    qint64 end = m_terminal->droppedLines() + m_terminal->backBuffer().size();
+    qint64 firstLine = end - m_terminal->backBufferScrollPos();
+    int rows = m_terminal->rows();
+    if (match.line >= firstLine && match.line < firstLine + rows)
+        return;
+
+    qint64 scrollPos = qBound(qint64(0), end - (match.line - rows / 2), qint64(m_terminal->backBuffer().size()));
+    int lines = int(scrollPos - m_terminal->backBufferScrollPos());
+    if (lines > 0)
+        m_terminal->scrollBackBufferBack(lines);
+    else
+        m_terminal->scrollBackBufferFwd(-lines);
+}
+
 int TextRender::contentHeight() const
 {
-    if (m_terminal.useAltScreenBuffer())
-        return m_terminal.buffer().size();
+    if (m_terminal->useAltScreenBuffer())
+        return m_terminal->buffer().size();
     else
-        return m_terminal.buffer().size() + m_terminal.backBuffer().size();
+        return m_terminal->buffer().size() + m_terminal->backBuffer().size();
 }
 
 int TextRender::visibleHeight() const
 {
-    return m_terminal.buffer().size();
+    return m_terminal->buffer().size();
 }
 
 int TextRender::contentY() const
 {
-    if (m_terminal.useAltScreenBuffer())
+    if (m_terminal->useAltScreenBuffer())
         return 0;
 
-    int scrollPos = m_terminal.backBuffer().size() - m_terminal.backBufferScrollPos();
+    int scrollPos = m_terminal->backBuffer().size() - m_terminal->backBufferScrollPos();
     return scrollPos;
 }
 
 QPointF TextRender::scrollBackBuffer(QPointF now, QPointF last)
 {
-    int xdist = qAbs(now.x() - last.x());
-    int ydist = qAbs(now.y() - last.y());
-    int fontSize = fontPointSize();
+    qreal xdist = qAbs(now.x() - last.x());
+    qreal ydist = qAbs(now.y() - last.y());
+
+    if (ydist == 0 || xdist >= ydist * 2)
+        return last;
+
+    if (m_terminal->useAltScreenBuffer()) {
+        // The application does the scrolling, and only understands whole lines.
+        int lines = ydist / iFontHeight;
+        if (lines > 0 && now.y() < last.y()) {
+            m_terminal->scrollBackBufferFwd(lines);
+            last = QPointF(now.x(), last.y() - lines * iFontHeight);
+        } else if (lines > 0 && now.y() > last.y()) {
+            m_terminal->scrollBackBufferBack(lines);
+            last = QPointF(now.x(), last.y() + lines * iFontHeight);
+        }
+        return last;
+    }
+
+    scrollByPixels(now.y() - last.y());
+    return now;
+}
+
+/*! \internal
+ *
+ * Move the view through the back buffer by \a dy pixels (positive is towards
+ * older content).
+ *
+ * The Terminal only knows about whole lines, so the remainder is kept in
+ * m_scrollOffset, which shifts the rows up by a fraction of a line. It is
+ * always in (-fontHeight, 0], and zero whenever the view is at the bottom.
+ *
+ * Returns false if the view could not move any further.
+ */
+bool TextRender::scrollByPixels(qreal dy)
+{
+    // Distance of the view from the bottom of the back buffer, in pixels.
+    qreal current = m_terminal->backBufferScrollPos() * iFontHeight + m_scrollOffset;
+    qreal position = qBound<qreal>(0, current + dy, m_terminal->backBuffer().size() * iFontHeight);
+    if (position == current)
+        return false;
+
+    int lines = std::ceil(position / iFontHeight);
+    m_scrollOffset = position - lines * iFontHeight;
+
+    int delta = lines - m_terminal->backBufferScrollPos();
+    if (delta > 0) {
+        m_terminal->scrollBackBufferBack(delta);
+    } else if (delta < 0) {
+        m_terminal->scrollBackBufferFwd(-delta);
+    } else {
+        // Only the offset changed; the rows just need to be moved.
+        redraw();
+    }
+    return true;
+}
+
+/*! \internal
+ *
+ * Continue a scroll after the drag ended, slowing down over time.
+ */
+void TextRender::flick()
+{
+    qint64 elapsed = m_flickClock.restart();
+    const qreal deceleration = 0.002; // px/ms^2
+
+    if (!scrollByPixels(m_flickVelocity * elapsed)) {
+        stopFlick();
+        return;
+    }
+
+    qreal speed = qMax<qreal>(0, qAbs(m_flickVelocity) - deceleration * elapsed);
+    if (speed == 0) {
+        stopFlick();
+        return;
+    }
+    m_flickVelocity = m_flickVelocity < 0 ? -speed : speed;
+}
+
+void TextRender::stopFlick()
+{
+    if (m_flickTimer) {
+        killTimer(m_flickTimer);
+        m_flickTimer = 0;
+    }
+    m_flickVelocity = 0;
+}
+
+#if defined(TEST_MODE)
+
+struct TextRenderTest
+{
+    static void polish(TextRender* render) { render->updatePolish(); }
+    static bool contentsDirty(TextRender* render) { return render->m_contentsDirty; }
+    static Terminal* terminal(TextRender* render) { return render->m_terminal; }
+
+    static QVector<TerminalLine> rowLines(TextRender* render)
+    {
+        QVector<TerminalLine> lines;
+        for (TextRender::Row* row : qAsConst(render->m_rows))
+            lines.append(row->line);
+        return lines;
+    }
 
-    int lines = ydist / fontSize;
+    // Paint a line into a row of its own, as paintContents() does.
+    static void paintLine(TextRender* render, const TerminalLine& line)
+    {
+        TextRender::Row* row = render->fetchFreeRow();
+        render->paintRow(row, line);
+        render->recycleRow(row);
+    }
+};
 
-    if (lines > 0 && now.y() < last.y() && xdist < ydist * 2) {
-        m_terminal.scrollBackBufferFwd(lines);
-        last = QPointF(now.x(), last.y() - lines * fontSize);
-    } else if (lines > 0 && now.y() > last.y() && xdist < ydist * 2) {
-        m_terminal.scrollBackBufferBack(lines);
-        last = QPointF(now.x(), last.y() + lines * fontSize);
+static TextRender* createTestTextRender(QQmlEngine* engine)
+{
+    if (!Util::instance())
+        new Util("");
+    // Something quiet, so that nothing arrives unasked for.
+    Util::instance()->setSettingsValue("general/execCmd", "cat");
+
+    static bool registered = false;
+    if (!registered) {
+        qmlRegisterType<TextRender>("literm", 1, 0, "TextRender");
+        registered = true;
     }
 
-    return last;
+    QQmlComponent component(engine);
+    component.setData(
+        "import QtQuick 2.0\n"
+        "import literm 1.0\n"
+        "TextRender {\n"
+        "    width: 800; height: 600\n"
+        "    font.family: \"monospace\"; font.pointSize: 10\n"
+        "    contentItem: Item {}\n"
+        "    cellDelegate: Rectangle {}\n"
+        "    cellContentsDelegate: Text { textFormat: Text.PlainText }\n"
+        "    cursorDelegate: Rectangle {}\n"
+        "    selectionDelegate: Rectangle {}\n"
+        "}\n",
+        QUrl());
+    return qobject_cast<TextRender*>(component.create());
 }
+
+// Type a line into cat, and wait for both the echo and cat's copy of it.
+static bool typeLine(TextRender* render, const QString& text)
+{
+    Terminal* terminal = TextRenderTest::terminal(render);
+    int row = terminal->cursorPos().y();
+    render->putString(text + "\r");
+
+    QElapsedTimer timer;
+    timer.start();
+    while (terminal->cursorPos().y() < qMin(row + 2, terminal->rows()) && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    // Let the second half of a split read arrive, too.
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    return terminal->cursorPos().y() >= qMin(row + 2, terminal->rows());
+}
+
+// The lines that polishing repainted rows for, rather than moving the rows
+// it had.
+static QVector<TerminalLine> repaintedLines(TextRender* render, const QVector<TerminalLine>& before)
+{
+    QVector<TerminalLine> painted;
+    for (const TerminalLine& line : TextRenderTest::rowLines(render)) {
+        bool kept = false;
+        for (const TerminalLine& old : before)
+            kept = kept || old.isSharedWith(line);
+        if (!kept)
+            painted.append(line);
+    }
+    return painted;
+}
+
+TEST_CASE("TextRender: Only changed lines are repainted")
+{
+    QQmlEngine engine;
+    std::unique_ptr<TextRender> render(createTestTextRender(&engine));
+    REQUIRE(render);
+
+    REQUIRE(typeLine(render.get(), "warm up"));
+    TextRenderTest::polish(render.get());
+
+    QVector<TerminalLine> before = TextRenderTest::rowLines(render.get());
+    TextRenderTest::polish(render.get());
+    REQUIRE(repaintedLines(render.get(), before).isEmpty());
+
+    // Only the echo and cat's copy of the line.
+    REQUIRE(typeLine(render.get(), "the quick brown fox jumps over the lazy dog"));
+    before = TextRenderTest::rowLines(render.get());
+    TextRenderTest::polish(render.get());
+    REQUIRE(repaintedLines(render.get(), before).size() == 2);
+}
+
+TEST_CASE("TextRender: Allocations per frame", "[!benchmark]")
+{
+    // Qt's containers allocate with malloc(), which is only counted on glibc.
+    if (!AllocationCounter::countsMalloc())
+        return;
+
+    // Reported only. There are no budgets yet: they are to be set from runs on
+    // the supported Qt versions.
+    QQmlEngine engine;
+    std::unique_ptr<TextRender> render(createTestTextRender(&engine));
+    REQUIRE(render);
+
+    // The first frame creates all of the delegates.
+    REQUIRE(typeLine(render.get(), "warm up"));
+    TextRenderTest::polish(render.get());
+
+    AllocationCounter counter;
+    TextRenderTest::polish(render.get());
+    WARN("unchanged frame: " << counter.allocations() << " allocations");
+
+    REQUIRE(typeLine(render.get(), "the quick brown fox jumps over the lazy dog"));
+    const QVector<TerminalLine> before = TextRenderTest::rowLines(render.get());
+    counter.reset();
+    TextRenderTest::polish(render.get());
+    qint64 newLines = counter.allocations();
+
+    // Against painting the same lines on their own, to tell the cost of the
+    // rows from that of the frame around them.
+    const QVector<TerminalLine> painted = repaintedLines(render.get(), before);
+    counter.reset();
+    for (const TerminalLine& line : painted)
+        TextRenderTest::paintLine(render.get(), line);
+    WARN("frame with two new lines: " << newLines << " allocations, " << counter.allocations() << " of them to paint the rows");
+}
+
+TEST_CASE("TextRender: Nothing is painted while hidden")
+{
+    QQmlEngine engine;
+    std::unique_ptr<TextRender> render(createTestTextRender(&engine));
+    REQUIRE(render);
+
+    REQUIRE(typeLine(render.get(), "shown"));
+    TextRenderTest::polish(render.get());
+    REQUIRE(!TextRenderTest::contentsDirty(render.get()));
+
+    // Output still arrives (in larger batches), but isn't painted.
+    render->setVisible(false);
+    REQUIRE(typeLine(render.get(), "hidden"));
+    TextRenderTest::polish(render.get());
+    REQUIRE(TextRenderTest::contentsDirty(render.get()));
+
+    // Showing it again catches up.
+    render->setVisible(true);
+    TextRenderTest::polish(render.get());
+    REQUIRE(!TextRenderTest::contentsDirty(render.get()));
+}
+
+TEST_CASE("TextRender: The search is created when it is first used")
+{
+    QQmlEngine engine;
+    std::unique_ptr<TextRender> render(createTestTextRender(&engine));
+    REQUIRE(render);
+    Terminal* terminal = TextRenderTest::terminal(render.get());
+
+    // Painting and the search properties don't need one.
+    REQUIRE(typeLine(render.get(), "needle"));
+    TextRenderTest::polish(render.get());
+    REQUIRE(render->searchMatchCount() == 0);
+    REQUIRE(render->searchCurrentMatch() == -1);
+    REQUIRE(!render->searchBusy());
+    REQUIRE(render->searchValid());
+    REQUIRE(!terminal->findChild<TerminalSearch*>());
+
+    render->search("needle", false, false);
+    REQUIRE(terminal->findChild<TerminalSearch*>());
+}
+
+#endif // TEST_MODE
@@ -19,10 +19,15 @@
 #ifndef TEXTRENDER_H
 #define TEXTRENDER_H
 
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QVariantMap>
 #include <QQuickItem>
 
 #include "terminal.h"
 
+class BlinkClock;
+
 class TextRender : public QQuickItem
 {
     Q_PROPERTY(QString title READ title NOTIFY titleChanged)
@@ -36,12 +41,18 @@ class TextRender : public QQuickItem
     Q_PROPERTY(QQmlComponent* cellContentsDelegate READ cellContentsDelegate WRITE setCellContentsDelegate NOTIFY cellContentsDelegateChanged)
     Q_PROPERTY(QQmlComponent* cursorDelegate READ cursorDelegate WRITE setCursorDelegate NOTIFY cursorDelegateChanged)
     Q_PROPERTY(QQmlComponent* selectionDelegate READ selectionDelegate WRITE setSelectionDelegate NOTIFY selectionDelegateChanged)
+    Q_PROPERTY(QQmlComponent* searchHighlightDelegate READ searchHighlightDelegate WRITE setSearchHighlightDelegate NOTIFY searchHighlightDelegateChanged)
     Q_PROPERTY(int contentHeight READ contentHeight NOTIFY contentHeightChanged)
     Q_PROPERTY(int visibleHeight READ visibleHeight NOTIFY visibleHeightChanged)
     Q_PROPERTY(int contentY READ contentY NOTIFY contentYChanged)
     Q_PROPERTY(QSize terminalSize READ terminalSize NOTIFY terminalSizeChanged)
     Q_PROPERTY(QString selectedText READ selectedText NOTIFY selectionChanged)
     Q_PROPERTY(bool canPaste READ canPaste NOTIFY clipboardChanged)
+    Q_PROPERTY(bool blinkOn READ blinkOn NOTIFY blinkOnChanged)
+    Q_PROPERTY(int searchMatchCount READ searchMatchCount NOTIFY searchChanged)
+    Q_PROPERTY(int searchCurrentMatch READ searchCurrentMatch NOTIFY searchChanged)
+    Q_PROPERTY(bool searchBusy READ searchBusy NOTIFY searchChanged)
+    Q_PROPERTY(bool searchValid READ searchValid NOTIFY searchChanged)
 
     Q_OBJECT
 public:
@@ -51,6 +62,9 @@ public:
     Q_INVOKABLE const QStringList printableLinesFromCursor(int lines);
     Q_INVOKABLE void putString(QString str);
     Q_INVOKABLE const QStringList grabURLsFromBuffer();
+    Q_INVOKABLE QVariantMap memoryUsage() const;
+
+    void detachSession();
 
     bool canPaste() const;
     Q_INVOKABLE void copy();
@@ -59,12 +73,23 @@ public:
 
     QString selectedText() const;
 
+    Q_INVOKABLE void search(const QString& pattern, bool regularExpression, bool caseSensitive);
+    Q_INVOKABLE void searchNext();
+    Q_INVOKABLE void searchPrevious();
+    Q_INVOKABLE void endSearch();
+    int searchMatchCount() const;
+    int searchCurrentMatch() const;
+    bool searchBusy() const;
+    bool searchValid() const;
+
     int contentHeight() const;
     int visibleHeight() const;
     int contentY() const;
 
     QString title() const;
 
+    bool blinkOn() const;
+
     enum DragMode
     {
         DragOff,
@@ -106,6 +131,8 @@ public:
     void setCursorDelegate(QQmlComponent* delegate);
     QQmlComponent* selectionDelegate() const;
     void setSelectionDelegate(QQmlComponent* delegate);
+    QQmlComponent* searchHighlightDelegate() const;
+    void setSearchHighlightDelegate(QQmlComponent* delegate);
 
 signals:
     void contentItemChanged();
@@ -117,6 +144,7 @@ signals:
     void cellContentsDelegateChanged();
     void cursorDelegateChanged();
     void selectionDelegateChanged();
+    void searchHighlightDelegateChanged();
     void visualBell();
     void titleChanged();
     void dragModeChanged();
@@ -132,9 +160,12 @@ signals:
     void panUp();
     void panDown();
     void hangupReceived();
+    void blinkOnChanged();
+    void searchChanged();
 
 public slots:
     void redraw();
+    void redrawOverlay();
     void mousePress(float eventX, float eventY);
     void mouseMove(float eventX, float eventY);
     void mouseRelease(float eventX, float eventY);
@@ -148,10 +179,13 @@ protected:
     void wheelEvent(QWheelEvent* event) override;
     void timerEvent(QTimerEvent* event) override;
     void componentComplete() override;
+    void itemChange(ItemChange change, const ItemChangeData& value) override;
 
 private slots:
     void handleScrollBack(bool reset);
     void handleTitleChanged(const QString& title);
+    void handleBlinkPhase();
+    void showSearchMatch();
 
 private:
     Q_DISABLE_COPY(TextRender)
@@ -165,9 +199,26 @@ private:
         PanDown
     };
 
+    struct Row
+    {
+        QQuickItem* background;
+        QQuickItem* text;
+        QQuickItem* blink;
+        QVector<QQuickItem*> cells;
+        QVector<QQuickItem*> cellsContent;
+        TerminalLine line;
+        bool blinks;
+    };
+
+    void connectTerminal();
+    TerminalSearch* terminalSearch();
+    void attachSession(Terminal* session);
+    void paintContents();
+    void paintOverlay();
+    void paintSearchHighlights();
+    void paintRow(Row* row, const TerminalLine& line);
     void drawBgFragment(QQuickItem* cellContentsDelegate, qreal x, qreal y, int width, TermChar style);
     void drawTextFragment(QQuickItem* cellContentsDelegate, qreal x, qreal y, QString text, TermChar style);
-    void paintFromBuffer(const TerminalBuffer& buffer, int from, int to, qreal& y, int& yDelegateIndex);
     QPointF charsToPixels(QPoint pos);
     void selectionHelper(QPointF scenePos, bool selectionOngoing);
 
@@ -184,9 +235,16 @@ private:
      * @return The new value for last (modified by any consumed offset)
      **/
     QPointF scrollBackBuffer(QPointF now, QPointF last);
+    bool scrollByPixels(qreal dy);
+    void flick();
+    void stopFlick();
 
-    QQuickItem* fetchFreeCell();
-    QQuickItem* fetchFreeCellContent();
+    QQuickItem* fetchFreeCell(Row* row);
+    QQuickItem* fetchFreeCellContent(Row* row, bool blinking);
+    Row* fetchFreeRow();
+    void recycleRow(Row* row);
+    void invalidateRows();
+    void updateBlinkClock();
 
     QPointF dragOrigin;
     bool m_activeClick;
@@ -201,23 +259,40 @@ private:
     QQuickItem* m_contentItem;
     QQuickItem* m_backgroundContainer;
     QQuickItem* m_textContainer;
+    QQuickItem* m_blinkContainer;
     QQuickItem* m_overlayContainer;
     QQmlComponent* m_cellDelegate;
-    QVector<QQuickItem*> m_cells;
     QVector<QQuickItem*> m_freeCells;
     QQmlComponent* m_cellContentsDelegate;
-    QVector<QQuickItem*> m_cellsContent;
     QVector<QQuickItem*> m_freeCellsContent;
+    QVector<Row*> m_rows;
+    QVector<Row*> m_freeRows;
+    int m_rowColumns;
+    bool m_rowInverseVideoMode;
     QQmlComponent* m_cursorDelegate;
     QQuickItem* m_cursorDelegateInstance;
     QQmlComponent* m_selectionDelegate;
     QQuickItem* m_topSelectionDelegateInstance;
     QQuickItem* m_middleSelectionDelegateInstance;
     QQuickItem* m_bottomSelectionDelegateInstance;
+    QQmlComponent* m_searchHighlightDelegate;
+    QVector<QQuickItem*> m_searchHighlights;
+    bool m_searchConnected;
     DragMode m_dragMode;
     QString m_title;
     int m_dispatch_timer;
-    Terminal m_terminal;
+    bool m_contentsDirty;
+    qreal m_scrollOffset;
+    int m_flickTimer;
+    qreal m_flickVelocity;
+    QElapsedTimer m_flickClock;
+    QElapsedTimer m_dragTimer;
+    // Owned by the window, which may go first.
+    QPointer<BlinkClock> m_blinkClock;
+    bool m_blinkClockUser;
+    Terminal* m_terminal;
+
+    friend struct TextRenderTest;
 };
 
 #endif // TEXTRENDER_H
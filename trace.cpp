@@ -0,0 +1,279 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "catch.hpp"
+#include "trace.h"
+
+#if defined(LITERM_TRACING)
+
+#    include <QCoreApplication>
+#    include <QElapsedTimer>
+#    include <QFile>
+#    include <QMutex>
+#    include <QThread>
+#    include <QVector>
+#    include <QtDebug>
+#    include <algorithm>
+
+/*!
+ * \class Trace
+ * \internal
+ *
+ * Trace collects spans, counters and instant events in memory while enabled,
+ * and writes them out as Chrome trace event JSON when stopped.
+ *
+ * Events may come from the render thread as well as the GUI thread, so
+ * recording takes a lock. Only the pointers to names and keys are stored, and
+ * the number of events is capped, so that a long session doesn't grow without
+ * bound.
+ */
+
+bool Trace::s_enabled = false;
+
+namespace {
+struct Event
+{
+    char phase;
+    const char* category;
+    const char* name;
+    qint64 start;
+    qint64 end;
+    quintptr thread;
+    int argCount;
+    Trace::Arg args[Trace::MaxArgs];
+};
+}
+
+static const int maxEvents = 2000000;
+
+static QMutex s_lock;
+static QElapsedTimer s_clock;
+static QString s_path;
+static QVector<Event> s_events;
+static bool s_overflowed = false;
+
+bool Trace::start(const QString& path)
+{
+    QMutexLocker locker(&s_lock);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write trace to" << path;
+        return false;
+    }
+
+    s_path = path;
+    s_events.clear();
+    s_events.reserve(64 * 1024);
+    s_overflowed = false;
+    s_clock.start();
+    s_enabled = true;
+    return true;
+}
+
+static void appendNumber(QByteArray* out, qint64 ns)
+{
+    // Timestamps are in microseconds, keep the fraction.
+    *out += QByteArray::number(ns / 1000);
+    *out += '.';
+    *out += QByteArray::number(ns % 1000).rightJustified(3, '0');
+}
+
+static QByteArray toJson(const QVector<Event>& events)
+{
+    QByteArray out;
+    out.reserve(events.size() * 120 + 64);
+    out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+    for (int i = 0; i < events.size(); i++) {
+        const Event& e = events.at(i);
+        if (i)
+            out += ",\n";
+        out += "{\"ph\":\"";
+        out += e.phase;
+        out += "\",\"cat\":\"";
+        out += e.category;
+        out += "\",\"name\":\"";
+        out += e.name;
+        out += "\",\"pid\":";
+        out += pid;
+        out += ",\"tid\":";
+        out += QByteArray::number(quint64(e.thread));
+        out += ",\"ts\":";
+        appendNumber(&out, e.start);
+        if (e.phase == 'X') {
+            out += ",\"dur\":";
+            appendNumber(&out, e.end - e.start);
+        } else if (e.phase == 'i') {
+            out += ",\"s\":\"t\"";
+        }
+        if (e.argCount) {
+            out += ",\"args\":{";
+            for (int j = 0; j < e.argCount; j++) {
+                if (j)
+                    out += ',';
+                out += '"';
+                out += e.args[j].key;
+                out += "\":";
+                out += QByteArray::number(e.args[j].value);
+            }
+            out += '}';
+        }
+        out += '}';
+    }
+
+    out += "\n]}\n";
+    return out;
+}
+
+/*!
+ * Stop tracing and write what was collected to the file given to start().
+ */
+bool Trace::stop()
+{
+    QVector<Event> events;
+    QString path;
+    {
+        QMutexLocker locker(&s_lock);
+        if (!s_enabled)
+            return false;
+        s_enabled = false;
+        events.swap(s_events);
+        path = s_path;
+        if (s_overflowed)
+            qWarning() << "Trace was cut short after" << maxEvents << "events";
+    }
+
+    QFile file(path);
+    QByteArray json = toJson(events);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+        qWarning() << "Can't write trace to" << path;
+        return false;
+    }
+    return true;
+}
+
+qint64 Trace::now()
+{
+    return s_clock.nsecsElapsed();
+}
+
+static void record(char phase, const char* category, const char* name, qint64 start, qint64 end, const Trace::Arg* args, int argCount)
+{
+    QMutexLocker locker(&s_lock);
+    if (!Trace::isEnabled())
+        return;
+    if (s_events.size() >= maxEvents) {
+        s_overflowed = true;
+        return;
+    }
+
+    Event e;
+    e.phase = phase;
+    e.category = category;
+    e.name = name;
+    e.start = start;
+    e.end = end;
+    e.thread = quintptr(QThread::currentThreadId());
+    e.argCount = qMin(argCount, int(Trace::MaxArgs));
+    std::copy(args, args + e.argCount, e.args);
+    s_events.append(e);
+}
+
+void Trace::complete(const char* category, const char* name, qint64 start, qint64 end, const Arg* args, int argCount)
+{
+    record('X', category, name, start, end, args, argCount);
+}
+
+/*!
+ * Record \a value for the counter \a name. Viewers draw counters as a graph
+ * over time, named after \a name with a series called "value".
+ */
+void Trace::counter(const char* category, const char* name, qint64 value)
+{
+    Arg arg = { "value", value };
+    qint64 t = now();
+    record('C', category, name, t, t, &arg, 1);
+}
+
+void Trace::instant(const char* category, const char* name)
+{
+    qint64 t = now();
+    record('i', category, name, t, t, 0, 0);
+}
+
+#    if defined(TEST_MODE)
+
+#        include <QJsonArray>
+#        include <QJsonDocument>
+#        include <QJsonObject>
+#        include <QTemporaryDir>
+
+TEST_CASE("Trace: Disabled by default")
+{
+    REQUIRE(!Trace::isEnabled());
+    LITERM_TRACE_SPAN(span, "test", "span");
+    LITERM_TRACE_ARG(span, "value", 1);
+    LITERM_TRACE_COUNTER("test", "counter", 1);
+    LITERM_TRACE_INSTANT("test", "instant");
+    REQUIRE(!Trace::stop());
+}
+
+TEST_CASE("Trace: Writes Chrome trace JSON")
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("trace.json");
+    REQUIRE(Trace::start(path));
+
+    {
+        LITERM_TRACE_SPAN(span, "test", "span");
+        LITERM_TRACE_ARG(span, "bytes", 42);
+        LITERM_TRACE_ADD(span, "csi", 1);
+        LITERM_TRACE_ADD(span, "csi", 2);
+    }
+    LITERM_TRACE_COUNTER("test", "delegates", 7);
+    LITERM_TRACE_INSTANT("test", "frame");
+
+    REQUIRE(Trace::stop());
+    REQUIRE(!Trace::isEnabled());
+
+    QFile file(path);
+    REQUIRE(file.open(QIODevice::ReadOnly));
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    REQUIRE(error.error == QJsonParseError::NoError);
+
+    QJsonArray events = doc.object()["traceEvents"].toArray();
+    REQUIRE(events.size() == 3);
+
+    QJsonObject span = events.at(0).toObject();
+    REQUIRE(span["ph"].toString() == "X");
+    REQUIRE(span["name"].toString() == "span");
+    REQUIRE(span["dur"].toDouble() >= 0);
+    REQUIRE(span["args"].toObject()["bytes"].toInt() == 42);
+    REQUIRE(span["args"].toObject()["csi"].toInt() == 3);
+
+    QJsonObject counter = events.at(1).toObject();
+    REQUIRE(counter["ph"].toString() == "C");
+    REQUIRE(counter["args"].toObject()["value"].toInt() == 7);
+
+    REQUIRE(events.at(2).toObject()["ph"].toString() == "i");
+}
+
+#    endif // TEST_MODE
+
+#endif // LITERM_TRACING
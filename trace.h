@@ -0,0 +1,162 @@
+/*
+    Copyright (C) 2017 Crimson AS <info@crimson.no>
+
+    This work is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This work is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this work.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Tracing of the data path, written as Chrome trace event JSON (which Perfetto
+// and chrome://tracing both open).
+//
+// Build with `qmake CONFIG+=tracing` to compile it in, and run with
+// `-trace FILE` to turn it on. Without CONFIG+=tracing, all of the macros
+// below compile to nothing.
+//
+//   LITERM_TRACE_SPAN(span, "category", "name");   // lasts until end of scope
+//   LITERM_TRACE_ARG(span, "bytes", count);        // attach a value to it
+//   LITERM_TRACE_ADD(span, "csi", 1);              // add to a value
+//   LITERM_TRACE_COUNTER("category", "name", value);
+//   LITERM_TRACE_INSTANT("category", "name");
+//   if (LITERM_TRACE_ENABLED()) { ... }           // for work only a trace needs
+//
+// Names, categories and argument keys must be string literals (or otherwise
+// outlive the trace), as only the pointers are kept.
+
+#if defined(LITERM_TRACING)
+
+#    include <QString>
+#    include <QtGlobal>
+
+class Trace
+{
+public:
+    static bool isEnabled() { return s_enabled; }
+
+    static bool start(const QString& path);
+    static bool stop();
+
+    static qint64 now();
+
+    struct Arg
+    {
+        const char* key;
+        qint64 value;
+    };
+    enum
+    {
+        MaxArgs = 6
+    };
+
+    static void complete(const char* category, const char* name, qint64 start, qint64 end, const Arg* args, int argCount);
+    static void counter(const char* category, const char* name, qint64 value);
+    static void instant(const char* category, const char* name);
+
+private:
+    static bool s_enabled;
+};
+
+class TraceSpan
+{
+public:
+    TraceSpan(const char* category, const char* name)
+        : m_category(category)
+        , m_name(name)
+        , m_start(Q_UNLIKELY(Trace::isEnabled()) ? Trace::now() : -1)
+        , m_argCount(0)
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if (Q_UNLIKELY(m_start >= 0))
+            Trace::complete(m_category, m_name, m_start, Trace::now(), m_args, m_argCount);
+    }
+
+    void setArg(const char* key, qint64 value)
+    {
+        if (Q_LIKELY(m_start < 0))
+            return;
+        for (int i = 0; i < m_argCount; i++) {
+            if (m_args[i].key == key) {
+                m_args[i].value = value;
+                return;
+            }
+        }
+        if (m_argCount < Trace::MaxArgs)
+            m_args[m_argCount++] = { key, value };
+    }
+
+    void addArg(const char* key, qint64 value)
+    {
+        if (Q_LIKELY(m_start < 0))
+            return;
+        for (int i = 0; i < m_argCount; i++) {
+            if (m_args[i].key == key) {
+                m_args[i].value += value;
+                return;
+            }
+        }
+        if (m_argCount < Trace::MaxArgs)
+            m_args[m_argCount++] = { key, value };
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    const char* m_category;
+    const char* m_name;
+    qint64 m_start;
+    int m_argCount;
+    Trace::Arg m_args[Trace::MaxArgs];
+};
+
+#    define LITERM_TRACE_ENABLED() Q_UNLIKELY(Trace::isEnabled())
+#    define LITERM_TRACE_SPAN(span, category, name) TraceSpan span(category, name)
+#    define LITERM_TRACE_ARG(span, key, value) span.setArg(key, value)
+#    define LITERM_TRACE_ADD(span, key, value) span.addArg(key, value)
+#    define LITERM_TRACE_COUNTER(category, name, value)          \
+        do {                                                     \
+            if (Q_UNLIKELY(Trace::isEnabled()))                  \
+                Trace::counter(category, name, value);           \
+        } while (0)
+#    define LITERM_TRACE_INSTANT(category, name)                 \
+        do {                                                     \
+            if (Q_UNLIKELY(Trace::isEnabled()))                  \
+                Trace::instant(category, name);                  \
+        } while (0)
+
+#else
+
+#    define LITERM_TRACE_ENABLED() false
+#    define LITERM_TRACE_SPAN(span, category, name) \
+        do {                                        \
+        } while (0)
+#    define LITERM_TRACE_ARG(span, key, value) \
+        do {                                   \
+        } while (0)
+#    define LITERM_TRACE_ADD(span, key, value) \
+        do {                                   \
+        } while (0)
+#    define LITERM_TRACE_COUNTER(category, name, value) \
+        do {                                            \
+        } while (0)
+#    define LITERM_TRACE_INSTANT(category, name) \
+        do {                                     \
+        } while (0)
+
+#endif // LITERM_TRACING
+
+#endif // TRACE_H
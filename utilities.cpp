@@ -23,6 +23,12 @@
 #include <QGuiApplication>
 #include <QQuickView>
 
+#if defined(TEST_MODE)
+#    include <QSignalSpy>
+#    include <QTemporaryDir>
+#endif
+
+#include "catch.hpp"
 #include "terminal.h"
 #include "textrender.h"
 #include "utilities.h"
@@ -37,10 +43,29 @@ static Util* s_instance;
 Util::Util(const QString& settingsFile, QObject* parent)
     : QObject(parent)
     , m_settings(settingsFile, QSettings::IniFormat)
-    , iWindow(0)
+    , m_snapshot(readSettings(m_settings))
 {
     Q_ASSERT(s_instance == nullptr);
     s_instance = this;
+
+    // Editors and QSettings replace the file rather than write to it, so
+    // watch the directory for it coming back, and let a burst of changes
+    // settle before reading it.
+    m_reloadTimer.setSingleShot(true);
+    m_reloadTimer.setInterval(100);
+    connect(&m_reloadTimer, &QTimer::timeout, this, [this]() {
+        m_settings.sync();
+        reloadSettings();
+    });
+    connect(&m_watcher, SIGNAL(fileChanged(QString)), this, SLOT(settingsFileChanged()));
+    connect(&m_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(settingsFileChanged()));
+    watchSettingsFile();
+
+    // The window properties follow whichever window has focus.
+    if (qGuiApp) {
+        connect(qGuiApp, &QGuiApplication::focusWindowChanged, this, &Util::windowTitleChanged);
+        connect(qGuiApp, &QGuiApplication::focusWindowChanged, this, &Util::windowOrientationChanged);
+    }
 }
 
 Util::~Util()
@@ -55,42 +80,42 @@ Util* Util::instance()
 
 QString Util::panLeftTitle() const
 {
-    return settingsValue("gestures/panLeftTitle", "Alt-Right").toString();
+    return m_snapshot.panLeftTitle;
 }
 
 QString Util::panLeftCommand() const
 {
-    return settingsValue("gestures/panLeftCommand", "\\e\\e[C").toString();
+    return m_snapshot.panLeftCommand;
 }
 
 QString Util::panRightTitle() const
 {
-    return settingsValue("gestures/panRightTitle", "Alt-Left").toString();
+    return m_snapshot.panRightTitle;
 }
 
 QString Util::panRightCommand() const
 {
-    return settingsValue("gestures/panRightCommand", "\\e\\e[D").toString();
+    return m_snapshot.panRightCommand;
 }
 
 QString Util::panDownTitle() const
 {
-    return settingsValue("gestures/panDownTitle", "Page Up").toString();
+    return m_snapshot.panDownTitle;
 }
 
 QString Util::panDownCommand() const
 {
-    return settingsValue("gestures/panDownCommand", "\\e[5~").toString();
+    return m_snapshot.panDownCommand;
 }
 
 QString Util::panUpTitle() const
 {
-    return settingsValue("gestures/panUpTitle", "Page Down").toString();
+    return m_snapshot.panUpTitle;
 }
 
 QString Util::panUpCommand() const
 {
-    return settingsValue("gestures/panUpCommand", "\\e[6~").toString();
+    return m_snapshot.panUpCommand;
 }
 
 QString Util::startupErrorMessage() const
@@ -106,54 +131,98 @@ void Util::setStartupErrorMessage(const QString& message)
 
 QByteArray Util::terminalEmulator() const
 {
-    return m_settings.value("terminal/envVarTERM", "xterm-256color").toByteArray();
+    return m_snapshot.terminalEmulator;
 }
 
 QString Util::terminalCommand() const
 {
-    return m_settings.value("general/execCmd").toString();
+    return m_snapshot.terminalCommand;
+}
+
+/*!
+ * Start the next terminal with \a launch: the command given with -e, or the
+ * command, directory and environment a client asked for (see InstanceServer).
+ */
+void Util::setNextLaunch(const PtyLaunchOptions& launch)
+{
+    m_nextLaunch = launch;
+}
+
+PtyLaunchOptions Util::takeNextLaunch()
+{
+    PtyLaunchOptions launch = m_nextLaunch;
+    m_nextLaunch = PtyLaunchOptions();
+    return launch;
 }
 
 int Util::terminalScrollbackSize() const
 {
-    return m_settings.value("terminal/scrollbackLineLimit", "3000").toInt();
+    return m_snapshot.scrollbackLineLimit;
+}
+
+/*!
+ * The most memory, in bytes, that the scrollback of all terminals together may
+ * use. Set in megabytes; 0 means no limit.
+ */
+qint64 Util::scrollbackMemoryLimit() const
+{
+    return m_snapshot.scrollbackMemoryLimit;
+}
+
+void Util::addWindow(QQuickView* window)
+{
+    if (!window)
+        qFatal("invalid window");
+    m_windows.append(window);
+    connect(window, SIGNAL(contentOrientationChanged(Qt::ScreenOrientation)), this, SIGNAL(windowOrientationChanged()));
+    connect(window, SIGNAL(windowTitleChanged(QString)), this, SIGNAL(windowTitleChanged()));
+    connect(window, &QObject::destroyed, this, [this, window]() { m_windows.removeOne(window); });
 }
 
-void Util::setWindow(QQuickView* win)
+/*!
+ * The window with focus, or failing that the newest one.
+ */
+QQuickView* Util::activeWindow() const
 {
-    if (iWindow)
-        qFatal("Should set window property only once");
-    iWindow = win;
-    if (!iWindow)
-        qFatal("invalid main window");
-    connect(win, SIGNAL(contentOrientationChanged(Qt::ScreenOrientation)), this, SIGNAL(windowOrientationChanged()));
-    connect(win, SIGNAL(windowTitleChanged(QString)), this, SIGNAL(windowTitleChanged()));
+    for (QQuickView* window : m_windows) {
+        if (window == QGuiApplication::focusWindow())
+            return window;
+    }
+    return m_windows.isEmpty() ? 0 : m_windows.last();
 }
 
 void Util::setWindowTitle(QString title)
 {
-    iWindow->setTitle(title);
+    if (QQuickView* window = activeWindow())
+        window->setTitle(title);
     emit windowTitleChanged();
 }
 
 QString Util::windowTitle()
 {
-    return iWindow->title();
+    QQuickView* window = activeWindow();
+    return window ? window->title() : QString();
 }
 
 int Util::windowOrientation()
 {
-    return iWindow->contentOrientation();
+    QQuickView* window = activeWindow();
+    return window ? window->contentOrientation() : Qt::PrimaryOrientation;
 }
 
 void Util::setWindowOrientation(int orientation)
 {
-    iWindow->reportContentOrientationChange(static_cast<Qt::ScreenOrientation>(orientation));
+    if (QQuickView* window = activeWindow())
+        window->reportContentOrientationChange(static_cast<Qt::ScreenOrientation>(orientation));
 }
 
+/*!
+ * Open another window in this process, sharing the QML engine (and with it
+ * everything already loaded) with the others.
+ */
 void Util::openNewWindow()
 {
-    QProcess::startDetached("/usr/bin/literm", QStringList());
+    emit newWindowRequested();
 }
 
 QString Util::getUserMenuXml()
@@ -182,6 +251,165 @@ QVariant Util::settingsValue(QString key, const QVariant& defaultValue) const
 void Util::setSettingsValue(QString key, QVariant value)
 {
     m_settings.setValue(key, value);
+    reloadSettings();
+}
+
+/*!
+ * \internal
+ *
+ * Read all the settings the getters return.
+ */
+Util::Settings Util::readSettings(const QSettings& settings)
+{
+    Settings s;
+    s.terminalEmulator = settings.value("terminal/envVarTERM", "xterm-256color").toByteArray();
+    s.terminalCommand = settings.value("general/execCmd").toString();
+    s.scrollbackLineLimit = settings.value("terminal/scrollbackLineLimit", "3000").toInt();
+    s.scrollbackMemoryLimit = settings.value("terminal/scrollbackMemoryLimit", 128).toLongLong() * 1024 * 1024;
+    s.charset = settings.value("terminal/charset", "UTF-8").toString();
+    s.visualBell = settings.value("general/visualBell", true).toBool();
+    s.keepSessions = settings.value("general/keepSessions", false).toBool();
+    s.blinkInterval = settings.value("general/blinkInterval", 500).toInt();
+
+    s.fontFamily = settings.value("ui/fontFamily").toString();
+    if (s.fontFamily.isEmpty() && qGuiApp) {
+        QFont defaultFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+        s.fontFamily = QFontInfo(defaultFont).family();
+    }
+#if defined(Q_OS_MAC)
+    s.fontSize = settings.value("ui/fontSize", 14).toInt();
+#else
+    s.fontSize = settings.value("ui/fontSize", 11).toInt();
+#endif
+
+#if defined(MOBILE_BUILD)
+    QString defaultDragMode("scroll");
+#elif defined(DESKTOP_BUILD) || defined(TEST_MODE)
+    QString defaultDragMode("select");
+#else
+#    error Unknown default dragMode
+#endif
+    QString dragMode = settings.value("ui/dragMode", defaultDragMode).toString();
+    if (dragMode == "gestures") {
+        s.dragMode = TextRender::DragGestures;
+    } else if (dragMode == "scroll") {
+        s.dragMode = TextRender::DragScroll;
+    } else if (dragMode == "select") {
+        s.dragMode = TextRender::DragSelect;
+    } else {
+        s.dragMode = TextRender::DragOff;
+    }
+
+    QString keyboardMode = settings.value("ui/vkbShowMethod", "move").toString();
+    if (keyboardMode == "fade") {
+        s.keyboardMode = KeyboardFade;
+    } else if (keyboardMode == "move") {
+        s.keyboardMode = KeyboardMove;
+    } else {
+        s.keyboardMode = KeyboardOff;
+    }
+
+    s.keyboardFadeOutDelay = settings.value("ui/keyboardFadeOutDelay", 4000).toInt();
+    s.keyboardLayout = settings.value("ui/keyboardLayout", "english").toString();
+    s.extraLinesFromCursor = settings.value("ui/showExtraLinesFromCursor", 1).toInt();
+    s.keyboardMargins = settings.value("ui/keyboardMargins", 10).toInt();
+    s.keyDelegates = settings.value("ui/keyDelegates", false).toBool();
+    s.keyPressFeedback = settings.value("ui/keyPressFeedback", true).toBool();
+
+    QString orientationMode = settings.value("ui/orientationLockMode", "auto").toString();
+    if (orientationMode == "auto") {
+        s.orientationMode = OrientationAuto;
+    } else if (orientationMode == "landscape") {
+        s.orientationMode = OrientationLandscape;
+    } else {
+        s.orientationMode = OrientationPortrait;
+    }
+
+    s.panLeftTitle = settings.value("gestures/panLeftTitle", "Alt-Right").toString();
+    s.panLeftCommand = settings.value("gestures/panLeftCommand", "\\e\\e[C").toString();
+    s.panRightTitle = settings.value("gestures/panRightTitle", "Alt-Left").toString();
+    s.panRightCommand = settings.value("gestures/panRightCommand", "\\e\\e[D").toString();
+    s.panDownTitle = settings.value("gestures/panDownTitle", "Page Up").toString();
+    s.panDownCommand = settings.value("gestures/panDownCommand", "\\e[5~").toString();
+    s.panUpTitle = settings.value("gestures/panUpTitle", "Page Down").toString();
+    s.panUpCommand = settings.value("gestures/panUpCommand", "\\e[6~").toString();
+    return s;
+}
+
+/*!
+ * \internal
+ *
+ * Replace the settings snapshot with what m_settings has now, and tell about
+ * what changed. Settings written here, or to settings.ini by another literm,
+ * show up in every window this way.
+ */
+void Util::reloadSettings()
+{
+    Settings old = m_snapshot;
+    m_snapshot = readSettings(m_settings);
+    const Settings& s = m_snapshot;
+
+    if (s.fontSize != old.fontSize)
+        emit fontSizeChanged();
+    if (s.dragMode != old.dragMode)
+        emit dragModeChanged();
+    if (s.keyboardMode != old.keyboardMode)
+        emit keyboardModeChanged();
+    if (s.keyboardFadeOutDelay != old.keyboardFadeOutDelay)
+        emit keyboardFadeOutDelayChanged();
+    if (s.keyboardLayout != old.keyboardLayout)
+        emit keyboardLayoutChanged();
+    if (s.orientationMode != old.orientationMode)
+        emit orientationModeChanged();
+
+    if (s.terminalEmulator != old.terminalEmulator
+        || s.terminalCommand != old.terminalCommand
+        || s.scrollbackLineLimit != old.scrollbackLineLimit
+        || s.scrollbackMemoryLimit != old.scrollbackMemoryLimit
+        || s.charset != old.charset
+        || s.visualBell != old.visualBell
+        || s.keepSessions != old.keepSessions
+        || s.blinkInterval != old.blinkInterval
+        || s.fontFamily != old.fontFamily
+        || s.fontSize != old.fontSize
+        || s.dragMode != old.dragMode
+        || s.keyboardMode != old.keyboardMode
+        || s.keyboardFadeOutDelay != old.keyboardFadeOutDelay
+        || s.keyboardLayout != old.keyboardLayout
+        || s.extraLinesFromCursor != old.extraLinesFromCursor
+        || s.keyboardMargins != old.keyboardMargins
+        || s.keyDelegates != old.keyDelegates
+        || s.keyPressFeedback != old.keyPressFeedback
+        || s.orientationMode != old.orientationMode
+        || s.panLeftTitle != old.panLeftTitle
+        || s.panLeftCommand != old.panLeftCommand
+        || s.panRightTitle != old.panRightTitle
+        || s.panRightCommand != old.panRightCommand
+        || s.panDownTitle != old.panDownTitle
+        || s.panDownCommand != old.panDownCommand
+        || s.panUpTitle != old.panUpTitle
+        || s.panUpCommand != old.panUpCommand) {
+        emit settingsChanged();
+    }
+}
+
+void Util::watchSettingsFile()
+{
+    QString file = m_settings.fileName();
+    if (file.isEmpty())
+        return;
+    QString dir = QFileInfo(file).path();
+    if (!m_watcher.directories().contains(dir))
+        m_watcher.addPath(dir);
+    if (!m_watcher.files().contains(file) && QFile::exists(file))
+        m_watcher.addPath(file);
+}
+
+void Util::settingsFileChanged()
+{
+    // A replaced file is no longer watched.
+    watchSettingsFile();
+    m_reloadTimer.start();
 }
 
 QString Util::versionString()
@@ -196,11 +424,7 @@ int Util::uiFontSize()
 
 int Util::fontSize()
 {
-#if defined(Q_OS_MAC)
-    return settingsValue("ui/fontSize", 14).toInt();
-#endif
-
-    return settingsValue("ui/fontSize", 11).toInt();
+    return m_snapshot.fontSize;
 }
 
 void Util::setFontSize(int size)
@@ -210,12 +434,11 @@ void Util::setFontSize(int size)
     }
 
     setSettingsValue("ui/fontSize", size);
-    emit fontSizeChanged();
 }
 
 void Util::keyPressFeedback()
 {
-    if (!settingsValue("ui/keyPressFeedback", true).toBool())
+    if (!m_snapshot.keyPressFeedback)
         return;
 
 #ifdef HAVE_FEEDBACK
@@ -225,7 +448,7 @@ void Util::keyPressFeedback()
 
 void Util::keyReleaseFeedback()
 {
-    if (!settingsValue("ui/keyPressFeedback", true).toBool())
+    if (!m_snapshot.keyPressFeedback)
         return;
 
         // TODO: check what's more comfortable, only press, or press and release
@@ -236,61 +459,31 @@ void Util::keyReleaseFeedback()
 
 bool Util::visualBellEnabled() const
 {
-    return settingsValue("general/visualBell", true).toBool();
-}
-
-int Util::cursorAnimationStartPauseDuration() const
-{
-    return settingsValue("cursor/animation/startPauseDuration", 500).toInt();
-}
-
-int Util::cursorAnimationFadeInDuration() const
-{
-    return settingsValue("cursor/animation/fadeInDuration", 0).toInt();
-}
-
-int Util::cursorAnimationMiddlePauseDuration() const
-{
-    return settingsValue("cursor/animation/middlePauseDuration", 500).toInt();
+    return m_snapshot.visualBell;
 }
 
-int Util::cursorAnimationFadeOutDuration() const
+/*!
+ * Whether the literm server keeps the sessions of a closed window running, to
+ * be attached again with -attach.
+ */
+bool Util::keepSessions() const
 {
-    return settingsValue("cursor/animation/fadeOutDuration", 0).toInt();
+    return m_snapshot.keepSessions;
 }
 
-int Util::cursorAnimationEndPauseDuration() const
+int Util::blinkInterval() const
 {
-    return settingsValue("cursor/animation/endPauseDuration", 0).toInt();
+    return m_snapshot.blinkInterval;
 }
 
 QString Util::fontFamily()
 {
-    QFont defaultFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
-    QFontInfo fi(defaultFont);
-    return settingsValue("ui/fontFamily", fi.family()).toString();
+    return m_snapshot.fontFamily;
 }
 
 TextRender::DragMode Util::dragMode()
 {
-#if defined(MOBILE_BUILD)
-    QString defaultDragMode("scroll");
-#elif defined(DESKTOP_BUILD) || defined(TEST_MODE)
-    QString defaultDragMode("select");
-#else
-#    error Unknown default dragMode
-#endif
-    QString mode = settingsValue("ui/dragMode", defaultDragMode).toString();
-
-    if (mode == "gestures") {
-        return TextRender::DragGestures;
-    } else if (mode == "scroll") {
-        return TextRender::DragScroll;
-    } else if (mode == "select") {
-        return TextRender::DragSelect;
-    } else {
-        return TextRender::DragOff;
-    }
+    return m_snapshot.dragMode;
 }
 
 void Util::setDragMode(TextRender::DragMode mode)
@@ -316,20 +509,11 @@ void Util::setDragMode(TextRender::DragMode mode)
     }
 
     setSettingsValue("ui/dragMode", modeString);
-    emit dragModeChanged();
 }
 
 int Util::keyboardMode()
 {
-    QString mode = settingsValue("ui/vkbShowMethod", "move").toString();
-
-    if (mode == "fade") {
-        return KeyboardFade;
-    } else if (mode == "move") {
-        return KeyboardMove;
-    } else {
-        return KeyboardOff;
-    }
+    return m_snapshot.keyboardMode;
 }
 
 void Util::setKeyboardMode(int mode)
@@ -352,12 +536,11 @@ void Util::setKeyboardMode(int mode)
     }
 
     setSettingsValue("ui/vkbShowMethod", modeString);
-    emit keyboardModeChanged();
 }
 
 int Util::keyboardFadeOutDelay()
 {
-    return settingsValue("ui/keyboardFadeOutDelay", 4000).toInt();
+    return m_snapshot.keyboardFadeOutDelay;
 }
 
 void Util::setKeyboardFadeOutDelay(int delay)
@@ -367,12 +550,11 @@ void Util::setKeyboardFadeOutDelay(int delay)
     }
 
     setSettingsValue("ui/keyboardFadeOutDelay", delay);
-    emit keyboardFadeOutDelayChanged();
 }
 
 QString Util::keyboardLayout()
 {
-    return settingsValue("ui/keyboardLayout", "english").toString();
+    return m_snapshot.keyboardLayout;
 }
 
 void Util::setKeyboardLayout(const QString& layout)
@@ -382,35 +564,35 @@ void Util::setKeyboardLayout(const QString& layout)
     }
 
     setSettingsValue("ui/keyboardLayout", layout);
-    emit keyboardLayoutChanged();
 }
 
 int Util::extraLinesFromCursor()
 {
-    return settingsValue("ui/showExtraLinesFromCursor", 1).toInt();
+    return m_snapshot.extraLinesFromCursor;
 }
 
 QString Util::charset()
 {
-    return settingsValue("terminal/charset", "UTF-8").toString();
+    return m_snapshot.charset;
 }
 
 int Util::keyboardMargins()
 {
-    return settingsValue("ui/keyboardMargins", 10).toInt();
+    return m_snapshot.keyboardMargins;
 }
 
-int Util::orientationMode()
+/*!
+ * Whether the mobile keyboard is made of Key.qml delegates, which are slower
+ * to create and draw than KeyboardItem, but can be restyled in QML.
+ */
+bool Util::keyDelegates()
 {
-    QString mode = settingsValue("ui/orientationLockMode", "auto").toString();
+    return m_snapshot.keyDelegates;
+}
 
-    if (mode == "auto") {
-        return OrientationAuto;
-    } else if (mode == "landscape") {
-        return OrientationLandscape;
-    } else {
-        return OrientationPortrait;
-    }
+int Util::orientationMode()
+{
+    return m_snapshot.orientationMode;
 }
 
 void Util::setOrientationMode(int mode)
@@ -433,7 +615,6 @@ void Util::setOrientationMode(int mode)
     }
 
     setSettingsValue("ui/orientationLockMode", modeString);
-    emit orientationModeChanged();
 }
 
 void Util::notifyText(QString text)
@@ -443,10 +624,13 @@ void Util::notifyText(QString text)
 
 void Util::fakeKeyPress(int key, int modifiers)
 {
+    QQuickView* window = activeWindow();
+    if (!window)
+        return;
     QKeyEvent pev(QEvent::KeyPress, key, Qt::KeyboardModifiers(modifiers));
-    QCoreApplication::sendEvent(iWindow, &pev);
+    QCoreApplication::sendEvent(window, &pev);
     QKeyEvent rev(QEvent::KeyRelease, key, Qt::KeyboardModifiers(modifiers));
-    QCoreApplication::sendEvent(iWindow, &rev);
+    QCoreApplication::sendEvent(window, &rev);
 }
 
 void Util::copyTextToClipboard(QString str)
@@ -456,3 +640,60 @@ void Util::copyTextToClipboard(QString str)
     cb->clear();
     cb->setText(str);
 }
+
+#if defined(TEST_MODE)
+
+struct UtilTest
+{
+    static Util::Settings read(const QSettings& settings) { return Util::readSettings(settings); }
+};
+
+TEST_CASE("Util: Settings are read once, and changes announced")
+{
+    if (Util::instance() == nullptr)
+        new Util("");
+    Util* util = Util::instance();
+
+    QSignalSpy settingsChanged(util, &Util::settingsChanged);
+    QSignalSpy dragModeChanged(util, &Util::dragModeChanged);
+
+    int limit = util->terminalScrollbackSize();
+    util->setSettingsValue("terminal/scrollbackLineLimit", limit + 1);
+    REQUIRE(util->terminalScrollbackSize() == limit + 1);
+    REQUIRE(settingsChanged.count() == 1);
+    REQUIRE(dragModeChanged.count() == 0);
+
+    util->setSettingsValue("terminal/scrollbackLineLimit", limit + 1);
+    REQUIRE(settingsChanged.count() == 1);
+    util->setSettingsValue("terminal/scrollbackLineLimit", limit);
+
+    TextRender::DragMode mode = util->dragMode();
+    util->setDragMode(TextRender::DragOff);
+    REQUIRE(util->dragMode() == TextRender::DragOff);
+    REQUIRE(dragModeChanged.count() == 1);
+    util->setDragMode(mode);
+    REQUIRE(dragModeChanged.count() == 2);
+}
+
+TEST_CASE("Util: Settings snapshot reads settings.ini")
+{
+    QTemporaryDir dir;
+    QString file = dir.path() + "/settings.ini";
+    {
+        QSettings writer(file, QSettings::IniFormat);
+        writer.setValue("terminal/scrollbackLineLimit", 42);
+        writer.setValue("ui/dragMode", "gestures");
+        writer.setValue("ui/vkbShowMethod", "fade");
+    }
+
+    QSettings settings(file, QSettings::IniFormat);
+    auto snapshot = UtilTest::read(settings);
+    REQUIRE(snapshot.scrollbackLineLimit == 42);
+    REQUIRE(snapshot.dragMode == TextRender::DragGestures);
+    REQUIRE(snapshot.keyboardMode == Util::KeyboardFade);
+    REQUIRE(snapshot.charset == "UTF-8");
+    REQUIRE(snapshot.scrollbackMemoryLimit == 128 * 1024 * 1024);
+    REQUIRE(!snapshot.keepSessions);
+}
+
+#endif // TEST_MODE
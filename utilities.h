@@ -21,6 +21,7 @@
 
 #include <QtCore>
 
+#include "ptyiface.h"
 #include "textrender.h"
 
 class Terminal;
@@ -32,34 +33,31 @@ class Util : public QObject
     Q_OBJECT
     Q_PROPERTY(QString windowTitle READ windowTitle WRITE setWindowTitle NOTIFY windowTitleChanged)
     Q_PROPERTY(int windowOrientation READ windowOrientation WRITE setWindowOrientation NOTIFY windowOrientationChanged)
-    Q_PROPERTY(bool visualBellEnabled READ visualBellEnabled CONSTANT)
-    Q_PROPERTY(int cursorAnimationStartPauseDuration READ cursorAnimationStartPauseDuration CONSTANT)
-    Q_PROPERTY(int cursorAnimationFadeInDuration READ cursorAnimationFadeInDuration CONSTANT)
-    Q_PROPERTY(int cursorAnimationMiddlePauseDuration READ cursorAnimationMiddlePauseDuration CONSTANT)
-    Q_PROPERTY(int cursorAnimationFadeOutDuration READ cursorAnimationFadeOutDuration CONSTANT)
-    Q_PROPERTY(int cursorAnimationEndPauseDuration READ cursorAnimationEndPauseDuration CONSTANT)
-    Q_PROPERTY(QString fontFamily READ fontFamily CONSTANT)
+    Q_PROPERTY(bool visualBellEnabled READ visualBellEnabled NOTIFY settingsChanged)
+    Q_PROPERTY(int blinkInterval READ blinkInterval NOTIFY settingsChanged)
+    Q_PROPERTY(QString fontFamily READ fontFamily NOTIFY settingsChanged)
     Q_PROPERTY(int uiFontSize READ uiFontSize CONSTANT)
     Q_PROPERTY(int fontSize READ fontSize WRITE setFontSize NOTIFY fontSizeChanged)
     Q_PROPERTY(TextRender::DragMode dragMode READ dragMode WRITE setDragMode NOTIFY dragModeChanged)
     Q_PROPERTY(int keyboardMode READ keyboardMode WRITE setKeyboardMode NOTIFY keyboardModeChanged)
     Q_PROPERTY(int keyboardFadeOutDelay READ keyboardFadeOutDelay WRITE setKeyboardFadeOutDelay NOTIFY keyboardFadeOutDelayChanged)
     Q_PROPERTY(QString keyboardLayout READ keyboardLayout WRITE setKeyboardLayout NOTIFY keyboardLayoutChanged)
-    Q_PROPERTY(int extraLinesFromCursor READ extraLinesFromCursor CONSTANT)
-    Q_PROPERTY(QString charset READ charset CONSTANT)
-    Q_PROPERTY(int keyboardMargins READ keyboardMargins CONSTANT)
+    Q_PROPERTY(int extraLinesFromCursor READ extraLinesFromCursor NOTIFY settingsChanged)
+    Q_PROPERTY(QString charset READ charset NOTIFY settingsChanged)
+    Q_PROPERTY(int keyboardMargins READ keyboardMargins NOTIFY settingsChanged)
+    Q_PROPERTY(bool keyDelegates READ keyDelegates CONSTANT)
     Q_PROPERTY(int orientationMode READ orientationMode WRITE setOrientationMode NOTIFY orientationModeChanged)
-    Q_PROPERTY(QByteArray terminalEmulator READ terminalEmulator CONSTANT)
-    Q_PROPERTY(QString terminalCommand READ terminalCommand CONSTANT)
-    Q_PROPERTY(int terminalScrollbackSize READ terminalScrollbackSize CONSTANT)
-    Q_PROPERTY(QString panLeftTitle READ panLeftTitle CONSTANT)
-    Q_PROPERTY(QString panLeftCommand READ panLeftCommand CONSTANT)
-    Q_PROPERTY(QString panRightTitle READ panRightTitle CONSTANT)
-    Q_PROPERTY(QString panRightCommand READ panRightCommand CONSTANT)
-    Q_PROPERTY(QString panDownTitle READ panDownTitle CONSTANT)
-    Q_PROPERTY(QString panDownCommand READ panDownCommand CONSTANT)
-    Q_PROPERTY(QString panUpTitle READ panUpTitle CONSTANT)
-    Q_PROPERTY(QString panUpCommand READ panUpCommand CONSTANT)
+    Q_PROPERTY(QByteArray terminalEmulator READ terminalEmulator NOTIFY settingsChanged)
+    Q_PROPERTY(QString terminalCommand READ terminalCommand NOTIFY settingsChanged)
+    Q_PROPERTY(int terminalScrollbackSize READ terminalScrollbackSize NOTIFY settingsChanged)
+    Q_PROPERTY(QString panLeftTitle READ panLeftTitle NOTIFY settingsChanged)
+    Q_PROPERTY(QString panLeftCommand READ panLeftCommand NOTIFY settingsChanged)
+    Q_PROPERTY(QString panRightTitle READ panRightTitle NOTIFY settingsChanged)
+    Q_PROPERTY(QString panRightCommand READ panRightCommand NOTIFY settingsChanged)
+    Q_PROPERTY(QString panDownTitle READ panDownTitle NOTIFY settingsChanged)
+    Q_PROPERTY(QString panDownCommand READ panDownCommand NOTIFY settingsChanged)
+    Q_PROPERTY(QString panUpTitle READ panUpTitle NOTIFY settingsChanged)
+    Q_PROPERTY(QString panUpCommand READ panUpCommand NOTIFY settingsChanged)
     Q_PROPERTY(QString startupErrorMessage READ startupErrorMessage CONSTANT)
 
     Q_ENUMS(KeyboardMode)
@@ -99,9 +97,13 @@ public:
 
     QByteArray terminalEmulator() const;
     QString terminalCommand() const;
+    void setNextLaunch(const PtyLaunchOptions& launch);
+    PtyLaunchOptions takeNextLaunch();
     int terminalScrollbackSize() const;
+    qint64 scrollbackMemoryLimit() const;
 
-    void setWindow(QQuickView* win);
+    void addWindow(QQuickView* window);
+    QList<QQuickView*> windows() const { return m_windows; }
     void setWindowTitle(QString title);
     QString windowTitle();
     int windowOrientation();
@@ -128,12 +130,9 @@ public:
     Q_INVOKABLE void copyTextToClipboard(QString str);
 
     bool visualBellEnabled() const;
+    bool keepSessions() const;
 
-    int cursorAnimationStartPauseDuration() const;
-    int cursorAnimationFadeInDuration() const;
-    int cursorAnimationMiddlePauseDuration() const;
-    int cursorAnimationFadeOutDuration() const;
-    int cursorAnimationEndPauseDuration() const;
+    int blinkInterval() const;
 
     QString fontFamily();
 
@@ -152,11 +151,13 @@ public:
     int extraLinesFromCursor();
     QString charset();
     int keyboardMargins();
+    bool keyDelegates();
 
     int orientationMode();
     void setOrientationMode(int mode);
 
 signals:
+    void newWindowRequested();
     void notify(QString msg);
     void windowTitleChanged();
     void windowOrientationChanged();
@@ -166,13 +167,61 @@ signals:
     void keyboardFadeOutDelayChanged();
     void keyboardLayoutChanged();
     void orientationModeChanged();
+    // Any setting has changed, here or in another process.
+    void settingsChanged();
+
+private slots:
+    void settingsFileChanged();
 
 private:
     Q_DISABLE_COPY(Util)
+    friend struct UtilTest;
+
+    // Everything read from settings.ini, so that reading a setting doesn't
+    // go through QSettings. Replaced as a whole by reloadSettings().
+    struct Settings
+    {
+        QByteArray terminalEmulator;
+        QString terminalCommand;
+        int scrollbackLineLimit;
+        qint64 scrollbackMemoryLimit;
+        QString charset;
+        bool visualBell;
+        bool keepSessions;
+        int blinkInterval;
+        QString fontFamily;
+        int fontSize;
+        TextRender::DragMode dragMode;
+        int keyboardMode;
+        int keyboardFadeOutDelay;
+        QString keyboardLayout;
+        int extraLinesFromCursor;
+        int keyboardMargins;
+        bool keyDelegates;
+        bool keyPressFeedback;
+        int orientationMode;
+        QString panLeftTitle;
+        QString panLeftCommand;
+        QString panRightTitle;
+        QString panRightCommand;
+        QString panDownTitle;
+        QString panDownCommand;
+        QString panUpTitle;
+        QString panUpCommand;
+    };
+
+    static Settings readSettings(const QSettings& settings);
+    void reloadSettings();
+    void watchSettingsFile();
+    QQuickView* activeWindow() const;
 
     QSettings m_settings;
-    QQuickView* iWindow;
+    Settings m_snapshot;
+    QFileSystemWatcher m_watcher;
+    QTimer m_reloadTimer;
+    QList<QQuickView*> m_windows;
     QString m_startupErrorMessage;
+    PtyLaunchOptions m_nextLaunch;
 };
 
 #endif // UTIL_H